@@ -0,0 +1,670 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "aot.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Same frame layout as the JIT: each block is a function taking the
+ * frame of its enclosing block in rdi, static link at [rbp - 8] and
+ * variables from [rbp - 16] down.
+*/
+
+/* State of the assembly writer */
+typedef struct {
+	const ast_t *ast;
+	FILE *stream;
+	/* Block being compiled */
+	int block;
+	/* Counter of local labels */
+	int label;
+} aot_t;
+
+/* Runtime of generated programs, in Linux system calls only */
+static const char *aot_runtime =
+	"\t.text\n"
+	"\t.globl _start\n"
+	"_start:\n"
+	/* Lowest rsp a call may be made from */
+	"\tmov ebx, %d\n"
+	"\tsub rsp, 16\n"
+	"\tmov edi, 3\n" // RLIMIT_STACK
+	"\tmov rsi, rsp\n"
+	"\tmov eax, 97\n" // getrlimit
+	"\tsyscall\n"
+	"\ttest rax, rax\n"
+	"\tjnz 1f\n"
+	"\tmov rax, [rsp]\n"
+	"\tshr rax, 1\n"
+	"\tcmp rax, rbx\n"
+	"\tcmovb rbx, rax\n"
+	"1:\tadd rsp, 16\n"
+	"\tmov rax, rsp\n"
+	"\tsub rax, rbx\n"
+	"\tmov [rip + rt_stack_limit], rax\n"
+	"\txor edi, edi\n"
+	"\tcall pl0_block0\n"
+	"\tcall rt_flush\n"
+	"\tmov eax, 60\n" // exit
+	"\txor edi, edi\n"
+	"\tsyscall\n"
+	"\n"
+	/* Write buffered output to stdout */
+	"rt_flush:\n"
+	"\tmov rdx, [rip + rt_outlen]\n"
+	"\tlea rsi, [rip + rt_outbuf]\n"
+	"1:\ttest rdx, rdx\n"
+	"\tjz 2f\n"
+	"\tmov edi, 1\n"
+	"\tmov eax, 1\n" // write
+	"\tsyscall\n"
+	"\ttest rax, rax\n"
+	"\tjle 2f\n"
+	"\tadd rsi, rax\n"
+	"\tsub rdx, rax\n"
+	"\tjmp 1b\n"
+	"2:\tmov qword ptr [rip + rt_outlen], 0\n"
+	"\tret\n"
+	"\n"
+	/* write(rdi), one number per line */
+	"rt_write:\n"
+	"\tmov rax, rdi\n"
+	"\tlea rsi, [rip + rt_digits + 32]\n"
+	"\tdec rsi\n"
+	"\tmov byte ptr [rsi], 10\n"
+	"\ttest rax, rax\n"
+	"\tjns 1f\n"
+	"\tneg rax\n"
+	"1:\tmov ecx, 10\n"
+	"2:\txor edx, edx\n"
+	"\tdiv rcx\n"
+	"\tadd dl, '0'\n"
+	"\tdec rsi\n"
+	"\tmov [rsi], dl\n"
+	"\ttest rax, rax\n"
+	"\tjnz 2b\n"
+	"\ttest rdi, rdi\n"
+	"\tjns 3f\n"
+	"\tdec rsi\n"
+	"\tmov byte ptr [rsi], '-'\n"
+	"3:\tlea rcx, [rip + rt_digits + 32]\n"
+	"\tsub rcx, rsi\n"
+	"\tmov rax, [rip + rt_outlen]\n"
+	"\tlea rdx, [rax + rcx]\n"
+	"\tcmp rdx, %d\n"
+	"\tjbe 4f\n"
+	"\tpush rsi\n"
+	"\tpush rcx\n"
+	"\tcall rt_flush\n"
+	"\tpop rcx\n"
+	"\tpop rsi\n"
+	"\txor eax, eax\n"
+	"4:\tlea rdi, [rip + rt_outbuf]\n"
+	"\tadd rdi, rax\n"
+	"\tadd rax, rcx\n"
+	"\tmov [rip + rt_outlen], rax\n"
+	"\trep movsb\n"
+	"\tret\n"
+	"\n"
+	/* Next byte of stdin in eax, -1 on end of file */
+	"rt_getc:\n"
+	"\tmov rax, [rip + rt_inpos]\n"
+	"\tcmp rax, [rip + rt_inlen]\n"
+	"\tjb 1f\n"
+	"\txor eax, eax\n" // read
+	"\txor edi, edi\n"
+	"\tlea rsi, [rip + rt_inbuf]\n"
+	"\tmov edx, %d\n"
+	"\tsyscall\n"
+	"\ttest rax, rax\n"
+	"\tjg 2f\n"
+	"\tmov eax, -1\n"
+	"\tret\n"
+	"2:\tmov [rip + rt_inlen], rax\n"
+	"\txor eax, eax\n"
+	"1:\tlea rdx, [rip + rt_inbuf]\n"
+	"\tmovzx edx, byte ptr [rdx + rax]\n"
+	"\tinc rax\n"
+	"\tmov [rip + rt_inpos], rax\n"
+	"\tmov eax, edx\n"
+	"\tret\n"
+	"\n"
+	/* read(rdi), keep variable if no number is available */
+	"rt_read:\n"
+	"\tpush rbx\n"
+	"\tpush r12\n"
+	"\tpush r13\n"
+	"\tmov rbx, rdi\n"
+	"1:\tcall rt_getc\n"
+	"\tcmp eax, -1\n"
+	"\tje 9f\n"
+	"\tcmp eax, ' '\n"
+	"\tjbe 1b\n"
+	"\txor r12d, r12d\n"
+	"\tcmp eax, '-'\n"
+	"\tjne 2f\n"
+	"\tmov r12d, 1\n"
+	"\tcall rt_getc\n"
+	"\tjmp 3f\n"
+	"2:\tcmp eax, '+'\n"
+	"\tjne 3f\n"
+	"\tcall rt_getc\n"
+	"3:\tlea ecx, [rax - '0']\n"
+	"\tcmp ecx, 9\n"
+	"\tja 8f\n"
+	"\txor r13d, r13d\n"
+	"4:\timul r13, r13, 10\n"
+	"\tadd r13, rcx\n"
+	"\tcall rt_getc\n"
+	"\tlea ecx, [rax - '0']\n"
+	"\tcmp ecx, 9\n"
+	"\tjbe 4b\n"
+	"\ttest r12d, r12d\n"
+	"\tjz 5f\n"
+	"\tneg r13\n"
+	"5:\tmov [rbx], r13\n"
+	/* Leave the byte after the number in buffer */
+	"8:\tcmp eax, -1\n"
+	"\tje 9f\n"
+	"\tdec qword ptr [rip + rt_inpos]\n"
+	"9:\tpop r13\n"
+	"\tpop r12\n"
+	"\tpop rbx\n"
+	"\tret\n"
+	"\n"
+	/* Print message rdi of length rsi to stderr, exit with 1 */
+	"rt_fatal:\n"
+	"\tpush rdi\n"
+	"\tpush rsi\n"
+	"\tcall rt_flush\n"
+	"\tpop rdx\n"
+	"\tpop rsi\n"
+	"\tmov edi, 2\n"
+	"\tmov eax, 1\n" // write
+	"\tsyscall\n"
+	"\tmov eax, 60\n" // exit
+	"\tmov edi, 1\n"
+	"\tsyscall\n"
+	"\n"
+	"\t.bss\n"
+	"\t.align 8\n"
+	"rt_stack_limit:\t.zero 8\n"
+	"rt_outlen:\t.zero 8\n"
+	"rt_inpos:\t.zero 8\n"
+	"rt_inlen:\t.zero 8\n"
+	"rt_digits:\t.zero 32\n"
+	"rt_outbuf:\t.zero %d\n"
+	"rt_inbuf:\t.zero %d\n";
+
+/* Level difference between current block and a block of depth */
+static int
+aot_level(const aot_t *a, int depth)
+{
+	return a->ast->blocks[a->block].depth - depth;
+}
+
+/* Follow static links into reg, return register holding the frame */
+static const char *
+aot_frame(aot_t *a, int level, const char *reg)
+{
+	if (!level)
+		return "rbp";
+
+	fprintf(a->stream, "\tmov %s, [rbp - 8]\n", reg);
+	while (--level)
+		fprintf(a->stream, "\tmov %s, [%s - 8]\n", reg, reg);
+	return reg;
+}
+
+/* Print memory operand of a variable, loading its frame into rsi */
+static void
+aot_var(aot_t *a, const node_t *var, char *buf, size_t size)
+{
+	const char *base = aot_frame(a, aot_level(a, var->depth), "rsi");
+	snprintf(buf, size, "qword ptr [%s - %d]", base, 16 + 8 * var->slot);
+}
+
+/* Node usable as immediate operand */
+static bool
+aot_imm(const aot_t *a, int n, long *imm)
+{
+	const node_t *node = a->ast->nodes + n;
+
+	if (node->type == ast_num) {
+		*imm = node->num;
+		return true;
+	}
+	return false;
+}
+
+static void aot_expression(aot_t *a, int n);
+
+/**
+ * rax := rax / rcx, abort with message if rcx is zero, or -1 while
+ * rax is LONG_MIN
+*/
+static void
+aot_div(aot_t *a, int n, bool checked)
+{
+	if (checked) {
+		fprintf(a->stream, "\ttest rcx, rcx\n"
+				   "\tjz .Ldiv%d\n"
+				   "\tcmp rcx, -1\n"
+				   "\tjne .Lok%d\n"
+				   "\tmovabs rdx, 0x8000000000000000\n"
+				   "\tcmp rax, rdx\n"
+				   "\tje .Lovf%d\n"
+				   ".Lok%d:\n",
+			n, n, n, n);
+	}
+	fprintf(a->stream, "\tcqo\n"
+			   "\tidiv rcx\n");
+	if (a->ast->nodes[n].op == percent)
+		fprintf(a->stream, "\tmov rax, rdx\n");
+}
+
+/**
+ * Evaluate binop or cond node, leave result of arithmetic in rax
+ * or result of comparison in flags.
+*/
+static void
+aot_binary(aot_t *a, int n)
+{
+	const node_t *node = a->ast->nodes + n;
+	const node_t *rhs = a->ast->nodes + node->kid[1];
+	const char *op;
+	char operand[64];
+	long imm;
+
+	switch (node->op) {
+	case plus:
+		op = "add";
+		break;
+	case minus:
+		op = "sub";
+		break;
+	case times:
+		op = "imul";
+		break;
+	case slash:
+	case percent:
+		op = NULL;
+		break;
+	default: // comparison
+		op = "cmp";
+		break;
+	}
+
+	aot_expression(a, node->kid[0]);
+
+	if (aot_imm(a, node->kid[1], &imm)) {
+		if (op && imm == (int)imm) {
+			fprintf(a->stream, "\t%s rax, %ld\n", op, imm);
+			return;
+		}
+		fprintf(a->stream, "\tmov rcx, %ld\n", imm);
+		if (!op) {
+			aot_div(a, n, !imm || imm == -1);
+			return;
+		}
+	} else if (rhs->type == ast_var) {
+		aot_var(a, rhs, operand, sizeof(operand));
+		if (op) {
+			fprintf(a->stream, "\t%s rax, %s\n", op, operand);
+			return;
+		}
+		fprintf(a->stream, "\tmov rcx, %s\n", operand);
+		aot_div(a, n, true);
+		return;
+	} else {
+		fprintf(a->stream, "\tpush rax\n");
+		aot_expression(a, node->kid[1]);
+		fprintf(a->stream, "\tmov rcx, rax\n"
+				   "\tpop rax\n");
+		if (!op) {
+			aot_div(a, n, true);
+			return;
+		}
+	}
+
+	fprintf(a->stream, "\t%s rax, rcx\n", op);
+}
+
+/* Suffix of jcc and setcc for a comparison */
+static const char *
+aot_cc(SYMBOL op, bool inverse)
+{
+	switch (op) {
+	case eql:
+		return inverse ? "ne" : "e";
+	case neq:
+		return inverse ? "e" : "ne";
+	case lss:
+		return inverse ? "ge" : "l";
+	case leq:
+		return inverse ? "g" : "le";
+	case gtr:
+		return inverse ? "le" : "g";
+	case geq:
+	default:
+		return inverse ? "l" : "ge";
+	}
+}
+
+/* Evaluate node into rax */
+static void
+aot_expression(aot_t *a, int n)
+{
+	const node_t *node = a->ast->nodes + n;
+	char operand[64];
+	long imm;
+
+	switch (node->type) {
+	case ast_num:
+	case ast_var:
+		if (aot_imm(a, n, &imm)) {
+			fprintf(a->stream, "\tmov rax, %ld\n", imm);
+		} else {
+			aot_var(a, node, operand, sizeof(operand));
+			fprintf(a->stream, "\tmov rax, %s\n", operand);
+		}
+		break;
+	case ast_neg:
+		aot_expression(a, node->kid[0]);
+		fprintf(a->stream, "\tneg rax\n");
+		break;
+	case ast_odd:
+		aot_expression(a, node->kid[0]);
+		fprintf(a->stream, "\tand rax, 1\n");
+		break;
+	case ast_binop:
+		aot_binary(a, n);
+		break;
+	case ast_cond:
+		aot_binary(a, n);
+		fprintf(a->stream, "\tset%s al\n"
+				   "\tmovzx rax, al\n",
+			aot_cc(node->op, false));
+		break;
+	default:
+		break;
+	}
+}
+
+/* Jump to label if condition is false */
+static void
+aot_branch(aot_t *a, int n, int label)
+{
+	const node_t *node = a->ast->nodes + n;
+
+	if (node->type == ast_cond) {
+		aot_binary(a, n);
+		fprintf(a->stream, "\tj%s .L%d\n", aot_cc(node->op, true),
+			label);
+		return;
+	}
+
+	if (node->type == ast_odd) {
+		aot_expression(a, node->kid[0]);
+		fprintf(a->stream, "\ttest al, 1\n");
+	} else {
+		aot_expression(a, n);
+		fprintf(a->stream, "\ttest rax, rax\n");
+	}
+	fprintf(a->stream, "\tjz .L%d\n", label);
+}
+
+static void
+aot_statement(aot_t *a, int n)
+{
+	const ast_t *ast = a->ast;
+	const node_t *node = ast->nodes + n;
+	char operand[64];
+	int label, block, level;
+
+	switch (node->type) {
+	case ast_assign:
+		aot_expression(a, node->kid[0]);
+		aot_var(a, node, operand, sizeof(operand));
+		fprintf(a->stream, "\tmov %s, rax\n", operand);
+		break;
+	case ast_call:
+		fprintf(a->stream, "\tcmp rsp, [rip + rt_stack_limit]\n"
+				   "\tjb .Lcall%d\n",
+			n);
+		/* Block of a procedure symbol is its body */
+		block = ast->syms[node->sym].block;
+		level = aot_level(a, ast->blocks[block].depth) + 1;
+		if (!strcmp(aot_frame(a, level, "rdi"), "rbp"))
+			fprintf(a->stream, "\tmov rdi, rbp\n");
+		fprintf(a->stream, "\tcall pl0_block%d\n", block);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			aot_statement(a, n);
+		break;
+	case ast_if:
+		label = a->label++;
+		aot_branch(a, node->kid[0], label);
+		aot_statement(a, node->kid[1]);
+		fprintf(a->stream, ".L%d:\n", label);
+		break;
+	case ast_while:
+		label = a->label;
+		a->label += 2;
+		fprintf(a->stream, ".L%d:\n", label);
+		aot_branch(a, node->kid[0], label + 1);
+		aot_statement(a, node->kid[1]);
+		fprintf(a->stream, "\tjmp .L%d\n"
+				   ".L%d:\n",
+			label, label + 1);
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			aot_var(a, ast->nodes + n, operand, sizeof(operand));
+			/* Drop "qword ptr" for lea */
+			fprintf(a->stream, "\tlea rdi, %s\n"
+					   "\tcall rt_read\n",
+				strchr(operand, '['));
+		}
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			aot_expression(a, n);
+			fprintf(a->stream, "\tmov rdi, rax\n"
+					   "\tcall rt_write\n");
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+aot_block(aot_t *a, int block)
+{
+	const ast_block_t *b = a->ast->blocks + block;
+	int size = (8 + 8 * b->nvars + 15) & ~15;
+
+	a->block = block;
+
+	fprintf(a->stream, "\n"
+			   "pl0_block%d:\n"
+			   "\tpush rbp\n"
+			   "\tmov rbp, rsp\n"
+			   "\tsub rsp, %d\n"
+			   "\tmov [rbp - 8], rdi\n",
+		block, size);
+	/* Every activation starts with zeroed variables */
+	for (int i = 0; i < b->nvars; i++)
+		fprintf(a->stream, "\tmov qword ptr [rbp - %d], 0\n",
+			16 + 8 * i);
+
+	aot_statement(a, b->body);
+
+	fprintf(a->stream, "\tleave\n"
+			   "\tret\n");
+}
+
+void
+aot_emit(const ast_t *ast, FILE *stream)
+{
+	aot_t a = { .ast = ast, .stream = stream };
+
+	fprintf(stream, "\t.intel_syntax noprefix\n");
+	fprintf(stream, aot_runtime, AOT_STACK_SIZE, AOT_BUFFER_SIZE,
+		AOT_BUFFER_SIZE, AOT_BUFFER_SIZE, AOT_BUFFER_SIZE);
+
+	fprintf(stream, "\n\t.text\n");
+	for (int b = 0; b < ast->block_num; b++)
+		aot_block(&a, b);
+
+	/* Errors of each division that may not be divisible */
+	for (int n = 1; n < ast->node_num; n++) {
+		const node_t *node = ast->nodes + n;
+		if (node->type != ast_binop ||
+		    (node->op != slash && node->op != percent))
+			continue;
+		fprintf(stream, ".Ldiv%d:\n"
+				"\tlea rdi, [rip + .Lmsg%d]\n"
+				"\tmov esi, offset .Lend%d - .Lmsg%d\n"
+				"\tjmp rt_fatal\n"
+				".Lovf%d:\n"
+				"\tlea rdi, [rip + .Lmsgovf%d]\n"
+				"\tmov esi, offset .Lendovf%d - .Lmsgovf%d\n"
+				"\tjmp rt_fatal\n",
+			n, n, n, n, n, n, n, n);
+	}
+
+	/* Error of each call nested too deep */
+	for (int n = 1; n < ast->node_num; n++) {
+		if (ast->nodes[n].type != ast_call)
+			continue;
+		fprintf(stream, ".Lcall%d:\n"
+				"\tlea rdi, [rip + .Lmsgcall%d]\n"
+				"\tmov esi, offset .Lendcall%d - .Lmsgcall%d\n"
+				"\tjmp rt_fatal\n",
+			n, n, n, n);
+	}
+
+	fprintf(stream, "\n\t.section .rodata\n");
+	for (int n = 1; n < ast->node_num; n++) {
+		const node_t *node = ast->nodes + n;
+		if (node->type != ast_binop ||
+		    (node->op != slash && node->op != percent))
+			continue;
+		fprintf(stream, ".Lmsg%d:\t.ascii \"runtime:%d:%d: "
+				"division by zero\\n\"\n"
+				".Lend%d:\n"
+				".Lmsgovf%d:\t.ascii \"runtime:%d:%d: "
+				"division overflow\\n\"\n"
+				".Lendovf%d:\n",
+			n, node->pos.row, node->pos.col, n, n, node->pos.row,
+			node->pos.col, n);
+	}
+	for (int n = 1; n < ast->node_num; n++) {
+		const node_t *node = ast->nodes + n;
+		if (node->type != ast_call)
+			continue;
+		fprintf(stream, ".Lmsgcall%d:\t.ascii \"runtime:%d:%d: "
+				"too many nested calls\\n\"\n"
+				".Lendcall%d:\n",
+			n, node->pos.row, node->pos.col, n);
+	}
+}
+
+/* Run a tool of binutils, return its exit status */
+static int
+aot_spawn(char *const argv[])
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void
+aot_build(const ast_t *ast, context_t *context, const char *output,
+	  bool asm_only)
+{
+	char dir[] = "/tmp/pl0-XXXXXX";
+	char source[sizeof(dir) + 4], object[sizeof(dir) + 4];
+	char *message = context_top_restrict(context)->message;
+	FILE *stream;
+	int ret;
+
+	if (asm_only) {
+		if (!(stream = fopen(output, "w"))) {
+			snprintf(message, MAX_CONTEXT_MSG_SIZE,
+				 "aot: cannot open %s", output);
+			exit(1);
+		}
+		aot_emit(ast, stream);
+		fclose(stream);
+		return;
+	}
+
+	/**
+	 * Assembly and object file live in a directory only we can
+	 * write, so neither path can be taken over by someone else.
+	*/
+	if (!mkdtemp(dir)) {
+		snprintf(message, MAX_CONTEXT_MSG_SIZE,
+			 "aot: cannot create temporary directory");
+		exit(1);
+	}
+	snprintf(source, sizeof(source), "%s/p.s", dir);
+	snprintf(object, sizeof(object), "%s/p.o", dir);
+	if (!(stream = fopen(source, "w"))) {
+		rmdir(dir);
+		snprintf(message, MAX_CONTEXT_MSG_SIZE,
+			 "aot: cannot create temporary file");
+		exit(1);
+	}
+	aot_emit(ast, stream);
+	fclose(stream);
+
+	ret = aot_spawn((char *const[]){ "as", "--64", "-o", object, source,
+					 NULL });
+	if (!ret)
+		ret = aot_spawn((char *const[]){ "ld", "-s", "-o",
+						 (char *)output, object,
+						 NULL });
+
+	unlink(source);
+	unlink(object);
+	rmdir(dir);
+
+	if (ret) {
+		snprintf(message, MAX_CONTEXT_MSG_SIZE,
+			 "aot: failed to assemble or link %s", output);
+		exit(1);
+	}
+}
@@ -0,0 +1,45 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AOT_H
+#define AOT_H
+
+#include "ast.h"
+
+/* Size of I/O buffers of the runtime */
+#define AOT_BUFFER_SIZE 0x1000
+/**
+ * Bytes of stack calls may nest on at most, or half of a smaller stack
+ * limit, calls going deeper end the program before it overflows
+*/
+#define AOT_STACK_SIZE 0x400000
+
+/**
+ * Write x86-64 assembly of a parsed program, with a runtime that
+ * needs nothing but Linux system calls.
+*/
+void aot_emit(const ast_t *ast, FILE *stream);
+
+/**
+ * Compile a parsed program into a standalone executable with the
+ * system assembler and linker, or into assembly only if asm_only.
+*/
+void aot_build(const ast_t *ast, context_t *context, const char *output,
+	       bool asm_only);
+
+#endif /* AOT_H */
@@ -0,0 +1,68 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <limits.h>
+#include <stdbool.h>
+
+/**
+ * Arithmetic of PL/0, shared by every engine and by constant folding.
+ * It wraps around like two's complement machines, where overflow of
+ * signed longs would be undefined in C.
+*/
+static inline long
+arith_add(long m, long n)
+{
+	return (long)((unsigned long)m + (unsigned long)n);
+}
+
+static inline long
+arith_sub(long m, long n)
+{
+	return (long)((unsigned long)m - (unsigned long)n);
+}
+
+static inline long
+arith_mul(long m, long n)
+{
+	return (long)((unsigned long)m * (unsigned long)n);
+}
+
+static inline long
+arith_neg(long n)
+{
+	return (long)-(unsigned long)n;
+}
+
+/* Division of m by n that neither fails nor traps */
+static inline bool
+arith_divisible(long m, long n)
+{
+	return n && !(m == LONG_MIN && n == -1);
+}
+
+/* Runtime error of a division by n that is not divisible */
+static inline const char *
+arith_div_error(long n)
+{
+	return n ? "division overflow" : "division by zero";
+}
+
+#endif /* ARITH_H */
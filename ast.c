@@ -0,0 +1,559 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ast.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AST_PREALLOC_NUM 0x100
+
+/* State of the tree builder */
+typedef struct {
+	ast_t *ast;
+	context_t *context;
+	/* Block being parsed */
+	int block;
+	/* First symbol declared by it */
+	int scope;
+	/**
+	 * Symbol each name id is bound to in the block being parsed,
+	 * -1 if none, restored from shadow at the end of each block.
+	*/
+	int *bind;
+	int bind_cap;
+} ast_parser_t;
+
+static void
+ast_error(const context_t *context, const char *fmt, ...)
+{
+	char *message = context_top_restrict(context)->message;
+	pos_t pos = token_cur(context)->pos;
+	va_list ap;
+	int len;
+
+	len = snprintf(message, MAX_CONTEXT_MSG_SIZE,
+		       "syntax:%d:%d: ", pos.row, pos.col);
+
+	va_start(ap, fmt);
+	vsnprintf(message + len, MAX_CONTEXT_MSG_SIZE - len, fmt, ap);
+	va_end(ap);
+
+	exit(1);
+}
+
+/* Make room for one more element of an arena array */
+static void *
+ast_grow(const context_t *context, void *array, int num, int *cap,
+	 size_t size)
+{
+	if (num < *cap)
+		return array;
+
+	*cap = *cap ? *cap * 2 : AST_PREALLOC_NUM;
+	if (!(array = realloc(array, *cap * size))) {
+		sprintf(context_top_restrict(context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	return array;
+}
+
+void
+ast_init(ast_t *ast)
+{
+	memset(ast, 0, sizeof(ast_t));
+}
+
+void
+ast_free(ast_t *ast)
+{
+	free(ast->nodes);
+	free(ast->syms);
+	free(ast->blocks);
+	ast_init(ast);
+}
+
+/**
+ * Append a node, positioned at the current token.
+ * Return index instead of pointer since the arena may move.
+*/
+static int
+node_new(ast_parser_t *p, NODE type)
+{
+	ast_t *ast = p->ast;
+	node_t *node;
+
+	ast->nodes = ast_grow(p->context, ast->nodes, ast->node_num,
+			      &ast->node_cap, sizeof(node_t));
+	/* Node 0 is reserved for "no node" */
+	if (!ast->node_num)
+		memset(ast->nodes + ast->node_num++, 0, sizeof(node_t));
+
+	node = ast->nodes + ast->node_num;
+	memset(node, 0, sizeof(node_t));
+	node->type = type;
+	node->pos = token_cur(p->context)->pos;
+
+	return ast->node_num++;
+}
+
+/* Binding of name_id, growing the table to hold it */
+static int *
+sym_bind(ast_parser_t *p, int name_id)
+{
+	if (name_id >= p->bind_cap) {
+		int cap = p->bind_cap ? p->bind_cap : AST_PREALLOC_NUM;
+
+		while (cap <= name_id)
+			cap *= 2;
+		if (!(p->bind = realloc(p->bind, cap * sizeof(int)))) {
+			sprintf(context_top_restrict(p->context)->message,
+				"Out of memory");
+			exit(1);
+		}
+		memset(p->bind + p->bind_cap, -1,
+		       (cap - p->bind_cap) * sizeof(int));
+		p->bind_cap = cap;
+	}
+
+	return p->bind + name_id;
+}
+
+/* Find ident of current token, abort if undefined */
+static int
+sym_lookup(ast_parser_t *p)
+{
+	int name_id = token_cur(p->context)->num;
+	int s = *sym_bind(p, name_id);
+
+	if (s == -1)
+		ast_error(p->context, "variable \"%s\" used but undefined",
+			  intern_name(name_id));
+	return s;
+}
+
+/* Declare ident of current token in current block */
+static int
+sym_add(ast_parser_t *p, IDENT type)
+{
+	ast_t *ast = p->ast;
+	ast_block_t *block = ast->blocks + p->block;
+	int name_id = token_cur(p->context)->num;
+	int *bind = sym_bind(p, name_id);
+	ast_sym_t *sym;
+
+	/* Symbols of nested blocks are unbound, so later ones are ours */
+	if (*bind >= p->scope)
+		ast_error(p->context,
+			  "cannot declare ident \"%s\" duplicately",
+			  intern_name(name_id));
+
+	ast->syms = ast_grow(p->context, ast->syms, ast->sym_num,
+			     &ast->sym_cap, sizeof(ast_sym_t));
+	sym = ast->syms + ast->sym_num;
+
+	sym->name_id = name_id;
+	sym->type = type;
+	sym->value = 0;
+	sym->block = p->block;
+	sym->slot = type == variable ? block->nvars++ : -1;
+	sym->scope_next = block->syms;
+	block->syms = ast->sym_num;
+	sym->shadow = *bind;
+	*bind = ast->sym_num;
+
+	return ast->sym_num++;
+}
+
+static int
+block_new(ast_parser_t *p, int sym)
+{
+	ast_t *ast = p->ast;
+	ast_block_t *block;
+
+	ast->blocks = ast_grow(p->context, ast->blocks, ast->block_num,
+			       &ast->block_cap, sizeof(ast_block_t));
+	block = ast->blocks + ast->block_num;
+
+	block->parent = p->block;
+	block->depth = p->block == -1 ? 0 : ast->blocks[p->block].depth + 1;
+	if (block->depth > ast->max_depth)
+		ast->max_depth = block->depth;
+	block->sym = sym;
+	block->syms = -1;
+	block->nvars = 0;
+	block->body = 0;
+
+	return ast->block_num++;
+}
+
+/* Node of a variable, addressed by (depth, slot) of symbol s */
+static int
+var_new(ast_parser_t *p, NODE type, int s)
+{
+	ast_t *ast = p->ast;
+	int n = node_new(p, type);
+
+	ast->nodes[n].sym = s;
+	ast->nodes[n].depth = ast->blocks[ast->syms[s].block].depth;
+	ast->nodes[n].slot = ast->syms[s].slot;
+	return n;
+}
+
+static int ast_parse_statement(ast_parser_t *p);
+static int ast_parse_expression(ast_parser_t *p);
+
+/**
+ * factor = ident | number | "(" expression ")".
+*/
+static int
+ast_parse_factor(ast_parser_t *p)
+{
+	context_t *context = p->context;
+	int n;
+
+	if (token_cur(context)->type == lparen) { // (
+		context_next(context);
+		n = ast_parse_expression(p);
+		assert(context, rparen); // )
+	}
+
+	else if (token_cur(context)->type == ident) { // a
+		int s = sym_lookup(p);
+		if (p->ast->syms[s].type == procvar)
+			ast_error(context, "procedure \"%s\" used as value",
+				  intern_name(p->ast->syms[s].name_id));
+		/* Value of const is known by now */
+		if (p->ast->syms[s].type == constvar) {
+			n = node_new(p, ast_num);
+			p->ast->nodes[n].num = p->ast->syms[s].value;
+		} else {
+			n = var_new(p, ast_var, s);
+		}
+	}
+
+	else if (token_cur(context)->type == number) { // 1
+		n = node_new(p, ast_num);
+		p->ast->nodes[n].num = token_cur(context)->num;
+	}
+
+	else {
+		ast_error(context, "invalid factor");
+		return 0;
+	}
+
+	context_next(context);
+	return n;
+}
+
+/**
+ * term = factor {("*"|"/") factor}.
+*/
+static int
+ast_parse_term(ast_parser_t *p)
+{
+	context_t *context = p->context;
+	int n = ast_parse_factor(p);
+
+	while (token_cur(context)->type == times ||
+	       token_cur(context)->type == slash) { // * or /
+		int op = node_new(p, ast_binop);
+		p->ast->nodes[op].op = token_cur(context)->type;
+
+		context_next(context);
+		int rhs = ast_parse_factor(p);
+
+		p->ast->nodes[op].kid[0] = n;
+		p->ast->nodes[op].kid[1] = rhs;
+		n = op;
+	}
+
+	return n;
+}
+
+/**
+ * expression = [ "+"|"-"] term { ("+"|"-") term}.
+*/
+static int
+ast_parse_expression(ast_parser_t *p)
+{
+	context_t *context = p->context;
+	int n;
+
+	if (token_cur(context)->type == minus) { // -
+		int neg = node_new(p, ast_neg);
+		context_next(context);
+		n = ast_parse_term(p);
+		p->ast->nodes[neg].kid[0] = n;
+		n = neg;
+	} else {
+		if (token_cur(context)->type == plus) // +
+			context_next(context);
+		n = ast_parse_term(p);
+	}
+
+	while (token_cur(context)->type == plus ||
+	       token_cur(context)->type == minus) { // + and -
+		int op = node_new(p, ast_binop);
+		p->ast->nodes[op].op = token_cur(context)->type;
+
+		context_next(context);
+		int rhs = ast_parse_term(p);
+
+		p->ast->nodes[op].kid[0] = n;
+		p->ast->nodes[op].kid[1] = rhs;
+		n = op;
+	}
+
+	return n;
+}
+
+/**
+ * condition = "odd" expression |
+ * 	expression ("="|"#"|"<"|"<="|">"|">=") expression .
+*/
+static int
+ast_parse_condition(ast_parser_t *p)
+{
+	context_t *context = p->context;
+	int n, lhs, rhs;
+
+	if (token_cur(context)->type == oddsym) { // odd
+		n = node_new(p, ast_odd);
+		context_next(context);
+		lhs = ast_parse_expression(p);
+		p->ast->nodes[n].kid[0] = lhs;
+		return n;
+	}
+
+	lhs = ast_parse_expression(p);
+
+	// = # < <= > >=
+	assert_multi(context, 6, eql, neq, lss, leq, gtr, geq);
+	n = node_new(p, ast_cond);
+	p->ast->nodes[n].op = token_cur(context)->type;
+
+	context_next(context);
+	rhs = ast_parse_expression(p);
+
+	p->ast->nodes[n].kid[0] = lhs;
+	p->ast->nodes[n].kid[1] = rhs;
+	return n;
+}
+
+/**
+ * statement = [ ident ":=" expression | "call" ident
+ * 	| "?" ident | "!" expression
+ * 	| "begin" statement {";" statement } "end"
+ * 	| "if" condition "then" statement
+ * 	| "while" condition "do" statement ].
+ * Return 0 for an empty statement.
+*/
+static int
+ast_parse_statement(ast_parser_t *p)
+{
+	context_t *context = p->context;
+	ast_t *ast = p->ast;
+	int n, s, kid, tail;
+
+	switch (token_cur(context)->type) {
+	case ident: // id
+		s = sym_lookup(p);
+		if (ast->syms[s].type != variable)
+			ast_error(context, "cannot assign value to %s \"%s\"",
+				  ast->syms[s].type == constvar ? "const" :
+								  "procedure",
+				  intern_name(ast->syms[s].name_id));
+		n = var_new(p, ast_assign, s);
+
+		assert(context_next(context), becomes); // :=
+		context_next(context);
+		kid = ast_parse_expression(p); // a + 1
+		ast->nodes[n].kid[0] = kid;
+		return n;
+
+	case callsym: // call
+		assert(context_next(context), ident); // id
+		s = sym_lookup(p);
+		if (ast->syms[s].type != procvar)
+			ast_error(context, "cannot call non-procedure \"%s\"",
+				  intern_name(ast->syms[s].name_id));
+		n = node_new(p, ast_call);
+		ast->nodes[n].sym = s;
+		context_next(context);
+		return n;
+
+	case beginsym: // begin
+		n = node_new(p, ast_begin);
+		tail = 0;
+		do {
+			context_next(context);
+			kid = ast_parse_statement(p); // a := 1
+			if (!kid)
+				continue;
+			if (tail)
+				ast->nodes[tail].next = kid;
+			else
+				ast->nodes[n].kid[0] = kid;
+			tail = kid;
+		} while (token_cur(context)->type == semicolon); // ;
+
+		assert(context, endsym); // end
+		context_next(context);
+		return n;
+
+	case ifsym: // if
+	case whilesym: // while
+		n = node_new(p, token_cur(context)->type == ifsym ? ast_if :
+								     ast_while);
+		context_next(context);
+		kid = ast_parse_condition(p);
+		ast->nodes[n].kid[0] = kid;
+
+		assert(context, ast->nodes[n].type == ast_if ? thensym :
+							       dosym);
+		context_next(context);
+		kid = ast_parse_statement(p); // a := 1
+		ast->nodes[n].kid[1] = kid;
+		return n;
+
+	case readsym: // read
+		n = node_new(p, ast_read);
+		tail = 0;
+		assert(context_next(context), lparen); // (
+		do {
+			assert(context_next(context), ident); // id
+			s = sym_lookup(p);
+			if (ast->syms[s].type != variable)
+				ast_error(context, "cannot read into \"%s\"",
+					  intern_name(ast->syms[s].name_id));
+			kid = var_new(p, ast_var, s);
+			if (tail)
+				ast->nodes[tail].next = kid;
+			else
+				ast->nodes[n].kid[0] = kid;
+			tail = kid;
+		} while (token_cur(context_next(context))->type == comma); // ,
+
+		assert(context, rparen); // )
+		context_next(context);
+		return n;
+
+	case writesym: // write
+		n = node_new(p, ast_write);
+		tail = 0;
+		assert(context_next(context), lparen); // (
+		do {
+			context_next(context);
+			kid = ast_parse_expression(p); // a + 1
+			if (tail)
+				ast->nodes[tail].next = kid;
+			else
+				ast->nodes[n].kid[0] = kid;
+			tail = kid;
+		} while (token_cur(context)->type == comma); // ,
+
+		assert(context, rparen); // )
+		context_next(context);
+		return n;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * block = [ "const" ident "=" number {"," ident "=" number} ";"]
+ * 	[ "var" ident {"," ident} ";"]
+ * 	{ "procedure" ident ";" block ";" } statement .
+*/
+static int
+ast_parse_block(ast_parser_t *p, int proc)
+{
+	context_t *context = p->context;
+	ast_t *ast = p->ast;
+	int parent = p->block;
+	int scope = p->scope;
+	int block = block_new(p, proc);
+	int s;
+
+	p->block = block;
+	p->scope = ast->sym_num;
+
+	if (token_cur(context)->type == constsym) { // const
+		do {
+			assert(context_next(context), ident); // id
+			s = sym_add(p, constvar);
+			assert(context_next(context), eql); // =
+			assert(context_next(context), number); // 123
+			ast->syms[s].value = token_cur(context)->num;
+		} while (token_cur(context_next(context))->type == comma); // ,
+
+		assert(context, semicolon); // ;
+		context_next(context);
+	}
+
+	if (token_cur(context)->type == varsym) { // var
+		do {
+			assert(context_next(context), ident); // id
+			sym_add(p, variable);
+		} while (token_cur(context_next(context))->type == comma); // ,
+
+		assert(context, semicolon); // ;
+		context_next(context);
+	}
+
+	while (token_cur(context)->type == proceduresym) { // procedure
+		assert(context_next(context), ident); // id
+		s = sym_add(p, procvar);
+		assert(context_next(context), semicolon); // ;
+		context_next(context);
+
+		int sub = ast_parse_block(p, s); // block
+		ast->syms[s].block = sub;
+
+		assert(context, semicolon); // ;
+		context_next(context);
+	}
+
+	s = ast_parse_statement(p); // a := 1
+	ast->blocks[block].body = s;
+
+	/* Names of this block go out of scope */
+	for (s = ast->blocks[block].syms; s != -1; s = ast->syms[s].scope_next)
+		p->bind[ast->syms[s].name_id] = ast->syms[s].shadow;
+
+	p->block = parent;
+	p->scope = scope;
+	return block;
+}
+
+void
+ast_parse(ast_t *ast, context_t *context)
+{
+	ast_parser_t p = { .ast = ast, .context = context, .block = -1 };
+
+	context_next(context);
+	ast_parse_block(&p, -1);
+	free(p.bind);
+
+	/* End of program */
+	assert(context, period); // .
+}
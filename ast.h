@@ -0,0 +1,135 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AST_H
+#define AST_H
+
+#include "context.h"
+#include "intern.h"
+
+/* Kinds of AST nodes */
+typedef enum {
+	ast_none,
+	/* Expressions */
+	ast_num, // 123
+	ast_var, // a
+	ast_neg, // - a
+	ast_binop, // a + b
+	ast_odd, // odd a
+	ast_cond, // a < b
+	/* Statements */
+	ast_assign, // a := b
+	ast_call, // call a
+	ast_read, // read(a, b)
+	ast_write, // write(a, b)
+	ast_begin, // begin ... end
+	ast_if, // if ... then ...
+	ast_while // while ... do ...
+} NODE;
+
+/**
+ * Node of the syntax tree. Nodes live in one contiguous array and
+ * refer to each other by index, index 0 stands for "no node".
+*/
+typedef struct {
+	NODE type;
+	/* Operator of binop and cond */
+	SYMBOL op;
+	/* Operands, condition and body */
+	int kid[2];
+	/* Next statement of a begin block, or next argument of read/write */
+	int next;
+	union {
+		/* Value of number */
+		long num;
+		/* Index into symbol table for var, assign, call and read */
+		int sym;
+	};
+	/**
+	 * Address of variable of var and assign, resolved while parsing:
+	 * static depth of the block declaring it, and slot in there.
+	*/
+	int depth;
+	int slot;
+	/* Position in source, for runtime errors */
+	pos_t pos;
+} node_t;
+
+/* Declared ident */
+typedef struct {
+	/* Intern id of its spelling */
+	int name_id;
+	IDENT type;
+	/* Value of const */
+	long value;
+	/* Block declaring it, or body block of a procedure */
+	int block;
+	/* Index of variable inside its block */
+	int slot;
+	/* Previous symbol of the same block, -1 for the first */
+	int scope_next;
+	/* Symbol of the same name it hides while parsing, -1 for none */
+	int shadow;
+} ast_sym_t;
+
+/* Block of a procedure or of the main program */
+typedef struct {
+	/* Enclosing block, -1 for main program */
+	int parent;
+	/* Static nesting depth, 0 for main program */
+	int depth;
+	/* Symbol of the procedure, -1 for main program */
+	int sym;
+	/* Last symbol declared in block */
+	int syms;
+	/* Number of variables */
+	int nvars;
+	/* Statement node */
+	int body;
+} ast_block_t;
+
+/* Arena holding a whole program */
+typedef struct {
+	node_t *nodes;
+	int node_num;
+	int node_cap;
+
+	ast_sym_t *syms;
+	int sym_num;
+	int sym_cap;
+
+	ast_block_t *blocks;
+	int block_num;
+	int block_cap;
+	/* Deepest static nesting depth */
+	int max_depth;
+} ast_t;
+
+void ast_init(ast_t *ast);
+void ast_free(ast_t *ast);
+
+/**
+ * program = block "." .
+ * Build the whole program from input of context, block 0 is main program.
+*/
+void ast_parse(ast_t *ast, context_t *context);
+
+/* Run a parsed program by walking the tree */
+void ast_exec(const ast_t *ast, context_t *context);
+
+#endif /* AST_H */
@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Run random programs of bench/gen.awk with every engine at every -O
+# level, the native executable and C translation included, and report
+# each seed whose output or runtime error differs from -O 0 -e ast.
+# Seeds that time out in the reference are skipped.
+#
+# Usage: bench/check.sh [analyzer] [from] [to]
+
+analyzer=${1:-./analyzer}
+from=${2:-1}
+to=${3:-200}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+seq 1 1000 >"$dir/input"
+fail=0
+
+# Output then errors of a command, which flush in either order
+run() {
+	timeout 5 "$@" <"$dir/input" >"$dir/out" 2>"$dir/err"
+	local ret=$?
+	cat "$dir/out" "$dir/err"
+	return $ret
+}
+
+for seed in $(seq "$from" "$to"); do
+	awk -v seed="$seed" -f "$(dirname "$0")/gen.awk" >"$dir/p.pl0" ||
+		exit 2
+	ref=$(run "$analyzer" -O 0 -e ast "$dir/p.pl0")
+	[ $? -ge 124 ] && continue
+
+	for level in 0 1 2; do
+		for engine in ast closure vm jit tier "tier -P 1 -L 1"; do
+			out=$(run "$analyzer" -O $level -e $engine "$dir/p.pl0")
+			[ "$out" = "$ref" ] && continue
+			echo "seed $seed: -O $level -e $engine differs"
+			fail=1
+		done
+
+		out=$("$analyzer" -O $level -c "$dir/p" "$dir/p.pl0" 2>&1 &&
+		      run "$dir/p")
+		if [ "$out" != "$ref" ]; then
+			echo "seed $seed: -O $level -c differs"
+			fail=1
+		fi
+
+		out=$("$analyzer" -O $level -t "$dir/p.c" "$dir/p.pl0" 2>&1 &&
+		      cc -w -o "$dir/p" "$dir/p.c" 2>&1 && run "$dir/p")
+		if [ "$out" != "$ref" ]; then
+			echo "seed $seed: -O $level -t differs"
+			fail=1
+		fi
+	done
+done
+
+exit $fail
@@ -0,0 +1,201 @@
+#
+# Write a random program of seed, with nested procedures, loops, reads
+# and divisions that may fail. Loops are bounded by counters and the
+# only recursion is bounded by g, so every program ends. Locals may be
+# read unassigned or assigned only conditionally, and small procedures
+# are called twice in a row, so conditions of odd t hold on every
+# other call made around t := t + 1.
+#
+# Usage: awk -v seed=1 -f bench/gen.awk >random.pl0
+
+function randint(a, b)
+{
+	return a + int(rand() * (b - a + 1))
+}
+
+function fresh(prefix)
+{
+	return prefix (++count)
+}
+
+# Words of space separated lists
+function pick(list,    a)
+{
+	return a[randint(1, split(list, a, " "))]
+}
+
+function append(list, word)
+{
+	return list == "" ? word : list " " word
+}
+
+# Variables that may be assigned, all but g
+function writable(vars,    a, n, i, out)
+{
+	n = split(vars, a, " ")
+	out = ""
+	for (i = 1; i <= n; i++)
+		if (a[i] != "g")
+			out = append(out, a[i])
+	return out
+}
+
+function expression(vars, d,    r, op, a, b)
+{
+	r = rand()
+	if (d > limit || r < 0.3) {
+		if (vars != "" && rand() < 0.7)
+			return pick(vars)
+		return randint(0, 9) ""
+	}
+	if (r < 0.4)
+		return "(0 - " expression(vars, d + 1) ")"
+	op = substr("+-*+-*/", randint(1, 7), 1)
+	if (op == "/" && rand() < 0.8) {
+		b = expression(vars, d + 1)
+		return "(" expression(vars, d + 1) " / (" b " * " b " + 1))"
+	}
+	if (op == "/" && rand() < 0.5) {
+		a = expression(vars, d + 1)
+		b = vars != "" ? pick(vars) : "3"
+		return "(" a " / " b " * " b ")"
+	}
+	return "(" expression(vars, d + 1) " " op " " \
+		expression(vars, d + 1) ")"
+}
+
+function condition(vars)
+{
+	if (rand() < 0.2)
+		return "odd " expression(vars, 0)
+	return expression(vars, 0) " " pick("= # < <= > >=") " " \
+		expression(vars, 0)
+}
+
+function statement(vars, procs, counters, d,    r, c, n, i, out)
+{
+	r = rand()
+	if (d > limit || r < 0.35)
+		return pick(writable(vars)) " := " expression(vars, 0)
+	if (r < 0.42)
+		return "write(" expression(vars, 0) ")"
+	if (r < 0.45)
+		return "read(" pick(writable(vars)) ")"
+	if (r < 0.55 && procs != "")
+		return "call " pick(procs)
+	if (r < 0.7)
+		return "if " condition(vars) " then " \
+			statement(vars, procs, counters, d + 1)
+	if (r < 0.85 && counters != "") {
+		# Each nested loop counts with a counter of its own
+		c = counters
+		sub(/ .*/, "", c)
+		sub(/^[^ ]* ?/, "", counters)
+		out = "begin " c " := 0; while " c " < " randint(0, 6) \
+			" do begin "
+		n = randint(1, 4)
+		for (i = 1; i <= n; i++)
+			out = out statement(vars, procs, counters, d + 1) "; "
+		return out c " := " c " + 1 end end"
+	}
+	out = "begin "
+	n = randint(1, 4)
+	for (i = 1; i <= n; i++)
+		out = out (i > 1 ? "; " : "") \
+			statement(vars, procs, counters, d + 1)
+	return out " end"
+}
+
+# First assignment of local v, surely made, left out or made only if a
+# condition that may change from call to call holds
+function first(v, vars, counters,    r, c)
+{
+	r = rand()
+	if (r < 0.5 || v == "g" || v == "t")
+		return v " := " randint(-5, 9)
+	if (r < 0.65)
+		return "begin end"
+	if (r < 0.85)
+		return "if " (rand() < 0.5 ? "odd t" : condition(vars)) \
+			" then begin " v " := " randint(-5, 9) " end"
+	c = counters
+	sub(/ .*/, "", c)
+	return "begin " c " := 0; while " c " < " randint(0, 1) \
+		" do begin " v " := " randint(-5, 9) "; " c " := " c \
+		" + 1 end end"
+}
+
+function block(outer, procs, depth, self,
+	       vars, counters, all, n, i, out, name, body, at, a, nested,
+	       smalls, small, between)
+{
+	vars = depth ? "" : "g t"
+	n = randint(1, 4)
+	for (i = 1; i <= n; i++)
+		vars = append(vars, fresh("v"))
+	counters = fresh("c") " " fresh("c") " " fresh("c")
+
+	out = ""
+	if (rand() < 0.5)
+		out = "const " fresh("k") " = " randint(0, 20) ";\n"
+	name = vars " " counters
+	gsub(/ /, ", ", name)
+	out = out "var " name ";\n"
+	all = outer == "" ? vars : outer " " vars
+	if (depth < 2) {
+		nested = n = randint(0, 2)
+		for (i = 1; i <= n; i++) {
+			name = fresh("p")
+			out = out "procedure " name ";\n" \
+				block(all, procs, depth + 1, name) ";\n"
+			procs = append(procs, name)
+			if (small_made)
+				smalls = append(smalls, name)
+		}
+	}
+
+	# Some procedures are small enough to be inlined at every call
+	small = depth && !nested && rand() < 0.6
+	limit = small ? 1 : 3
+
+	n = split(vars, a, " ")
+	for (i = 1; i <= n; i++)
+		body[i] = first(a[i], all, counters)
+	at = n
+	n += small ? randint(1, 2) : randint(2, 6)
+	for (i = at + 1; i <= n; i++)
+		body[i] = statement(all, procs, counters, 0)
+	# Same procedure again once something it may read changed, the
+	# small ones inlined into this block rather
+	if (procs != "" && !small && rand() < 0.8) {
+		name = pick(smalls != "" ? smalls : procs)
+		if (rand() < 0.5)
+			between = "t := t + 1"
+		else
+			between = pick(writable(all)) " := " \
+				expression(all, 0)
+		body[++n] = "begin call " name "; " between "; call " name \
+			" end"
+	}
+	if (self != "" && !small && rand() < 0.4) {
+		at = randint(at + 1, n + 1)
+		for (i = n; i >= at; i--)
+			body[i + 1] = body[i]
+		body[at] = "if g < 3 then begin g := g + 1; call " self " end"
+		n++
+	}
+	body[++n] = "write(" a[split(all, a, " ")] ")"
+	limit = 3
+	small_made = small
+
+	out = out "begin\n"
+	for (i = 1; i <= n; i++)
+		out = out body[i] (i < n ? ";\n" : "\n")
+	return out "end"
+}
+
+BEGIN {
+	srand(seed)
+	limit = 3
+	print block("", "", 0, "") "."
+}
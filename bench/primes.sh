@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Time each engine on bench/primes.pl0 with max scaled up, -O 0 keeps
+# the program as written.
+#
+# Usage: bench/primes.sh [analyzer] [max] [level]
+
+analyzer=${1:-./analyzer}
+max=${2:-50000}
+level=${3:-0}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+TIMEFORMAT="%R s"
+
+sed "s/^const max = [0-9]*;/const max = $max;/" \
+	"$(dirname "$0")/primes.pl0" >"$dir/primes.pl0"
+
+for engine in ast closure vm jit tier; do
+	printf "%8s: " $engine
+	time "$analyzer" -O "$level" -e $engine "$dir/primes.pl0" >/dev/null
+done
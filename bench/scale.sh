@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Time the analyzer on generated programs declaring 10^3 to 10^6 idents
+# in one scope, each assigned from the one before.
+#
+# Usage: bench/scale.sh [analyzer] [engine]
+
+analyzer=${1:-./analyzer}
+engine=${2:-ast}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+TIMEFORMAT="%R s"
+
+for n in 1000 10000 100000 1000000; do
+	awk -v n=$n 'BEGIN {
+		printf "var v1"
+		for (i = 2; i <= n; i++)
+			printf ", v%d", i
+		printf ";\nbegin\nv1 := 1"
+		for (i = 2; i <= n; i++)
+			printf ";\nv%d := v%d + 1", i, i - 1
+		printf ";\nwrite(v%d)\nend.\n", n
+	}' >"$dir/scale.pl0"
+
+	printf "%8d idents: " $n
+	time "$analyzer" -e "$engine" "$dir/scale.pl0" >/dev/null
+done
@@ -0,0 +1,454 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cgen.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+/* State of the C writer */
+typedef struct {
+	const ast_t *ast;
+	FILE *stream;
+	/* Block being translated */
+	int block;
+	/* Nesting of statements, for indentation */
+	int indent;
+} cgen_t;
+
+/* Support code ahead of every translated program */
+static const char *cgen_prelude =
+	"#include <limits.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"\n"
+	"/* Arithmetic wraps around like the other engines of PL/0 */\n"
+	"static inline long\n"
+	"pl0_add(long m, long n)\n"
+	"{\n"
+	"\treturn (long)((unsigned long)m + (unsigned long)n);\n"
+	"}\n"
+	"\n"
+	"static inline long\n"
+	"pl0_sub(long m, long n)\n"
+	"{\n"
+	"\treturn (long)((unsigned long)m - (unsigned long)n);\n"
+	"}\n"
+	"\n"
+	"static inline long\n"
+	"pl0_mul(long m, long n)\n"
+	"{\n"
+	"\treturn (long)((unsigned long)m * (unsigned long)n);\n"
+	"}\n"
+	"\n"
+	"static inline long\n"
+	"pl0_neg(long n)\n"
+	"{\n"
+	"\treturn (long)-(unsigned long)n;\n"
+	"}\n"
+	"\n"
+	"/**\n"
+	" * Division truncates toward zero, a zero divisor or LONG_MIN / -1\n"
+	" * ends the program\n"
+	"*/\n"
+	"static inline void\n"
+	"pl0_div_check(long m, long n, int row, int col)\n"
+	"{\n"
+	"\tif (!n || (m == LONG_MIN && n == -1)) {\n"
+	"\t\tfflush(stdout);\n"
+	"\t\tfprintf(stderr, \"runtime:%d:%d: division %s\\n\", row, col,\n"
+	"\t\t\tn ? \"overflow\" : \"by zero\");\n"
+	"\t\texit(1);\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"static inline long\n"
+	"pl0_div(long m, long n, int row, int col)\n"
+	"{\n"
+	"\tpl0_div_check(m, n, row, col);\n"
+	"\treturn m / n;\n"
+	"}\n"
+	"\n"
+	"static inline long\n"
+	"pl0_mod(long m, long n, int row, int col)\n"
+	"{\n"
+	"\tpl0_div_check(m, n, row, col);\n"
+	"\treturn m % n;\n"
+	"}\n"
+	"\n"
+	"/* Variable is left unchanged if no number can be read */\n"
+	"static inline void\n"
+	"pl0_read(long *n)\n"
+	"{\n"
+	"\tlong value;\n"
+	"\n"
+	"\tif (scanf(\"%ld\", &value) == 1)\n"
+	"\t\t*n = value;\n"
+	"}\n"
+	"\n"
+	"static inline void\n"
+	"pl0_write(long n)\n"
+	"{\n"
+	"\tprintf(\"%ld\\n\", n);\n"
+	"}\n";
+
+static void
+cgen_indent(cgen_t *c)
+{
+	for (int i = 0; i < c->indent; i++)
+		fputc('\t', c->stream);
+}
+
+/* Print a literal, spelling LONG_MIN without overflow */
+static void
+cgen_number(cgen_t *c, long n)
+{
+	if (n == LONG_MIN)
+		fprintf(c->stream, "(%ldL - 1)", n + 1);
+	else if (n < 0)
+		fprintf(c->stream, "(%ldL)", n);
+	else
+		fprintf(c->stream, "%ldL", n);
+}
+
+/* Print frame of a block, level blocks out from current one */
+static void
+cgen_frame(cgen_t *c, int level)
+{
+	fprintf(c->stream, "f");
+	while (level--)
+		fprintf(c->stream, "->up");
+}
+
+/* Print lvalue of a variable */
+static void
+cgen_var(cgen_t *c, const node_t *var)
+{
+	const ast_t *ast = c->ast;
+
+	cgen_frame(c, ast->blocks[c->block].depth - var->depth);
+	fprintf(c->stream, "->v_%s",
+		intern_name(ast->syms[var->sym].name_id));
+}
+
+/* Whether expression n may end the program with a runtime error */
+static bool
+cgen_may_fail(const ast_t *ast, int n)
+{
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_binop:
+		if (node->op == slash || node->op == percent)
+			return true;
+		/* fall through */
+	case ast_cond:
+		return cgen_may_fail(ast, node->kid[0]) ||
+		       cgen_may_fail(ast, node->kid[1]);
+	case ast_neg:
+	case ast_odd:
+		return cgen_may_fail(ast, node->kid[0]);
+	default:
+		return false;
+	}
+}
+
+/**
+ * C leaves order of operands unspecified, so a left operand that may
+ * fail while the right may too is evaluated first into pl0_t<n>, for
+ * the error reported to be the same as of the other engines.
+*/
+static bool
+cgen_sequenced(const ast_t *ast, int n)
+{
+	const node_t *node = ast->nodes + n;
+
+	return (node->type == ast_binop || node->type == ast_cond) &&
+	       cgen_may_fail(ast, node->kid[0]) &&
+	       cgen_may_fail(ast, node->kid[1]);
+}
+
+static void cgen_expression(cgen_t *c, int n);
+
+/* Print left operand of n, or its temporary evaluated before */
+static void
+cgen_left(cgen_t *c, int n, bool sequenced)
+{
+	if (sequenced)
+		fprintf(c->stream, "pl0_t%d", n);
+	else
+		cgen_expression(c, c->ast->nodes[n].kid[0]);
+}
+
+static void
+cgen_expression(cgen_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+	bool sequenced = cgen_sequenced(c->ast, n);
+
+	switch (node->type) {
+	case ast_num:
+		cgen_number(c, node->num);
+		break;
+	case ast_var:
+		cgen_var(c, node);
+		break;
+	case ast_neg:
+		fprintf(c->stream, "pl0_neg(");
+		cgen_expression(c, node->kid[0]);
+		fprintf(c->stream, ")");
+		break;
+	case ast_binop:
+		if (sequenced) {
+			fprintf(c->stream, "(pl0_t%d = ", n);
+			cgen_expression(c, node->kid[0]);
+			fprintf(c->stream, ", ");
+		}
+		switch (node->op) {
+		case plus:
+			fprintf(c->stream, "pl0_add(");
+			break;
+		case minus:
+			fprintf(c->stream, "pl0_sub(");
+			break;
+		case times:
+			fprintf(c->stream, "pl0_mul(");
+			break;
+		case percent:
+			fprintf(c->stream, "pl0_mod(");
+			break;
+		default:
+			fprintf(c->stream, "pl0_div(");
+			break;
+		}
+		cgen_left(c, n, sequenced);
+		fprintf(c->stream, ", ");
+		cgen_expression(c, node->kid[1]);
+		if (node->op == slash || node->op == percent)
+			fprintf(c->stream, ", %d, %d", node->pos.row,
+				node->pos.col);
+		fprintf(c->stream, sequenced ? "))" : ")");
+		break;
+	case ast_odd:
+		fprintf(c->stream, "(");
+		cgen_expression(c, node->kid[0]);
+		fprintf(c->stream, " %% 2 != 0)");
+		break;
+	case ast_cond:
+		fprintf(c->stream, "(");
+		if (sequenced) {
+			fprintf(c->stream, "pl0_t%d = ", n);
+			cgen_expression(c, node->kid[0]);
+			fprintf(c->stream, ", ");
+		}
+		cgen_left(c, n, sequenced);
+		switch (node->op) {
+		case eql:
+			fprintf(c->stream, " == ");
+			break;
+		case neq:
+			fprintf(c->stream, " != ");
+			break;
+		case lss:
+			fprintf(c->stream, " < ");
+			break;
+		case leq:
+			fprintf(c->stream, " <= ");
+			break;
+		case gtr:
+			fprintf(c->stream, " > ");
+			break;
+		default:
+			fprintf(c->stream, " >= ");
+			break;
+		}
+		cgen_expression(c, node->kid[1]);
+		fprintf(c->stream, ")");
+		break;
+	default:
+		break;
+	}
+}
+
+/* Print condition of if and while, with parentheses */
+static void
+cgen_condition(cgen_t *c, int n)
+{
+	NODE type = c->ast->nodes[n].type;
+
+	if (type != ast_cond && type != ast_odd)
+		fprintf(c->stream, "(");
+	cgen_expression(c, n);
+	if (type != ast_cond && type != ast_odd)
+		fprintf(c->stream, ")");
+}
+
+static void
+cgen_statement(cgen_t *c, int n)
+{
+	const ast_t *ast = c->ast;
+	const node_t *node = ast->nodes + n;
+	int sym;
+
+	switch (node->type) {
+	case ast_assign:
+		cgen_indent(c);
+		cgen_var(c, node);
+		fprintf(c->stream, " = ");
+		cgen_expression(c, node->kid[0]);
+		fprintf(c->stream, ";\n");
+		break;
+	case ast_call:
+		/* Static link is the frame of the block declaring procedure */
+		sym = node->sym;
+		cgen_indent(c);
+		fprintf(c->stream, "pl0_block%d(", ast->syms[sym].block);
+		cgen_frame(c, ast->blocks[c->block].depth -
+				      ast->blocks[ast->syms[sym].block].depth +
+				      1);
+		fprintf(c->stream, ");\n");
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			cgen_statement(c, n);
+		break;
+	case ast_if:
+	case ast_while:
+		cgen_indent(c);
+		fprintf(c->stream, node->type == ast_if ? "if " : "while ");
+		cgen_condition(c, node->kid[0]);
+		fprintf(c->stream, " {\n");
+		c->indent++;
+		cgen_statement(c, node->kid[1]);
+		c->indent--;
+		cgen_indent(c);
+		fprintf(c->stream, "}\n");
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			cgen_indent(c);
+			fprintf(c->stream, "pl0_read(&");
+			cgen_var(c, ast->nodes + n);
+			fprintf(c->stream, ");\n");
+		}
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			cgen_indent(c);
+			fprintf(c->stream, "pl0_write(");
+			cgen_expression(c, n);
+			fprintf(c->stream, ");\n");
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* Print head of the function of a block, with newline after type */
+static void
+cgen_head(cgen_t *c, int block, const char *sep)
+{
+	const ast_block_t *b = c->ast->blocks + block;
+
+	if (b->parent < 0)
+		fprintf(c->stream, "static void%spl0_block%d(void *up)", sep,
+			block);
+	else
+		fprintf(c->stream, "static void%spl0_block%d(struct frame%d *up)",
+			sep, block, b->parent);
+}
+
+void
+cgen_emit(const ast_t *ast, FILE *stream)
+{
+	cgen_t c = { .ast = ast, .stream = stream };
+
+	fprintf(stream, "/* Translated from PL/0 by PL0-Analyzer */\n\n");
+	fputs(cgen_prelude, stream);
+
+	/* Frame of each block, variables in slot order */
+	for (int b = 0; b < ast->block_num; b++) {
+		const ast_block_t *block = ast->blocks + b;
+
+		fprintf(stream, "\n");
+		if (block->sym >= 0)
+			fprintf(stream, "/* procedure %s */\n",
+				intern_name(ast->syms[block->sym].name_id));
+		fprintf(stream, "struct frame%d {\n", b);
+		if (block->parent < 0)
+			fprintf(stream, "\tvoid *up;\n");
+		else
+			fprintf(stream, "\tstruct frame%d *up;\n",
+				block->parent);
+		for (int s = 0; s < ast->sym_num; s++) {
+			if (ast->syms[s].type == variable &&
+			    ast->syms[s].block == b)
+				fprintf(stream, "\tlong v_%s;\n",
+					intern_name(ast->syms[s].name_id));
+		}
+		fprintf(stream, "};\n");
+	}
+
+	fprintf(stream, "\n");
+	for (int b = 0; b < ast->block_num; b++) {
+		cgen_head(&c, b, " ");
+		fprintf(stream, ";\n");
+	}
+
+	/* Expressions call no procedure, so one temporary a node is safe */
+	for (int n = 1; n < ast->node_num; n++) {
+		if (cgen_sequenced(ast, n))
+			fprintf(stream, "static long pl0_t%d;\n", n);
+	}
+
+	for (int b = 0; b < ast->block_num; b++) {
+		c.block = b;
+		c.indent = 1;
+		fprintf(stream, "\n");
+		cgen_head(&c, b, "\n");
+		/* Every activation starts with zeroed variables */
+		fprintf(stream, "\n{\n"
+				"\tstruct frame%d f[1] = { { .up = up } };\n\n",
+			b);
+		cgen_statement(&c, ast->blocks[b].body);
+		fprintf(stream, "}\n");
+	}
+
+	fprintf(stream, "\n"
+			"int\n"
+			"main(void)\n"
+			"{\n"
+			"\tpl0_block0(NULL);\n"
+			"\treturn 0;\n"
+			"}\n");
+}
+
+void
+cgen_write(const ast_t *ast, context_t *context, const char *output)
+{
+	FILE *stream = fopen(output, "w");
+
+	if (!stream) {
+		snprintf(context_top_restrict(context)->message,
+			 MAX_CONTEXT_MSG_SIZE, "cgen: cannot open %s", output);
+		exit(1);
+	}
+	cgen_emit(ast, stream);
+	fclose(stream);
+}
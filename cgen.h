@@ -0,0 +1,34 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CGEN_H
+#define CGEN_H
+
+#include "ast.h"
+
+/**
+ * Write a parsed program as portable C: each block becomes a static
+ * function with its variables in a frame struct linked to the frame
+ * of the enclosing block.
+*/
+void cgen_emit(const ast_t *ast, FILE *stream);
+
+/* Write C source of a parsed program into file output */
+void cgen_write(const ast_t *ast, context_t *context, const char *output);
+
+#endif /* CGEN_H */
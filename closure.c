@@ -0,0 +1,515 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "closure.h"
+#include "arith.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/* Longs in the first chunk of records */
+#define CLOSURE_CHUNK_SIZE 0x1000
+/**
+ * Bytes of C stack calls may nest on at most, calls going deeper end
+ * the program before the stack overflows
+*/
+#define CLOSURE_STACK_SIZE 0x400000
+
+/* Records are carved from chunks that never move */
+typedef struct closure_chunk {
+	struct closure_chunk *next;
+	long *end;
+	long data[];
+} closure_chunk_t;
+
+/* State of a running program */
+struct closure_run {
+	context_t *context;
+	/**
+	 * Record of the active block of each depth. Records never move,
+	 * so a variable is one load from here.
+	*/
+	long **display;
+	/* Chunk holding the top of records */
+	closure_chunk_t *chunk;
+	long *top;
+	/**
+	 * Calls nest on the C stack, as deep as their statements are.
+	 * So the depth checked is that of stack from where the program
+	 * started.
+	*/
+	const char *stack_base;
+	size_t stack_size;
+};
+
+/* State of the closure compiler */
+typedef struct {
+	closure_t *cl;
+	const ast_t *ast;
+	context_t *context;
+} closure_compiler_t;
+
+typedef long (*closure_eval_t)(const closure_expr_t *x, closure_run_t *r);
+typedef void (*closure_exec_t)(const closure_stmt_t *x, closure_run_t *r);
+
+static void
+closure_no_mem(const context_t *context)
+{
+	sprintf(context_top_restrict(context)->message, "Out of memory");
+	exit(1);
+}
+
+static void
+closure_fail(const closure_run_t *r, pos_t pos, const char *msg)
+{
+	snprintf(context_top_restrict(r->context)->message,
+		 MAX_CONTEXT_MSG_SIZE, "runtime:%d:%d: %s", pos.row, pos.col,
+		 msg);
+	exit(1);
+}
+
+static long
+closure_error(const closure_expr_t *x, closure_run_t *r, const char *msg)
+{
+	closure_fail(r, x->pos, msg);
+	return 0;
+}
+
+#define CLOSURE_VAR(k) (r->display[x->depth[k]][x->slot[k]])
+
+static long
+closure_num(const closure_expr_t *x, closure_run_t *r)
+{
+	(void)r;
+	return x->num;
+}
+
+static long
+closure_var(const closure_expr_t *x, closure_run_t *r)
+{
+	return CLOSURE_VAR(0);
+}
+
+static long
+closure_neg(const closure_expr_t *x, closure_run_t *r)
+{
+	return arith_neg(x->kid[0]->eval(x->kid[0], r));
+}
+
+static long
+closure_odd(const closure_expr_t *x, closure_run_t *r)
+{
+	return x->kid[0]->eval(x->kid[0], r) % 2 != 0;
+}
+
+/**
+ * Closures of a binary operator on a and b: xx for operands of other
+ * closures, vv for two variables, vn for a variable and a number.
+*/
+#define CLOSURE_BINOP(name, value)                                             \
+	static long closure_##name##_xx(const closure_expr_t *x,               \
+					closure_run_t *r)                      \
+	{                                                                      \
+		long a = x->kid[0]->eval(x->kid[0], r);                        \
+		long b = x->kid[1]->eval(x->kid[1], r);                        \
+		return value;                                                  \
+	}                                                                      \
+	static long closure_##name##_vv(const closure_expr_t *x,               \
+					closure_run_t *r)                      \
+	{                                                                      \
+		long a = CLOSURE_VAR(0), b = CLOSURE_VAR(1);                   \
+		return value;                                                  \
+	}                                                                      \
+	static long closure_##name##_vn(const closure_expr_t *x,               \
+					closure_run_t *r)                      \
+	{                                                                      \
+		long a = CLOSURE_VAR(0), b = x->num;                           \
+		return value;                                                  \
+	}
+
+CLOSURE_BINOP(add, arith_add(a, b))
+CLOSURE_BINOP(sub, arith_sub(a, b))
+CLOSURE_BINOP(mul, arith_mul(a, b))
+CLOSURE_BINOP(div, arith_divisible(a, b) ?
+			   a / b :
+			   closure_error(x, r, arith_div_error(b)))
+CLOSURE_BINOP(mod, arith_divisible(a, b) ?
+			   a % b :
+			   closure_error(x, r, arith_div_error(b)))
+CLOSURE_BINOP(eql, a == b)
+CLOSURE_BINOP(neq, a != b)
+CLOSURE_BINOP(lss, a < b)
+CLOSURE_BINOP(leq, a <= b)
+CLOSURE_BINOP(gtr, a > b)
+CLOSURE_BINOP(geq, a >= b)
+
+#define CLOSURE_OPS(name)                                                      \
+	closure_##name##_xx, closure_##name##_vv, closure_##name##_vn
+
+static const struct {
+	SYMBOL op;
+	closure_eval_t xx, vv, vn;
+} closure_binops[] = {
+	{ plus, CLOSURE_OPS(add) },  { minus, CLOSURE_OPS(sub) },
+	{ times, CLOSURE_OPS(mul) }, { slash, CLOSURE_OPS(div) },
+	{ percent, CLOSURE_OPS(mod) }, { eql, CLOSURE_OPS(eql) },
+	{ neq, CLOSURE_OPS(neq) },   { lss, CLOSURE_OPS(lss) },
+	{ leq, CLOSURE_OPS(leq) },   { gtr, CLOSURE_OPS(gtr) },
+	{ geq, CLOSURE_OPS(geq) },
+};
+
+/* Push zeroed record of nvars variables */
+static long *
+closure_push(closure_run_t *r, int nvars)
+{
+	long *frame;
+
+	if (r->top + nvars > r->chunk->end) {
+		closure_chunk_t *next = r->chunk->next;
+
+		/* Chunks past the top are kept for later calls */
+		if (!next || next->data + nvars > next->end) {
+			long size = CLOSURE_CHUNK_SIZE;
+
+			while (size < nvars)
+				size *= 2;
+			if (!(next = malloc(sizeof(closure_chunk_t) +
+					    size * sizeof(long))))
+				closure_no_mem(r->context);
+			next->end = next->data + size;
+			next->next = r->chunk->next;
+			r->chunk->next = next;
+		}
+		r->chunk = next;
+		r->top = next->data;
+	}
+
+	frame = r->top;
+	r->top += nvars;
+	memset(frame, 0, nvars * sizeof(long));
+	return frame;
+}
+
+/**
+ * Run body of block in a new record. Blocks out of it are out of the
+ * caller too, so only the display entry of its own depth changes.
+*/
+static void
+closure_enter(closure_run_t *r, const closure_block_t *b)
+{
+	closure_chunk_t *chunk = r->chunk;
+	long *top = r->top;
+	long *frame = r->display[b->depth];
+
+	r->display[b->depth] = closure_push(r, b->nvars);
+	b->body->exec(b->body, r);
+	r->display[b->depth] = frame;
+	r->chunk = chunk;
+	r->top = top;
+}
+
+static void
+closure_nop(const closure_stmt_t *x, closure_run_t *r)
+{
+	(void)x;
+	(void)r;
+}
+
+static void
+closure_assign(const closure_stmt_t *x, closure_run_t *r)
+{
+	long value = x->expr->eval(x->expr, r);
+
+	r->display[x->depth][x->slot] = value;
+}
+
+static void
+closure_inc(const closure_stmt_t *x, closure_run_t *r)
+{
+	long *var = &r->display[x->depth][x->slot];
+
+	*var = arith_add(*var, x->num);
+}
+
+static void
+closure_dec(const closure_stmt_t *x, closure_run_t *r)
+{
+	long *var = &r->display[x->depth][x->slot];
+
+	*var = arith_sub(*var, x->num);
+}
+
+static void
+closure_call(const closure_stmt_t *x, closure_run_t *r)
+{
+	const char *sp = __builtin_frame_address(0);
+
+	if ((size_t)(r->stack_base - sp) > r->stack_size)
+		closure_fail(r, x->pos, "too many nested calls");
+	closure_enter(r, x->block);
+}
+
+static void
+closure_begin(const closure_stmt_t *x, closure_run_t *r)
+{
+	for (const closure_stmt_t *s = x->body; s; s = s->next)
+		s->exec(s, r);
+}
+
+static void
+closure_if(const closure_stmt_t *x, closure_run_t *r)
+{
+	if (x->expr->eval(x->expr, r))
+		x->body->exec(x->body, r);
+}
+
+static void
+closure_while(const closure_stmt_t *x, closure_run_t *r)
+{
+	while (x->expr->eval(x->expr, r))
+		x->body->exec(x->body, r);
+}
+
+static void
+closure_read(const closure_stmt_t *x, closure_run_t *r)
+{
+	long tmp;
+
+	if (scanf("%ld", &tmp) == 1)
+		r->display[x->depth][x->slot] = tmp;
+}
+
+static void
+closure_write(const closure_stmt_t *x, closure_run_t *r)
+{
+	fprintf(r->context->outstream, "%ld\n", x->expr->eval(x->expr, r));
+}
+
+static void *
+closure_new(closure_compiler_t *c, size_t size)
+{
+	void *ptr = region_alloc(c->cl->region, size);
+
+	if (!ptr)
+		closure_no_mem(c->context);
+	return ptr;
+}
+
+static const closure_expr_t *
+closure_expression(closure_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+	const node_t *a, *b;
+	closure_expr_t *x = closure_new(c, sizeof(closure_expr_t));
+	size_t k = 0;
+
+	x->pos = node->pos;
+	switch (node->type) {
+	case ast_num:
+		x->eval = closure_num;
+		x->num = node->num;
+		break;
+	case ast_var:
+		x->eval = closure_var;
+		x->depth[0] = node->depth;
+		x->slot[0] = node->slot;
+		break;
+	case ast_neg:
+	case ast_odd:
+		x->eval = node->type == ast_neg ? closure_neg : closure_odd;
+		x->kid[0] = closure_expression(c, node->kid[0]);
+		break;
+	case ast_binop:
+	case ast_cond:
+		while (closure_binops[k].op != node->op)
+			k++;
+		a = c->ast->nodes + node->kid[0];
+		b = c->ast->nodes + node->kid[1];
+		if (a->type == ast_var &&
+		    (b->type == ast_var || b->type == ast_num)) {
+			x->depth[0] = a->depth;
+			x->slot[0] = a->slot;
+			if (b->type == ast_var) {
+				x->eval = closure_binops[k].vv;
+				x->depth[1] = b->depth;
+				x->slot[1] = b->slot;
+			} else {
+				x->eval = closure_binops[k].vn;
+				x->num = b->num;
+			}
+		} else {
+			x->eval = closure_binops[k].xx;
+			x->kid[0] = closure_expression(c, node->kid[0]);
+			x->kid[1] = closure_expression(c, node->kid[1]);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return x;
+}
+
+static closure_stmt_t *
+closure_statement(closure_compiler_t *c, int n)
+{
+	const ast_t *ast = c->ast;
+	const node_t *node = ast->nodes + n;
+	const node_t *value, *var;
+	closure_stmt_t *x = closure_new(c, sizeof(closure_stmt_t));
+	const closure_stmt_t **tail = &x->body;
+
+	switch (node->type) {
+	case ast_assign:
+		x->depth = node->depth;
+		x->slot = node->slot;
+		value = ast->nodes + node->kid[0];
+		var = ast->nodes + value->kid[0];
+		/* a := a + n and a := a - n */
+		if (value->type == ast_binop &&
+		    (value->op == plus || value->op == minus) &&
+		    var->type == ast_var && var->depth == node->depth &&
+		    var->slot == node->slot &&
+		    ast->nodes[value->kid[1]].type == ast_num) {
+			x->exec = value->op == plus ? closure_inc : closure_dec;
+			x->num = ast->nodes[value->kid[1]].num;
+		} else {
+			x->exec = closure_assign;
+			x->expr = closure_expression(c, node->kid[0]);
+		}
+		break;
+	case ast_call:
+		x->exec = closure_call;
+		x->block = c->cl->blocks + ast->syms[node->sym].block;
+		x->pos = node->pos;
+		break;
+	case ast_begin:
+		x->exec = closure_begin;
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			closure_stmt_t *s = closure_statement(c, n);
+
+			*tail = s;
+			tail = &s->next;
+		}
+		break;
+	case ast_if:
+	case ast_while:
+		x->exec = node->type == ast_if ? closure_if : closure_while;
+		x->expr = closure_expression(c, node->kid[0]);
+		x->body = closure_statement(c, node->kid[1]);
+		break;
+	case ast_read:
+		/* One closure for each argument */
+		x->exec = closure_begin;
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			closure_stmt_t *read =
+				closure_new(c, sizeof(closure_stmt_t));
+
+			read->exec = closure_read;
+			read->depth = ast->nodes[n].depth;
+			read->slot = ast->nodes[n].slot;
+			*tail = read;
+			tail = &read->next;
+		}
+		break;
+	case ast_write:
+		x->exec = closure_begin;
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			closure_stmt_t *write =
+				closure_new(c, sizeof(closure_stmt_t));
+
+			write->exec = closure_write;
+			write->expr = closure_expression(c, n);
+			*tail = write;
+			tail = &write->next;
+		}
+		break;
+	default:
+		x->exec = closure_nop;
+		break;
+	}
+
+	return x;
+}
+
+void
+closure_init(closure_t *cl)
+{
+	memset(cl, 0, sizeof(closure_t));
+	region_init(cl->region);
+}
+
+void
+closure_free(closure_t *cl)
+{
+	region_free(cl->region);
+	closure_init(cl);
+}
+
+void
+closure_compile(closure_t *cl, const ast_t *ast, context_t *context)
+{
+	closure_compiler_t c = { .cl = cl, .ast = ast, .context = context };
+
+	/* Calls are bound to blocks before their bodies are built */
+	cl->blocks = closure_new(&c, ast->block_num * sizeof(closure_block_t));
+	cl->max_depth = ast->max_depth;
+	for (int b = 0; b < ast->block_num; b++) {
+		cl->blocks[b].depth = ast->blocks[b].depth;
+		cl->blocks[b].nvars = ast->blocks[b].nvars;
+	}
+	for (int b = 0; b < ast->block_num; b++)
+		cl->blocks[b].body = closure_statement(&c, ast->blocks[b].body);
+}
+
+void
+closure_run(const closure_t *cl, context_t *context)
+{
+	closure_run_t r = { .context = context,
+			    .stack_base = __builtin_frame_address(0),
+			    .stack_size = CLOSURE_STACK_SIZE };
+	closure_chunk_t *first;
+	struct rlimit limit;
+
+	r.display = calloc(cl->max_depth + 1, sizeof(long *));
+	first = malloc(sizeof(closure_chunk_t) +
+		       CLOSURE_CHUNK_SIZE * sizeof(long));
+	if (!r.display || !first)
+		closure_no_mem(context);
+	first->next = NULL;
+	first->end = first->data + CLOSURE_CHUNK_SIZE;
+	r.chunk = first;
+	r.top = first->data;
+
+	/* Calls nest on at most half of a smaller stack */
+	if (!getrlimit(RLIMIT_STACK, &limit) &&
+	    limit.rlim_cur != RLIM_INFINITY &&
+	    limit.rlim_cur / 2 < r.stack_size)
+		r.stack_size = limit.rlim_cur / 2;
+
+	closure_enter(&r, cl->blocks);
+	fflush(context->outstream);
+
+	while (first) {
+		closure_chunk_t *next = first->next;
+		free(first);
+		first = next;
+	}
+	free(r.display);
+}
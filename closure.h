@@ -0,0 +1,89 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "ast.h"
+#include "region.h"
+
+typedef struct closure_run closure_run_t;
+typedef struct closure_expr closure_expr_t;
+typedef struct closure_stmt closure_stmt_t;
+
+/**
+ * Expression compiled into a C function bound to its operands. Operands
+ * that are variables or numbers are resolved into the closure itself,
+ * others are closures of their own.
+*/
+struct closure_expr {
+	long (*eval)(const closure_expr_t *x, closure_run_t *r);
+	const closure_expr_t *kid[2];
+	/* Variables read directly, by static depth and slot */
+	int depth[2];
+	int slot[2];
+	/* Value of a number, or right operand that is one */
+	long num;
+	/* Position in source, for runtime errors */
+	pos_t pos;
+};
+
+/* Procedure or main program, record and body of its calls */
+typedef struct {
+	const closure_stmt_t *body;
+	int depth;
+	int nvars;
+} closure_block_t;
+
+/* Statement compiled into a C function bound to its operands */
+struct closure_stmt {
+	void (*exec)(const closure_stmt_t *x, closure_run_t *r);
+	/* Next statement of a begin */
+	const closure_stmt_t *next;
+	/* Value, condition or argument */
+	const closure_expr_t *expr;
+	/* Body of if and while, statements of begin */
+	const closure_stmt_t *body;
+	/* Block of call */
+	const closure_block_t *block;
+	/* Variable assigned or read */
+	int depth;
+	int slot;
+	/* Constant added by an increment */
+	long num;
+	/* Position in source of call, for runtime errors */
+	pos_t pos;
+};
+
+/* Closures of a whole program */
+typedef struct {
+	/* Owner of every closure */
+	region_t region[1];
+	closure_block_t *blocks;
+	int max_depth;
+} closure_t;
+
+void closure_init(closure_t *cl);
+void closure_free(closure_t *cl);
+
+/* Turn every block of a parsed program into closures */
+void closure_compile(closure_t *cl, const ast_t *ast, context_t *context);
+/* Run closures of main program */
+void closure_run(const closure_t *cl, context_t *context);
+
+#endif /* CLOSURE_H */
@@ -19,13 +19,29 @@
 #include "context.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Get next token, abort on error */
 context_t *
 context_next(context_t *context)
 {
-	if (!context->scan) {
-		context->token_tail = context->token_tail->next;
+	lexbuf_t *buf = context->lexbuf;
+	const token_t *t;
+	char name[LEX_TEXT_SIZE];
+
+	/* Tokens lexed ahead end with eof or an invalid symbol */
+	if (context->token_pos + 1 < buf->num) {
+		t = buf->tokens + ++context->token_pos;
+		if (t->type == nul) {
+			lexbuf_name(buf, t, name, sizeof(name));
+			sprintf(context_top_restrict(context)->message,
+				"lex:%d:%d: invalid symbol: %s", t->pos.row,
+				t->pos.col, name);
+			exit(1);
+		}
 		return context;
 	}
 
@@ -34,8 +50,9 @@ context_next(context_t *context)
 	/* Abort if get an invalid symbol */
 	if (!flag)
 		exit(1);
-	/* Or add it into chain */
+	/* Or add it into tokens */
 	token_add(context, flag);
+	context->token_pos = buf->num - 1;
 
 	return context;
 }
@@ -43,43 +60,52 @@ context_next(context_t *context)
 context_t *
 context_prev(context_t *context)
 {
-	if (!context->token_num)
+	if (context->token_pos < 0)
 		return context;
 
-	context->token_tail = context->token_last_tail;
-	context->token_num--;
-
-	if (context->token_num > PREALLOC_SYM_NUM) {
-		free(context->token_last_tail);
-	}
+	context->lexbuf->num = context->token_pos;
+	context->token_pos--;
 
 	return context;
 }
 
+/* Region of contexts of the program being interpreted */
+static region_t program;
+
 void
 context_init(context_t *context, FILE *instream, FILE *outstream)
 {
 	context->instream = instream;
 	context->outstream = outstream;
+	context->input = 0;
+	context->lexbuf = token_stream();
 
-	context->token_tail = context->tokens;
-	context->token_num = 0;
+	context->token_pos = -1;
+	context->token_start = 0;
+	/* Chunks of a context used before went with its region */
+	memset(context->id_chunk, 0, sizeof(context->id_chunk));
+	ident_reset(context);
 
 	context->prev = 0;
+	context->region = &program;
 
 	context->excute = true;
-	context->scan = true;
 }
 
 context_t *
 context_fork(context_t *parent)
 {
 	context_t *context;
-	if (!(context = calloc(1, sizeof(context_t))))
+	if (!(context = region_alloc(parent->region, sizeof(context_t))))
 		goto no_mem;
 
 	/* Basic setups */
 	context_init(context, parent->instream, parent->outstream);
+	context->input = parent->input;
+	context->lexbuf = parent->lexbuf;
+	context->token_pos = parent->token_pos;
+	context->token_start = parent->token_pos;
+	context->region = parent->region;
 
 	/* prev for ident table */
 	context->prev = parent;
@@ -87,10 +113,57 @@ context_fork(context_t *parent)
 	return context;
 
 no_mem:
-	sprintf(context_top_restrict(context)->message, "Out of memory");
+	sprintf(context_top_restrict(parent)->message, "Out of memory");
 	exit(1);
 }
 
+void
+context_free(context_t *context)
+{
+	region_free(context->region);
+}
+
+bool
+context_map(context_t *context, input_t *input)
+{
+	struct stat st;
+	void *base;
+
+	if (fstat(fileno(context->instream), &st) || !S_ISREG(st.st_mode))
+		return false;
+
+	/* Nothing to map in an empty file */
+	if (!st.st_size) {
+		base = 0;
+	} else {
+		base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE,
+			    fileno(context->instream), 0);
+		if (base == MAP_FAILED)
+			return false;
+		madvise(base, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	input->base = base;
+	input->pos = base;
+	input->end = input->base + st.st_size;
+	context->input = input;
+
+	return true;
+}
+
+void
+context_unmap(context_t *context)
+{
+	input_t *input = context->input;
+
+	if (!input)
+		return;
+	if (input->base)
+		munmap((void *)input->base, input->end - input->base);
+	context->input = 0;
+	context->lexbuf = 0;
+}
+
 const context_t *
 context_top_restrict(const context_t *context)
 {
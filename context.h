@@ -22,9 +22,15 @@
 #include "symbols.h"
 #include "prompt.h"
 #include "interpreter.h"
+#include "lexbuf.h"
+#include "region.h"
 
-#define PREALLOC_SYM_NUM 0x040
-#define MAX_IDENT_NUM 0x40
+/**
+ * Idents of a context kept inline, more go to chunks of the region
+ * doubling in size, and an index on name ids replaces linear search.
+*/
+#define IDENT_SMALL 8
+#define IDENT_CHUNKS 28
 
 #define MAX_CONTEXT_MSG_SIZE 128
 #define MAX_TOKEN_BUFFER_SIZE 2048
@@ -34,25 +40,31 @@ typedef struct {
 	/* I/O stream */
 	FILE *instream;
 	FILE *outstream;
+	/* Mapped input, read instead of instream if not null */
+	input_t *input;
+	/**
+	 * Tokens shared by contexts of the same input, lexed ahead or
+	 * read from instream when parser goes past the last one.
+	*/
+	lexbuf_t *lexbuf;
 
 	prompt_t prompt[1];
 
-	/* Preallocated token chain, used by lex and syntax */
-	token_t tokens[PREALLOC_SYM_NUM];
-	/* Tail of token chain*/
-	token_t *token_tail;
-	token_t *token_last_tail;
-	/* Count for tokens */
-	int token_num;
+	/* Index of current token */
+	int token_pos;
+	/* Index of first token of the block of a procedure context */
+	int token_start;
 
 	/* Ident table, used by interpreter */
-	ident_t idents[MAX_IDENT_NUM];
-	size_t id_num;
+	ident_t idents[IDENT_SMALL];
+	ident_t *id_chunk[IDENT_CHUNKS];
+	int id_num;
+	/* Open addressing on name id, ident number + 1 or 0 if free */
+	int *id_index;
+	int id_mask;
 
 	/* For conditions */
 	bool excute;
-	/* Specify if scan next token from input */
-	bool scan;
 
 	/* Error message */
 	char *message;
@@ -61,10 +73,21 @@ typedef struct {
 
 	/* Point to previous context */
 	void *prev;
+	/* Region of the program, owning contexts forked from this one */
+	region_t *region;
 } context_t;
 
 void context_init(context_t *context, FILE *instream, FILE *outstream);
 context_t *context_fork(context_t *parent);
+/* Free every context forked for the program of context at once */
+void context_free(context_t *context);
+
+/**
+ * Map instream of context into memory, return false and keep reading
+ * with stdio if it cannot be mapped, e.g. a pipe.
+*/
+bool context_map(context_t *context, input_t *input);
+void context_unmap(context_t *context);
 
 const context_t *context_top_restrict(const context_t *context);
 context_t *context_top(context_t *context);
@@ -73,7 +96,7 @@ context_t *context_top(context_t *context);
  * Functions of tokens
 */
 
-/* Wrapper for fgetc/ungetc */
+/* Read mapped input, or wrapper for fgetc/ungetc */
 int get_char(context_t *context);
 int unget_char(context_t *context, int ch);
 
@@ -84,19 +107,31 @@ const char *sym2human(SYMBOL sym);
 
 /* Initialize variables */
 void token_init();
-/* Add a symbol to end of chain */
+/* Tokens read from instream by getsym() */
+lexbuf_t *token_stream();
+/* Add last symbol of getsym() to tokens of context */
 void token_add(context_t *context, int ch);
 /* Print token info */
 void token_dump(context_t *context);
+/* Lex mapped input repeatedly, report tokens per second */
+void token_bench(context_t *context);
 
 /**
  * Functions of syntax
 */
 
-/* Scan in next token */
+/* Move to next token, scan in one more if needed */
 context_t *context_next(context_t *context);
+/* Drop current token, the last one scanned in */
 context_t *context_prev(context_t *context);
 
+/* Current token */
+static inline token_t *
+token_cur(const context_t *context)
+{
+	return context->lexbuf->tokens + context->token_pos;
+}
+
 /**
  * Check if token->type matches the given SYMBOLs,
  * abort if no one matches.
@@ -146,7 +181,21 @@ int parse_factor(context_t *context);
 ident_t *ident_add(context_t *context, const token_t *token, IDENT type);
 int ident_assign(const context_t *context, ident_t *id, void *value);
 
-ident_t *ident_find(context_t *context, const char *name);
+ident_t *ident_find(context_t *context, int name_id);
+/**
+ * Find ident of current token, through the cache of the token when
+ * it was looked up from the same context before.
+*/
+ident_t *ident_lookup(context_t *context);
+/* Drop every ident of context */
+void ident_reset(context_t *context);
+/**
+ * Save idents of context as lines of "type value name" into stream,
+ * or replace them with idents saved there, so that interpreters of
+ * later lines see declarations of earlier ones.
+*/
+void ident_save(context_t *context, FILE *stream);
+void ident_load(context_t *context, FILE *stream);
 
 void ident_prompt(const ident_t *id);
 void ident_dump(context_t *context);
@@ -157,7 +206,7 @@ void ident_error(const context_t *context, const char *fmt, ...);
 #define ident_uninitialized(name)                                              \
 	ident_error(context, "variable \"%s\" used but not initialized", name)
 
-int operation(const context_t *context, int m, SYMBOL opt, int n);
-bool condition(const context_t *context, int m, SYMBOL opt, int n);
+long operation(const context_t *context, long m, SYMBOL opt, long n);
+bool condition(const context_t *context, long m, SYMBOL opt, long n);
 
 #endif /* CONTEXT_H */
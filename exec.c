@@ -0,0 +1,265 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ast.h"
+#include "arith.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define EXEC_STACK_SIZE 0x1000
+#define EXEC_CONT_SIZE 0x100
+
+/* What is left to do of a statement */
+typedef enum {
+	exec_k_statement, /* run statement n */
+	exec_k_list, /* run statements from n on, n is not 0 */
+	exec_k_return /* restore display entry of depth n to frame */
+} exec_kind_t;
+
+typedef struct {
+	exec_kind_t kind;
+	int n;
+	int frame;
+} exec_cont_t;
+
+/* State of the tree walker */
+typedef struct {
+	const ast_t *ast;
+	context_t *context;
+	/**
+	 * Activation records, one for each active call, holding the
+	 * variables of its block. Records are pushed and popped at top,
+	 * so a call allocates nothing but stack.
+	*/
+	long *stack;
+	int top;
+	int size;
+	/**
+	 * Offset of record of the active block of each depth, the
+	 * innermost activation visible from the running block.
+	*/
+	int *display;
+	/**
+	 * Continuations of the statements running, so calls nest on
+	 * this stack instead of the C stack however deep they go.
+	*/
+	exec_cont_t *conts;
+	int cont_top;
+	int cont_size;
+} exec_t;
+
+static void
+exec_error(const exec_t *e, const node_t *node, const char *msg)
+{
+	snprintf(context_top_restrict(e->context)->message,
+		 MAX_CONTEXT_MSG_SIZE, "runtime:%d:%d: %s", node->pos.row,
+		 node->pos.col, msg);
+	exit(1);
+}
+
+/* Push zeroed record of block, return its offset */
+static int
+exec_push(exec_t *e, int block)
+{
+	int frame = e->top;
+	int nvars = e->ast->blocks[block].nvars;
+
+	if (e->top + nvars > e->size) {
+		while (e->top + nvars > e->size)
+			e->size *= 2;
+		if (!(e->stack = realloc(e->stack, e->size * sizeof(long)))) {
+			sprintf(context_top_restrict(e->context)->message,
+				"Out of memory");
+			exit(1);
+		}
+	}
+	memset(e->stack + frame, 0, nvars * sizeof(long));
+	e->top += nvars;
+	return frame;
+}
+
+/* Push what is left to do, to be done before what was pushed earlier */
+static void
+exec_then(exec_t *e, exec_kind_t kind, int n, int frame)
+{
+	if (e->cont_top == e->cont_size) {
+		e->cont_size *= 2;
+		if (!(e->conts = realloc(e->conts,
+					 e->cont_size * sizeof(exec_cont_t)))) {
+			sprintf(context_top_restrict(e->context)->message,
+				"Out of memory");
+			exit(1);
+		}
+	}
+	e->conts[e->cont_top++] = (exec_cont_t){ kind, n, frame };
+}
+
+static long
+exec_expression(const exec_t *e, int n)
+{
+	const node_t *node = e->ast->nodes + n;
+	long m, k;
+
+	switch (node->type) {
+	case ast_num:
+		return node->num;
+	case ast_var:
+		return e->stack[e->display[node->depth] + node->slot];
+	case ast_neg:
+		return arith_neg(exec_expression(e, node->kid[0]));
+	case ast_binop:
+		m = exec_expression(e, node->kid[0]);
+		k = exec_expression(e, node->kid[1]);
+		if ((node->op == slash || node->op == percent) &&
+		    !arith_divisible(m, k))
+			exec_error(e, node, arith_div_error(k));
+		return operation(e->context, m, node->op, k);
+	case ast_odd:
+		return exec_expression(e, node->kid[0]) % 2 != 0;
+	case ast_cond:
+		m = exec_expression(e, node->kid[0]);
+		return condition(e->context, m, node->op,
+				 exec_expression(e, node->kid[1]));
+	default:
+		exec_error(e, node, "invalid expression");
+		return 0;
+	}
+}
+
+/**
+ * Run statement n up to its first call or loop iteration, going on
+ * into one nested statement directly and pushing what is left.
+*/
+static void
+exec_statement(exec_t *e, int n)
+{
+	const node_t *node, *var;
+	int block, depth;
+	long tmp;
+
+	for (;;) {
+		node = e->ast->nodes + n;
+		switch (node->type) {
+		case ast_none:
+			return;
+		case ast_assign:
+			tmp = exec_expression(e, node->kid[0]);
+			e->stack[e->display[node->depth] + node->slot] = tmp;
+			return;
+		case ast_call:
+			/**
+			 * Block of a procedure symbol is its body. Blocks
+			 * out of it are out of the caller too, so only the
+			 * display entry of its own depth changes.
+			*/
+			block = e->ast->syms[node->sym].block;
+			depth = e->ast->blocks[block].depth;
+			exec_then(e, exec_k_return, depth, e->display[depth]);
+			e->display[depth] = exec_push(e, block);
+			n = e->ast->blocks[block].body;
+			continue;
+		case ast_begin:
+			if (!(n = node->kid[0]))
+				return;
+			if (e->ast->nodes[n].next)
+				exec_then(e, exec_k_list,
+					  e->ast->nodes[n].next, 0);
+			continue;
+		case ast_if:
+			if (!exec_expression(e, node->kid[0]))
+				return;
+			n = node->kid[1];
+			continue;
+		case ast_while:
+			/* Loop is tested again once its body is done */
+			if (!exec_expression(e, node->kid[0]))
+				return;
+			exec_then(e, exec_k_statement, n, 0);
+			n = node->kid[1];
+			continue;
+		case ast_read:
+			for (n = node->kid[0]; n; n = var->next) {
+				var = e->ast->nodes + n;
+				if (scanf("%ld", &tmp) == 1)
+					e->stack[e->display[var->depth] +
+						 var->slot] = tmp;
+			}
+			return;
+		case ast_write:
+			for (n = node->kid[0]; n; n = e->ast->nodes[n].next)
+				fprintf(e->context->outstream, "%ld\n",
+					exec_expression(e, n));
+			return;
+		default:
+			exec_error(e, node, "invalid statement");
+			return;
+		}
+	}
+}
+
+/* Run statement n and everything it pushes */
+static void
+exec_run(exec_t *e, int n)
+{
+	exec_cont_t k;
+
+	exec_then(e, exec_k_statement, n, 0);
+	while (e->cont_top) {
+		k = e->conts[--e->cont_top];
+		switch (k.kind) {
+		case exec_k_statement:
+			exec_statement(e, k.n);
+			break;
+		case exec_k_list:
+			if (e->ast->nodes[k.n].next)
+				exec_then(e, exec_k_list,
+					  e->ast->nodes[k.n].next, 0);
+			exec_statement(e, k.n);
+			break;
+		case exec_k_return:
+			e->top = e->display[k.n];
+			e->display[k.n] = k.frame;
+			break;
+		}
+	}
+}
+
+void
+ast_exec(const ast_t *ast, context_t *context)
+{
+	exec_t e = { .ast = ast, .context = context,
+		     .size = EXEC_STACK_SIZE, .cont_size = EXEC_CONT_SIZE };
+
+	e.stack = malloc(e.size * sizeof(long));
+	e.display = calloc(ast->max_depth + 1, sizeof(int));
+	e.conts = malloc(e.cont_size * sizeof(exec_cont_t));
+	if (!e.stack || !e.display || !e.conts) {
+		sprintf(context_top_restrict(context)->message,
+			"Out of memory");
+		exit(1);
+	}
+
+	e.display[0] = exec_push(&e, 0);
+	exec_run(&e, ast->blocks[0].body);
+	fflush(context->outstream);
+
+	free(e.stack);
+	free(e.display);
+	free(e.conts);
+}
@@ -0,0 +1,127 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+intern_t interns;
+
+/* FNV-1a */
+static inline uint32_t
+intern_hash(const char *name, int len)
+{
+	uint32_t h = 2166136261u;
+
+	for (int i = 0; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h;
+}
+
+void
+intern_reset()
+{
+	free(interns.slots);
+	free(interns.offsets);
+	free(interns.text);
+	memset(&interns, 0, sizeof(intern_t));
+}
+
+/* Double slots, ids stay the same */
+static bool
+intern_rehash(intern_t *t)
+{
+	size_t cap = t->slots ? (t->mask + 1) * 2 : INTERN_PREALLOC_SLOTS;
+	intern_slot_t *slots = malloc(cap * sizeof(*slots));
+
+	if (!slots)
+		return false;
+	for (size_t i = 0; i < cap; i++)
+		slots[i].id = -1;
+
+	for (size_t i = 0; t->slots && i <= t->mask; i++) {
+		size_t j = t->slots[i].hash & (cap - 1);
+
+		if (t->slots[i].id == -1)
+			continue;
+		while (slots[j].id != -1)
+			j = (j + 1) & (cap - 1);
+		slots[j] = t->slots[i];
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->mask = cap - 1;
+	return true;
+}
+
+/* Copy a new spelling into text, return its id */
+static int
+intern_store(intern_t *t, const char *name, int len)
+{
+	if (t->num == t->cap) {
+		int cap = t->cap ? t->cap * 2 : INTERN_PREALLOC_SLOTS / 2;
+		size_t *offsets = realloc(t->offsets, cap * sizeof(size_t));
+
+		if (!offsets)
+			return -1;
+		t->offsets = offsets;
+		t->cap = cap;
+	}
+
+	if (t->text_len + len + 1 > t->text_cap) {
+		size_t cap = t->text_cap ? t->text_cap * 2 : 0x1000;
+		char *text;
+
+		while (cap < t->text_len + len + 1)
+			cap *= 2;
+		if (!(text = realloc(t->text, cap)))
+			return -1;
+		t->text = text;
+		t->text_cap = cap;
+	}
+
+	t->offsets[t->num] = t->text_len;
+	memcpy(t->text + t->text_len, name, len);
+	t->text_len += len;
+	t->text[t->text_len++] = 0;
+	return t->num++;
+}
+
+int
+intern(const char *name, int len)
+{
+	intern_t *t = &interns;
+	uint32_t hash = intern_hash(name, len);
+	size_t i;
+
+	if ((size_t)t->num * 2 >= t->mask && !intern_rehash(t))
+		return -1;
+
+	for (i = hash & t->mask; t->slots[i].id != -1; i = (i + 1) & t->mask) {
+		const char *s = t->text + t->offsets[t->slots[i].id];
+
+		if (t->slots[i].hash == hash && !strncmp(s, name, len) &&
+		    !s[len])
+			return t->slots[i].id;
+	}
+
+	t->slots[i].hash = hash;
+	return t->slots[i].id = intern_store(t, name, len);
+}
@@ -0,0 +1,67 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Slots of an empty table, kept at most half full */
+#define INTERN_PREALLOC_SLOTS 0x400
+
+/* Slot of the table, probing compares text only on a full hash match */
+typedef struct {
+	uint32_t hash;
+	/* Id of spelling, -1 if empty */
+	int id;
+} intern_slot_t;
+
+/**
+ * Open addressing table with linear probing, giving each distinct
+ * ident spelling a small integer id in order of first appearance.
+*/
+typedef struct {
+	intern_slot_t *slots;
+	size_t mask;
+
+	/* Spellings by id, NUL-terminated in text */
+	size_t *offsets;
+	int num;
+	int cap;
+	char *text;
+	size_t text_len;
+	size_t text_cap;
+} intern_t;
+
+/* Drop every spelling of the table of this process */
+void intern_reset();
+
+/* Id of a spelling, added if new, -1 if out of memory */
+int intern(const char *name, int len);
+
+/* Spelling of an id */
+static inline const char *
+intern_name(int id)
+{
+	extern intern_t interns;
+	return interns.text + interns.offsets[id];
+}
+
+#endif /* INTERN_H */
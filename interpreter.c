@@ -18,71 +18,227 @@
 
 #include "interpreter.h"
 
+#include <limits.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "context.h"
+#include "intern.h"
+#include "arith.h"
 
 void
 ident_error(const context_t *context, const char *fmt, ...)
 {
-	extern pos_t err;
+	char *message = context_top_restrict(context)->message;
+	pos_t err = token_cur(context)->pos;
 	va_list ap;
+	int len;
 
-	va_start(ap, fmt);
-
-	sprintf(context_top_restrict(context)->message, "interpreter:%d:%d: ", err.row,
-		err.col);
-	vsprintf(context_top_restrict(context)->message, fmt, ap);
+	len = snprintf(message, MAX_CONTEXT_MSG_SIZE, "interpreter:%d:%d: ",
+		       err.row, err.col);
 
+	va_start(ap, fmt);
+	vsnprintf(message + len, MAX_CONTEXT_MSG_SIZE - len, fmt, ap);
 	va_end(ap);
 
 	exit(1);
 }
 
-ident_t *
-ident_add(context_t *context, const token_t *token, IDENT type)
+static void
+ident_no_mem(const context_t *context)
+{
+	sprintf(context_top_restrict(context)->message, "Out of memory");
+	exit(1);
+}
+
+/* Ident number i of context */
+static ident_t *
+ident_at(context_t *context, int i)
+{
+	int c;
+
+	if (i < IDENT_SMALL)
+		return context->idents + i;
+
+	/* Chunk c holds IDENT_SMALL << c idents, from number IDENT_SMALL << c */
+	c = 31 - __builtin_clz(i / IDENT_SMALL);
+	return context->id_chunk[c] + i - (IDENT_SMALL << c);
+}
+
+/* Put ident number i into index of context */
+static void
+index_put(context_t *context, int i)
+{
+	int h = ident_at(context, i)->name_id & context->id_mask;
+
+	while (context->id_index[h])
+		h = (h + 1) & context->id_mask;
+	context->id_index[h] = i + 1;
+}
+
+/**
+ * Make room in index for one more ident, building the index once idents
+ * outgrow the inline ones. Old indexes are left to the region.
+*/
+static void
+index_grow(context_t *context)
 {
+	int size = context->id_mask + 1;
+
+	if (context->id_num < IDENT_SMALL ||
+	    (context->id_index && (context->id_num + 1) * 2 <= size))
+		return;
+
+	size = context->id_index ? size * 2 : IDENT_SMALL * 4;
+	context->id_index = region_alloc(context->region, size * sizeof(int));
+	if (!context->id_index)
+		ident_no_mem(context);
+	context->id_mask = size - 1;
+
+	for (int i = 0; i < context->id_num; i++)
+		index_put(context, i);
+}
+
+/* Append ident of name_id to context */
+static ident_t *
+ident_new(context_t *context, int name_id, IDENT type)
+{
+	int i = context->id_num;
 	ident_t *id;
 
+	if (i == INT_MAX)
+		ident_no_mem(context);
+
+	/* Start a new chunk at each power of two, unless kept by a reset */
+	if (i >= IDENT_SMALL && !(i & (i - 1))) {
+		int c = 31 - __builtin_clz(i / IDENT_SMALL);
+
+		if (!context->id_chunk[c])
+			context->id_chunk[c] = region_alloc(
+				context->region, i * sizeof(ident_t));
+		if (!context->id_chunk[c])
+			ident_no_mem(context);
+	}
+	index_grow(context);
+
+	id = ident_at(context, i);
+	id->name_id = name_id;
+	id->type = type;
+	id->value = 0;
+
+	context->id_num++;
+	if (context->id_index)
+		index_put(context, i);
+
+	return id;
+}
+
+void
+ident_reset(context_t *context)
+{
+	/**
+	 * Chunks are kept, so idents declared again in the same order are
+	 * where lookups cached on tokens found them.
+	*/
+	context->id_num = 0;
+	context->id_index = 0;
+	context->id_mask = 0;
+}
+
+ident_t *
+ident_add(context_t *context, const token_t *token, IDENT type)
+{
 	if (token->type != ident) {
 		ident_error(context, "cannot declare ident of \"%s\" type",
 			    sym2human(token->type));
 		return NULL;
 	}
 
-	if (ident_find(context, token->value)) {
+	if (ident_find(context, token->num)) {
 		ident_error(context, "cannot declare ident \"%s\" duplicately",
-			    token->value);
+			    intern_name(token->num));
 		return NULL;
 	}
 
-	if (context->id_num > MAX_IDENT_NUM) {
-		sprintf(context_top_restrict(context)->message, "Out of memory");
-		exit(1);
-	}
+	return ident_new(context, token->num, type);
+}
 
-	id = context->idents + (context->id_num);
+ident_t *
+ident_lookup(context_t *context)
+{
+	lexbuf_t *buf = context->lexbuf;
+	lexcache_t *cache;
+	ident_t *id;
 
-	strcpy(id->name, token->value);
-	id->type = type;
-	id->value = 0;
+	if (!buf->cache)
+		return ident_find(context, token_cur(context)->num);
 
-	context->id_num++;
+	cache = buf->cache + context->token_pos;
+	if (cache->scope == context)
+		return cache->target;
 
+	if ((id = ident_find(context, token_cur(context)->num))) {
+		cache->scope = context;
+		cache->target = id;
+	}
 	return id;
 }
 
+void
+ident_save(context_t *context, FILE *stream)
+{
+	rewind(stream);
+	for (int i = 0; i < context->id_num; i++) {
+		const ident_t *id = ident_at(context, i);
+
+		/* Context of a procedure goes with the line declaring it */
+		fprintf(stream, "%d %zu %s\n", id->type,
+			id->type == procvar ? 0 : id->value,
+			intern_name(id->name_id));
+	}
+	fflush(stream);
+	if (ftruncate(fileno(stream), ftell(stream)))
+		perror("ident save");
+}
+
+void
+ident_load(context_t *context, FILE *stream)
+{
+	int type;
+	size_t value;
+	char *name;
+
+	ident_reset(context);
+	rewind(stream);
+	while (fscanf(stream, "%d %zu %ms", &type, &value, &name) == 3) {
+		int name_id = intern(name, strlen(name));
+
+		free(name);
+		if (name_id < 0)
+			ident_no_mem(context);
+		ident_new(context, name_id, type)->value = value;
+	}
+}
+
 ident_t *
-ident_find(context_t *context, const char *name)
+ident_find(context_t *context, int name_id)
 {
 	for (context_t *c = context; c != NULL; c = c->prev) {
-		ident_t *ptr = c->idents;
-		for (int i = 0; i < c->id_num; i++) {
-			if (!strcmp(ptr->name, name))
-				return ptr;
-			ptr++;
+		if (!c->id_index) {
+			for (int i = 0; i < c->id_num; i++) {
+				if (c->idents[i].name_id == name_id)
+					return c->idents + i;
+			}
+			continue;
+		}
+
+		int mask = c->id_mask;
+		for (int h = name_id & mask, i; (i = c->id_index[h]);
+		     h = (h + 1) & mask) {
+			if (ident_at(c, i - 1)->name_id == name_id)
+				return ident_at(c, i - 1);
 		}
 	}
 
@@ -99,7 +255,7 @@ ident_assign(const context_t *context, ident_t *id, void *value)
 	if (id->value) {
 		if (id->type == constvar) {
 			ident_error(context, "cannot assign value to const %s",
-				    id->name);
+				    intern_name(id->name_id));
 			return -1;
 		}
 	}
@@ -115,38 +271,45 @@ ident_assign(const context_t *context, ident_t *id, void *value)
 void
 ident_dump(context_t *context)
 {
-	const ident_t *ptr = context->idents;
-
 	printf("+---------------+----------+\n"
 	       "|          name |    value |\n"
 	       "+---------------+----------+\n");
-	for (size_t i = 0; i < context->id_num; i++) {
+	for (int i = 0; i < context->id_num; i++) {
+		const ident_t *ptr = ident_at(context, i);
+		const char *name = intern_name(ptr->name_id);
+
 		if (ptr->type == procvar) {
 			if (ptr->value)
-				printf("|%14s |%9s |\n", ptr->name, "(addr)");
+				printf("|%14s |%9s |\n", name, "(addr)");
 			else
-				printf("|%14s |%9p |\n", ptr->name,
+				printf("|%14s |%9p |\n", name,
 				       (void *)ptr->value);
 		} else {
-			printf("|%14s |%9ld |\n", ptr->name, ptr->value);
+			printf("|%14s |%9ld |\n", name, ptr->value);
 		}
-		ptr++;
 	}
 	printf("+---------------+----------+\n");
 }
 
-int
-operation(const context_t *context, int m, SYMBOL opt, int n)
+long
+operation(const context_t *context, long m, SYMBOL opt, long n)
 {
 	switch (opt) {
 	case plus:
-		return m + n;
+		return arith_add(m, n);
 	case minus:
-		return m - n;
+		return arith_sub(m, n);
 	case times:
-		return m * n;
+		return arith_mul(m, n);
 	case slash:
-		return m / n;
+	case percent:
+		/* Operands of statements skipped need not be divisible */
+		if (!arith_divisible(m, n)) {
+			if (context->excute)
+				ident_error(context, "%s", arith_div_error(n));
+			return 0;
+		}
+		return opt == slash ? m / n : m % n;
 	default:
 		ident_error(context, "invalid operation: \"%s\"",
 			    sym2human(opt));
@@ -155,7 +318,7 @@ operation(const context_t *context, int m, SYMBOL opt, int n)
 }
 
 bool
-condition(const context_t *context, int m, SYMBOL opt, int n)
+condition(const context_t *context, long m, SYMBOL opt, long n)
 {
 	switch (opt) {
 	case eql:
@@ -30,7 +30,8 @@ typedef enum {
 } IDENT;
 
 typedef struct {
-	char name[MAX_IDENT_SIZE];
+	/* Intern id of name, given by interpreter of current line */
+	int name_id;
 	size_t value;
 	IDENT type;
 } ident_t;
@@ -0,0 +1,1309 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * SSA form is built straight from the structured tree: an if joins
+ * its body and the block before it, a while joins the block before it
+ * and the end of its body in a header evaluating the condition. Phis
+ * are made only for variables the body writes, so no dominance
+ * frontiers are needed.
+ *
+ * Calls and read give variables they may write unknown values. A
+ * procedure writes what its body and the procedures it calls assign.
+ *
+ * Passes only find values equal to others or constant. Lowering walks
+ * the tree again in the order it was built, tracking which variable
+ * holds which value, and rewrites expressions from that.
+*/
+
+#include "ir.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Lattice of sparse conditional constant propagation */
+enum { lat_top, lat_num, lat_bottom };
+
+/* State of building, passes and lowering, shared by blocks */
+typedef struct {
+	ast_t *ast;
+	context_t *context;
+	opt_stats_t *stats;
+	ir_t *ir;
+
+	/* Current value of each variable used, -1 if not read yet */
+	int *env;
+	/* Variables read or written by the block, if of its stamp */
+	int *used;
+	int stamp;
+	/* Variables each block writes, with the procedures it calls */
+	int *mod_start;
+	int *mods;
+	int mod_num;
+	int mod_cap;
+	/* Scratch stamps of variables and blocks */
+	int *mark;
+	int *seen;
+	int mark_stamp;
+	/* Variables of if and while statements being built */
+	ir_def_t *stack;
+	int stack_num;
+	int stack_cap;
+	/* Basic block being built */
+	int cur;
+	/* Variable first found holding each value, -1 if none */
+	int *holder;
+} ir_state_t;
+
+static void
+ir_oom(ir_state_t *s)
+{
+	sprintf(context_top_restrict(s->context)->message, "Out of memory");
+	exit(1);
+}
+
+static void *
+ir_alloc(ir_state_t *s, size_t num, size_t size)
+{
+	void *p = calloc(num ? num : 1, size);
+
+	if (!p)
+		ir_oom(s);
+	return p;
+}
+
+/* Make room for one more element of an array */
+static void *
+ir_grow(ir_state_t *s, void *array, int num, int *cap, size_t size)
+{
+	if (num < *cap)
+		return array;
+
+	*cap = *cap ? *cap * 2 : 0x100;
+	if (!(array = realloc(array, *cap * size)))
+		ir_oom(s);
+	return array;
+}
+
+/* Value v stands for, after the passes */
+static int
+ir_find(ir_t *ir, int v)
+{
+	int r = v;
+
+	while (ir->values[r].repl != r)
+		r = ir->values[r].repl;
+	while (ir->values[v].repl != r) {
+		int next = ir->values[v].repl;
+
+		ir->values[v].repl = r;
+		v = next;
+	}
+	return r;
+}
+
+/* New value of the current block */
+static int
+ir_value(ir_state_t *s, IR_OP op, int a, int b)
+{
+	ir_t *ir = s->ir;
+	ir_value_t *v;
+
+	ir->values = ir_grow(s, ir->values, ir->value_num, &ir->value_cap,
+			     sizeof(ir_value_t));
+	v = ir->values + ir->value_num;
+	memset(v, 0, sizeof(ir_value_t));
+	v->op = op;
+	v->arg[0] = a;
+	v->arg[1] = b;
+	v->sym = -1;
+	v->block = s->cur;
+	v->repl = ir->value_num;
+	return ir->value_num++;
+}
+
+/* New basic block dominated by idom, -1 for the entry */
+static int
+ir_block(ir_state_t *s, int idom)
+{
+	ir_t *ir = s->ir;
+	ir_block_t *block;
+
+	ir->blocks = ir_grow(s, ir->blocks, ir->block_num, &ir->block_cap,
+			     sizeof(ir_block_t));
+	block = ir->blocks + ir->block_num;
+	memset(block, 0, sizeof(ir_block_t));
+	block->cond = -1;
+	block->idom = idom;
+	block->dom_depth = idom < 0 ? 0 : ir->blocks[idom].dom_depth + 1;
+	return ir->block_num++;
+}
+
+static void
+ir_edge(ir_state_t *s, int from, int to)
+{
+	ir_block_t *blocks = s->ir->blocks;
+
+	blocks[from].succ[blocks[from].nsucc++] = to;
+	blocks[to].pred[blocks[to].npred++] = from;
+}
+
+/* Block a dominates block b */
+static bool
+ir_dominates(const ir_t *ir, int a, int b)
+{
+	while (ir->blocks[b].dom_depth > ir->blocks[a].dom_depth)
+		b = ir->blocks[b].idom;
+	return a == b;
+}
+
+/* Current value of variable sym, its value on entry if not set yet */
+static int
+ir_read(ir_state_t *s, int sym)
+{
+	int cur = s->cur;
+
+	if (s->env[sym] != -1)
+		return s->env[sym];
+
+	s->cur = 0;
+	s->env[sym] = ir_value(s, ir_entry, -1, -1);
+	s->ir->values[s->env[sym]].sym = sym;
+	s->cur = cur;
+	return s->env[sym];
+}
+
+/* Start variables statement n defines */
+static void
+ir_defs_begin(ir_state_t *s, int n)
+{
+	s->ir->node_defs[n] = s->ir->def_num;
+}
+
+static void
+ir_def(ir_state_t *s, int sym, int value)
+{
+	ir_t *ir = s->ir;
+
+	ir->defs = ir_grow(s, ir->defs, ir->def_num, &ir->def_cap,
+			   sizeof(ir_def_t));
+	ir->defs[ir->def_num++] = (ir_def_t){ sym, value };
+	if (sym != -1)
+		s->env[sym] = value;
+}
+
+/* Variable sym gets a value not known */
+static void
+ir_clobber(ir_state_t *s, int sym)
+{
+	int v = ir_value(s, ir_unknown, -1, -1);
+
+	s->ir->values[v].sym = sym;
+	ir_def(s, sym, v);
+}
+
+/* Add variable sym to mods, once for a block */
+static void
+ir_mod(ir_state_t *s, int sym)
+{
+	if (s->mark[sym] == s->mark_stamp)
+		return;
+	s->mark[sym] = s->mark_stamp;
+	s->mods = ir_grow(s, s->mods, s->mod_num, &s->mod_cap, sizeof(int));
+	s->mods[s->mod_num++] = sym;
+}
+
+/* Add variables written by statement n to mods, through calls too */
+static void
+ir_mod_walk(ir_state_t *s, int n)
+{
+	const ast_t *ast = s->ast;
+	const node_t *node = ast->nodes + n;
+	int block;
+
+	switch (node->type) {
+	case ast_assign:
+		ir_mod(s, node->sym);
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_mod(s, ast->nodes[n].sym);
+		break;
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		if (s->seen[block] != s->mark_stamp) {
+			s->seen[block] = s->mark_stamp;
+			ir_mod_walk(s, ast->blocks[block].body);
+		}
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_mod_walk(s, n);
+		break;
+	case ast_if:
+	case ast_while:
+		ir_mod_walk(s, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Variables written by each block, in mods from mod_start[b] */
+static void
+ir_mods(ir_state_t *s)
+{
+	const ast_t *ast = s->ast;
+
+	s->mod_start = ir_alloc(s, ast->block_num + 1, sizeof(int));
+	for (int b = 0; b < ast->block_num; b++) {
+		s->mod_start[b] = s->mod_num;
+		s->mark_stamp++;
+		s->seen[b] = s->mark_stamp;
+		ir_mod_walk(s, ast->blocks[b].body);
+	}
+	s->mod_start[ast->block_num] = s->mod_num;
+}
+
+/* Mark variables used by expression n */
+static void
+ir_use_expression(ir_state_t *s, int n)
+{
+	const node_t *node = s->ast->nodes + n;
+
+	switch (node->type) {
+	case ast_var:
+		s->used[node->sym] = s->stamp;
+		s->env[node->sym] = -1;
+		break;
+	case ast_neg:
+	case ast_odd:
+		ir_use_expression(s, node->kid[0]);
+		break;
+	case ast_binop:
+	case ast_cond:
+		ir_use_expression(s, node->kid[0]);
+		ir_use_expression(s, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Mark variables used by statement n */
+static void
+ir_use_statement(ir_state_t *s, int n)
+{
+	const ast_t *ast = s->ast;
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_assign:
+		s->used[node->sym] = s->stamp;
+		s->env[node->sym] = -1;
+		ir_use_expression(s, node->kid[0]);
+		break;
+	case ast_read:
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_use_expression(s, n);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_use_statement(s, n);
+		break;
+	case ast_if:
+	case ast_while:
+		ir_use_expression(s, node->kid[0]);
+		ir_use_statement(s, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Push variable sym used by the block with its current value, once
+ * for a statement.
+*/
+static void
+ir_write(ir_state_t *s, int sym)
+{
+	if (s->mark[sym] == s->mark_stamp || s->used[sym] != s->stamp)
+		return;
+	s->mark[sym] = s->mark_stamp;
+	s->stack = ir_grow(s, s->stack, s->stack_num, &s->stack_cap,
+			   sizeof(ir_def_t));
+	s->stack[s->stack_num++] = (ir_def_t){ sym, ir_read(s, sym) };
+}
+
+/* Push variables used by the block statement n may write */
+static void
+ir_write_walk(ir_state_t *s, int n)
+{
+	const ast_t *ast = s->ast;
+	const node_t *node = ast->nodes + n;
+	int block;
+
+	switch (node->type) {
+	case ast_assign:
+		ir_write(s, node->sym);
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_write(s, ast->nodes[n].sym);
+		break;
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		for (int i = s->mod_start[block]; i < s->mod_start[block + 1];
+		     i++)
+			ir_write(s, s->mods[i]);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_write_walk(s, n);
+		break;
+	case ast_if:
+	case ast_while:
+		ir_write_walk(s, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+ir_writes(ir_state_t *s, int n)
+{
+	s->mark_stamp++;
+	ir_write_walk(s, n);
+}
+
+static int
+ir_expression(ir_state_t *s, int n)
+{
+	const node_t *node = s->ast->nodes + n;
+	int v, a;
+
+	switch (node->type) {
+	case ast_num:
+		v = ir_value(s, ir_num, -1, -1);
+		s->ir->values[v].num = node->num;
+		break;
+	case ast_var:
+		v = ir_read(s, node->sym);
+		break;
+	case ast_neg:
+	case ast_odd:
+		a = ir_expression(s, node->kid[0]);
+		v = ir_value(s, node->type == ast_neg ? ir_neg : ir_odd, a, -1);
+		break;
+	case ast_binop:
+	case ast_cond:
+	default:
+		a = ir_expression(s, node->kid[0]);
+		v = ir_expression(s, node->kid[1]);
+		v = ir_value(s, node->type == ast_binop ? ir_binop : ir_cond,
+			     a, v);
+		s->ir->values[v].sym_op = node->op;
+		break;
+	}
+	s->ir->node_value[n] = v;
+	return v;
+}
+
+static void ir_statement(ir_state_t *s, int n);
+
+/* If joins the end of its body and the block before it */
+static void
+ir_if(ir_state_t *s, int n)
+{
+	const node_t *node = s->ast->nodes + n;
+	int base = s->stack_num;
+	int cond = s->cur, body, join;
+
+	s->ir->blocks[cond].cond = ir_expression(s, node->kid[0]);
+	ir_writes(s, node->kid[1]);
+
+	body = ir_block(s, cond);
+	ir_edge(s, cond, body);
+	s->cur = body;
+	ir_statement(s, node->kid[1]);
+
+	join = ir_block(s, cond);
+	ir_edge(s, s->cur, join);
+	ir_edge(s, cond, join);
+	s->cur = join;
+
+	ir_defs_begin(s, n);
+	for (int i = base; i < s->stack_num; i++) {
+		int sym = s->stack[i].sym;
+		int phi = ir_value(s, ir_phi, s->env[sym], s->stack[i].value);
+
+		s->ir->values[phi].sym = sym;
+		ir_def(s, sym, phi);
+	}
+	ir_def(s, -1, -1);
+	s->stack_num = base;
+}
+
+/**
+ * Header of while joins the block before it and the end of its body,
+ * the loop is left from the header.
+*/
+static void
+ir_while(ir_state_t *s, int n)
+{
+	const node_t *node = s->ast->nodes + n;
+	int base = s->stack_num;
+	int head, body, exit;
+
+	ir_writes(s, node->kid[1]);
+	head = ir_block(s, s->cur);
+	ir_edge(s, s->cur, head);
+	s->cur = head;
+
+	ir_defs_begin(s, n);
+	for (int i = base; i < s->stack_num; i++) {
+		int sym = s->stack[i].sym;
+		int phi = ir_value(s, ir_phi, s->stack[i].value, -1);
+
+		s->ir->values[phi].sym = sym;
+		s->stack[i].value = phi;
+		ir_def(s, sym, phi);
+	}
+	ir_def(s, -1, -1);
+	s->ir->blocks[head].cond = ir_expression(s, node->kid[0]);
+
+	body = ir_block(s, head);
+	ir_edge(s, head, body);
+	s->cur = body;
+	ir_statement(s, node->kid[1]);
+	ir_edge(s, s->cur, head);
+
+	for (int i = base; i < s->stack_num; i++) {
+		int sym = s->stack[i].sym;
+
+		s->ir->values[s->stack[i].value].arg[1] = s->env[sym];
+		s->env[sym] = s->stack[i].value;
+	}
+
+	exit = ir_block(s, head);
+	ir_edge(s, head, exit);
+	s->cur = exit;
+	s->stack_num = base;
+}
+
+static void
+ir_statement(ir_state_t *s, int n)
+{
+	const ast_t *ast = s->ast;
+	const node_t *node = ast->nodes + n;
+	int v, block;
+
+	s->ir->node_defs[n] = -1;
+	switch (node->type) {
+	case ast_assign:
+		v = ir_expression(s, node->kid[0]);
+		v = ir_value(s, ir_copy, v, -1);
+		s->ir->values[v].sym = node->sym;
+		ir_defs_begin(s, n);
+		ir_def(s, node->sym, v);
+		ir_def(s, -1, -1);
+		break;
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		ir_defs_begin(s, n);
+		for (int i = s->mod_start[block]; i < s->mod_start[block + 1];
+		     i++) {
+			if (s->used[s->mods[i]] == s->stamp)
+				ir_clobber(s, s->mods[i]);
+		}
+		ir_def(s, -1, -1);
+		break;
+	case ast_read:
+		ir_defs_begin(s, n);
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_clobber(s, ast->nodes[n].sym);
+		ir_def(s, -1, -1);
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_expression(s, n);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_statement(s, n);
+		break;
+	case ast_if:
+		ir_if(s, n);
+		break;
+	case ast_while:
+		ir_while(s, n);
+		break;
+	default:
+		break;
+	}
+}
+
+/* SSA form of block b of the program */
+static void
+ir_build(ir_state_t *s, int b)
+{
+	ir_t *ir = s->ir;
+
+	ir->ast_block = b;
+	ir->value_num = ir->block_num = ir->def_num = 0;
+	s->stamp++;
+	ir_use_statement(s, s->ast->blocks[b].body);
+	s->cur = ir_block(s, -1);
+	ir_statement(s, s->ast->blocks[b].body);
+
+	free(ir->lattice);
+	free(ir->consts);
+	ir->lattice = ir_alloc(s, ir->value_num, sizeof(int));
+	ir->consts = ir_alloc(s, ir->value_num, sizeof(long));
+	for (int v = 0; v < ir->value_num; v++)
+		ir->lattice[v] = lat_bottom;
+}
+
+/**
+ * Copy propagation: a copy is its operand, and a phi whose operands
+ * are one value besides itself is that value.
+*/
+static void
+ir_copy_prop(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+	bool changed;
+
+	do {
+		changed = false;
+		for (int v = 0; v < ir->value_num; v++) {
+			ir_value_t *value = ir->values + v;
+			int a, b;
+
+			if (value->repl != v ||
+			    (value->op != ir_copy && value->op != ir_phi))
+				continue;
+			a = ir_find(ir, value->arg[0]);
+			b = value->op == ir_phi ? ir_find(ir, value->arg[1]) : a;
+			if (a == v)
+				a = b;
+			if (b == v)
+				b = a;
+			if (a != b || a == v)
+				continue;
+			value->repl = a;
+			s->stats->copies++;
+			changed = true;
+		}
+	} while (changed);
+}
+
+/* Operands of value v, the lesser first if their order does not matter */
+static void
+ir_operands(ir_t *ir, int v, int *a, int *b)
+{
+	const ir_value_t *value = ir->values + v;
+
+	*a = value->arg[0] < 0 ? -1 : ir_find(ir, value->arg[0]);
+	*b = value->arg[1] < 0 ? -1 : ir_find(ir, value->arg[1]);
+	if ((value->op == ir_binop || value->op == ir_cond) &&
+	    (value->sym_op == plus || value->sym_op == times ||
+	     value->sym_op == eql || value->sym_op == neq) &&
+	    *a > *b) {
+		int t = *a;
+
+		*a = *b;
+		*b = t;
+	}
+}
+
+static unsigned long
+ir_hash(ir_t *ir, int v)
+{
+	const ir_value_t *value = ir->values + v;
+	unsigned long h = value->op * 31 + value->sym_op;
+	int a, b;
+
+	ir_operands(ir, v, &a, &b);
+	h = h * 0x9e3779b97f4a7c15ul + (unsigned long)a;
+	h = h * 0x9e3779b97f4a7c15ul + (unsigned long)b;
+	h = h * 0x9e3779b97f4a7c15ul + (unsigned long)value->num;
+	if (value->op == ir_phi)
+		h = h * 0x9e3779b97f4a7c15ul + (unsigned long)value->block;
+	return h ^ h >> 29;
+}
+
+/* Values v and w compute the same, phis only in the same block */
+static bool
+ir_same(ir_t *ir, int v, int w)
+{
+	const ir_value_t *x = ir->values + v, *y = ir->values + w;
+	int xa, xb, ya, yb;
+
+	if (x->op != y->op || x->sym_op != y->sym_op || x->num != y->num ||
+	    (x->op == ir_phi && x->block != y->block))
+		return false;
+	ir_operands(ir, v, &xa, &xb);
+	ir_operands(ir, w, &ya, &yb);
+	return xa == ya && xb == yb;
+}
+
+/**
+ * Global value numbering: a value computing the same as one of a
+ * dominating block is that value. Values are numbered in order, and
+ * operands other than phis of loops come first.
+*/
+static void
+ir_gvn(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+	size_t mask = 0xff;
+	int *heads, *next;
+
+	while (mask < (size_t)ir->value_num)
+		mask = mask << 1 | 1;
+	heads = ir_alloc(s, mask + 1, sizeof(int));
+	next = ir_alloc(s, ir->value_num, sizeof(int));
+	memset(heads, -1, (mask + 1) * sizeof(int));
+
+	for (int v = 0; v < ir->value_num; v++) {
+		const ir_value_t *value = ir->values + v;
+		size_t h;
+		int w;
+
+		if (value->repl != v || value->op == ir_entry ||
+		    value->op == ir_unknown)
+			continue;
+		h = ir_hash(ir, v) & mask;
+		for (w = heads[h]; w != -1; w = next[w]) {
+			if (ir_same(ir, v, w) &&
+			    ir_dominates(ir, ir->values[w].block, value->block))
+				break;
+		}
+		if (w != -1) {
+			ir->values[v].repl = w;
+			s->stats->numbered++;
+			continue;
+		}
+		next[v] = heads[h];
+		heads[h] = v;
+	}
+
+	free(heads);
+	free(next);
+}
+
+/* Lists by index: those of i are list[start[i]] up to list[start[i + 1]] */
+typedef struct {
+	int *start;
+	int *list;
+} ir_csr_t;
+
+/* Values by block */
+static ir_csr_t
+ir_block_values(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+	ir_csr_t csr = {
+		.start = ir_alloc(s, ir->block_num + 1, sizeof(int)),
+		.list = ir_alloc(s, ir->value_num, sizeof(int)),
+	};
+
+	for (int v = 0; v < ir->value_num; v++)
+		csr.start[ir->values[v].block + 1]++;
+	for (int b = 0; b < ir->block_num; b++)
+		csr.start[b + 1] += csr.start[b];
+	/* Values in order, at counts those placed */
+	int *at = ir_alloc(s, ir->block_num, sizeof(int));
+	for (int v = 0; v < ir->value_num; v++) {
+		int b = ir->values[v].block;
+
+		csr.list[csr.start[b] + at[b]++] = v;
+	}
+	free(at);
+	return csr;
+}
+
+/**
+ * Users of each value left by the passes, a block b branching on it
+ * is the user -b - 1.
+*/
+static ir_csr_t
+ir_users(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+	int num = ir->value_num;
+	ir_csr_t csr = { .start = ir_alloc(s, num + 1, sizeof(int)) };
+	int *at = ir_alloc(s, num, sizeof(int));
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (int v = 0; v < num; v++) {
+			const ir_value_t *value = ir->values + v;
+
+			if (value->repl != v)
+				continue;
+			for (int i = 0; i < 2; i++) {
+				int a = value->arg[i];
+
+				if (a < 0 || value->op == ir_num)
+					continue;
+				a = ir_find(ir, a);
+				if (pass)
+					csr.list[csr.start[a] + at[a]++] = v;
+				else
+					csr.start[a + 1]++;
+			}
+		}
+		for (int b = 0; b < ir->block_num; b++) {
+			int c = ir->blocks[b].cond;
+
+			if (c < 0)
+				continue;
+			c = ir_find(ir, c);
+			if (pass)
+				csr.list[csr.start[c] + at[c]++] = -b - 1;
+			else
+				csr.start[c + 1]++;
+		}
+		if (pass)
+			break;
+		for (int v = 0; v < num; v++)
+			csr.start[v + 1] += csr.start[v];
+		csr.list = ir_alloc(s, csr.start[num], sizeof(int));
+	}
+
+	free(at);
+	return csr;
+}
+
+/* State of sparse conditional constant propagation */
+typedef struct {
+	ir_state_t *s;
+	ir_csr_t values;
+	ir_csr_t users;
+	bool *reached;
+	/* Edges from each predecessor taken, by block */
+	bool (*taken)[2];
+	/* Values whose lattice went down, and edges to follow */
+	int *work;
+	int work_num;
+	int work_cap;
+	int *edges;
+	int edge_num;
+	int edge_cap;
+} sccp_t;
+
+/* Meet of lattice of value w into kind and num */
+static void
+sccp_meet(const ir_t *ir, int w, int *kind, long *num)
+{
+	int k = ir->lattice[w];
+
+	if (k == lat_top || *kind == lat_bottom)
+		return;
+	if (k == lat_bottom || (*kind == lat_num && ir->consts[w] != *num)) {
+		*kind = lat_bottom;
+		return;
+	}
+	*kind = lat_num;
+	*num = ir->consts[w];
+}
+
+/* Lattice of value v from its operands */
+static void
+sccp_eval(sccp_t *c, int v)
+{
+	ir_t *ir = c->s->ir;
+	const ir_value_t *value = ir->values + v;
+	const ir_block_t *block = ir->blocks + value->block;
+	int kind = lat_top, a, b;
+	long num = 0, m, n;
+
+	if (!c->reached[value->block] || value->repl != v)
+		return;
+
+	switch (value->op) {
+	case ir_num:
+		kind = lat_num;
+		num = value->num;
+		break;
+	case ir_entry:
+	case ir_unknown:
+		kind = lat_bottom;
+		break;
+	case ir_phi:
+		for (int i = 0; i < block->npred; i++) {
+			if (c->taken[value->block][i])
+				sccp_meet(ir, ir_find(ir, value->arg[i]), &kind,
+					  &num);
+		}
+		break;
+	default:
+		a = ir_find(ir, value->arg[0]);
+		b = value->arg[1] < 0 ? a : ir_find(ir, value->arg[1]);
+		if (ir->lattice[a] == lat_top || ir->lattice[b] == lat_top)
+			break;
+		if (ir->lattice[a] == lat_bottom ||
+		    ir->lattice[b] == lat_bottom) {
+			kind = lat_bottom;
+			break;
+		}
+		m = ir->consts[a];
+		n = ir->consts[b];
+		kind = lat_num;
+		if (value->op == ir_copy)
+			num = m;
+		else if (value->op == ir_neg)
+			num = opt_operation(minus, 0, m);
+		else if (value->op == ir_odd)
+			num = m % 2 != 0;
+		else if ((value->sym_op == slash || value->sym_op == percent) &&
+			 !opt_divisible(m, n))
+			kind = lat_bottom; // left to fail at runtime
+		else
+			num = opt_operation(value->sym_op, m, n);
+		break;
+	}
+
+	if (kind == ir->lattice[v] && (kind != lat_num || num == ir->consts[v]))
+		return;
+	ir->lattice[v] = kind;
+	ir->consts[v] = num;
+	c->work = ir_grow(c->s, c->work, c->work_num, &c->work_cap,
+			  sizeof(int));
+	c->work[c->work_num++] = v;
+}
+
+/* Take the edge from block b to its successor i */
+static void
+sccp_edge(sccp_t *c, int b, int i)
+{
+	c->edges = ir_grow(c->s, c->edges, c->edge_num, &c->edge_cap,
+			   sizeof(int));
+	c->edges[c->edge_num++] = b * 2 + i;
+}
+
+/* Edges block b leaves by, from what its condition may be */
+static void
+sccp_branch(sccp_t *c, int b)
+{
+	ir_t *ir = c->s->ir;
+	const ir_block_t *block = ir->blocks + b;
+	int cond;
+
+	if (!c->reached[b])
+		return;
+	if (block->nsucc == 1) {
+		sccp_edge(c, b, 0);
+		return;
+	}
+	if (block->nsucc != 2)
+		return;
+
+	cond = ir_find(ir, block->cond);
+	if (ir->lattice[cond] == lat_bottom) {
+		sccp_edge(c, b, 0);
+		sccp_edge(c, b, 1);
+	} else if (ir->lattice[cond] == lat_num) {
+		sccp_edge(c, b, !ir->consts[cond]);
+	}
+}
+
+/* Follow an edge, reaching its block or a new predecessor of it */
+static void
+sccp_follow(sccp_t *c, int edge)
+{
+	ir_t *ir = c->s->ir;
+	int from = edge / 2;
+	int to = ir->blocks[from].succ[edge % 2];
+	int i = ir->blocks[to].pred[0] == from ? 0 : 1;
+	bool first = !c->reached[to];
+
+	if (c->taken[to][i])
+		return;
+	c->taken[to][i] = true;
+	c->reached[to] = true;
+
+	for (int k = c->values.start[to]; k < c->values.start[to + 1]; k++) {
+		int v = c->values.list[k];
+
+		if (first || ir->values[v].op == ir_phi)
+			sccp_eval(c, v);
+	}
+	if (first)
+		sccp_branch(c, to);
+}
+
+/**
+ * Sparse conditional constant propagation: values start unknown and
+ * only go down the lattice, blocks count only once reached by edges
+ * their predecessors may take.
+*/
+static void
+ir_sccp(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+	sccp_t c = {
+		.s = s,
+		.values = ir_block_values(s),
+		.users = ir_users(s),
+		.reached = ir_alloc(s, ir->block_num, sizeof(bool)),
+		.taken = ir_alloc(s, ir->block_num, sizeof(bool[2])),
+	};
+
+	for (int v = 0; v < ir->value_num; v++)
+		ir->lattice[v] = lat_top;
+
+	c.reached[0] = true;
+	for (int k = c.values.start[0]; k < c.values.start[1]; k++)
+		sccp_eval(&c, c.values.list[k]);
+	sccp_branch(&c, 0);
+
+	while (c.work_num || c.edge_num) {
+		if (c.edge_num) {
+			sccp_follow(&c, c.edges[--c.edge_num]);
+			continue;
+		}
+
+		int v = c.work[--c.work_num];
+		for (int k = c.users.start[v]; k < c.users.start[v + 1]; k++) {
+			int u = c.users.list[k];
+
+			if (u < 0)
+				sccp_branch(&c, -u - 1);
+			else
+				sccp_eval(&c, u);
+		}
+	}
+
+	free(c.values.start);
+	free(c.values.list);
+	free(c.users.start);
+	free(c.users.list);
+	free(c.reached);
+	free(c.taken);
+	free(c.work);
+	free(c.edges);
+}
+
+/* Passes in order, with the -O level running them */
+static const struct {
+	int level;
+	void (*run)(ir_state_t *s);
+} ir_passes[] = {
+	{ 1, ir_copy_prop },
+	{ 2, ir_gvn },
+	{ 1, ir_sccp },
+};
+
+/* Variables statement n defines hold their values from now on */
+static void
+ir_apply(ir_state_t *s, int n)
+{
+	ir_t *ir = s->ir;
+
+	if (ir->node_defs[n] < 0)
+		return;
+	for (ir_def_t *def = ir->defs + ir->node_defs[n]; def->sym != -1;
+	     def++) {
+		int v = ir_find(ir, def->value), h = s->holder[v];
+
+		s->env[def->sym] = v;
+		if (h == -1 || s->env[h] != v)
+			s->holder[v] = def->sym;
+	}
+}
+
+/* Turn node n into a read of variable sym */
+static void
+ir_use(ir_state_t *s, int n, int sym)
+{
+	const ast_t *ast = s->ast;
+	node_t *node = ast->nodes + n;
+
+	node->type = ast_var;
+	node->sym = sym;
+	node->depth = ast->blocks[ast->syms[sym].block].depth;
+	node->slot = ast->syms[sym].slot;
+	node->kid[0] = node->kid[1] = 0;
+}
+
+static void
+ir_lower_expression(ir_state_t *s, int n)
+{
+	ir_t *ir = s->ir;
+	node_t *node = s->ast->nodes + n;
+	int v = ir_find(ir, ir->node_value[n]), h = s->holder[v];
+
+	if (node->type == ast_num)
+		return;
+
+	/* Operands of a constant were all constant, nothing may fail */
+	if (ir->lattice[v] == lat_num) {
+		node->type = ast_num;
+		node->num = ir->consts[v];
+		node->kid[0] = node->kid[1] = 0;
+		s->stats->constants++;
+		return;
+	}
+
+	/**
+	 * A variable holding the value got it from an evaluation of it
+	 * that did not fail.
+	*/
+	if (h != -1 && s->env[h] == v &&
+	    (node->type == ast_var ? node->sym != h :
+				     node->type != ast_cond &&
+					     node->type != ast_odd)) {
+		ir_use(s, n, h);
+		s->stats->reused++;
+		return;
+	}
+
+	if (node->type != ast_var) {
+		ir_lower_expression(s, node->kid[0]);
+		if (node->type == ast_binop || node->type == ast_cond)
+			ir_lower_expression(s, node->kid[1]);
+	}
+}
+
+/* Walk statement n as it was built, rewriting its expressions */
+static void
+ir_lower_statement(ir_state_t *s, int n)
+{
+	const ast_t *ast = s->ast;
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_assign:
+		ir_lower_expression(s, node->kid[0]);
+		ir_apply(s, n);
+		break;
+	case ast_call:
+	case ast_read:
+		ir_apply(s, n);
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_lower_expression(s, n);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			ir_lower_statement(s, n);
+		break;
+	case ast_if:
+		ir_lower_expression(s, node->kid[0]);
+		ir_lower_statement(s, node->kid[1]);
+		ir_apply(s, n);
+		break;
+	case ast_while:
+		/* Header phis, holding again once the loop is left */
+		ir_apply(s, n);
+		ir_lower_expression(s, node->kid[0]);
+		ir_lower_statement(s, node->kid[1]);
+		ir_apply(s, n);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Rewrite block b of the program from its SSA form */
+static void
+ir_lower(ir_state_t *s, int b)
+{
+	ir_t *ir = s->ir;
+
+	s->holder = ir_alloc(s, ir->value_num, sizeof(int));
+	memset(s->holder, -1, ir->value_num * sizeof(int));
+
+	/* Variables hold their values on entry */
+	for (int v = 0; v < ir->value_num; v++) {
+		const ir_value_t *value = ir->values + v;
+
+		if (value->op == ir_entry) {
+			s->env[value->sym] = v;
+			s->holder[v] = value->sym;
+		}
+	}
+	ir_lower_statement(s, s->ast->blocks[b].body);
+
+	free(s->holder);
+	s->holder = 0;
+}
+
+static void
+ir_state_init(ir_state_t *s, ir_t *ir, ast_t *ast, context_t *context,
+	      opt_stats_t *stats)
+{
+	memset(ir, 0, sizeof(ir_t));
+	ir->ast = ast;
+	ir->node_value = calloc(ast->node_num, sizeof(int));
+	ir->node_defs = calloc(ast->node_num, sizeof(int));
+
+	*s = (ir_state_t){ .ast = ast, .context = context, .stats = stats,
+			   .ir = ir };
+	if (!ir->node_value || !ir->node_defs)
+		ir_oom(s);
+	s->env = ir_alloc(s, ast->sym_num, sizeof(int));
+	s->used = ir_alloc(s, ast->sym_num, sizeof(int));
+	s->mark = ir_alloc(s, ast->sym_num, sizeof(int));
+	s->seen = ir_alloc(s, ast->block_num, sizeof(int));
+	ir_mods(s);
+}
+
+static void
+ir_state_free(ir_state_t *s)
+{
+	ir_t *ir = s->ir;
+
+	free(ir->values);
+	free(ir->blocks);
+	free(ir->node_value);
+	free(ir->node_defs);
+	free(ir->defs);
+	free(ir->lattice);
+	free(ir->consts);
+	free(s->env);
+	free(s->used);
+	free(s->mark);
+	free(s->seen);
+	free(s->mod_start);
+	free(s->mods);
+	free(s->stack);
+}
+
+/* Build block b and run the passes of level on it */
+static void
+ir_run(ir_state_t *s, int b, int level)
+{
+	ir_build(s, b);
+	for (size_t i = 0; i < sizeof(ir_passes) / sizeof(*ir_passes); i++) {
+		if (ir_passes[i].level <= level)
+			ir_passes[i].run(s);
+	}
+}
+
+void
+ir_optimize(ast_t *ast, context_t *context, int level, opt_stats_t *stats)
+{
+	ir_state_t s;
+	ir_t ir;
+
+	ir_state_init(&s, &ir, ast, context, stats);
+	for (int b = 0; b < ast->block_num; b++) {
+		ir_run(&s, b, level);
+		ir_lower(&s, b);
+	}
+	ir_state_free(&s);
+}
+
+static void
+ir_dump_value(const ir_t *ir, int v, FILE *stream)
+{
+	const ir_value_t *value = ir->values + v;
+	const ast_t *ast = ir->ast;
+
+	fprintf(stream, "\tv%d = ", v);
+	switch (value->op) {
+	case ir_num:
+		fprintf(stream, "%ld", value->num);
+		break;
+	case ir_entry:
+		fprintf(stream, "entry");
+		break;
+	case ir_unknown:
+		fprintf(stream, "unknown");
+		break;
+	case ir_copy:
+		fprintf(stream, "v%d", value->arg[0]);
+		break;
+	case ir_phi:
+		fprintf(stream, "phi v%d, v%d", value->arg[0], value->arg[1]);
+		break;
+	case ir_neg:
+		fprintf(stream, "- v%d", value->arg[0]);
+		break;
+	case ir_odd:
+		fprintf(stream, "odd v%d", value->arg[0]);
+		break;
+	default:
+		fprintf(stream, "v%d %s v%d", value->arg[0],
+			sym2human(value->sym_op), value->arg[1]);
+		break;
+	}
+	if (value->sym != -1)
+		fprintf(stream, "\t; %s",
+			intern_name(ast->syms[value->sym].name_id));
+	if (ir->lattice[v] == lat_num)
+		fprintf(stream, "\t; = %ld", ir->consts[v]);
+	fprintf(stream, "\n");
+}
+
+void
+ir_dump(ast_t *ast, context_t *context, int level, FILE *stream)
+{
+	opt_stats_t stats = { 0 };
+	ir_state_t s;
+	ir_t ir;
+
+	ir_state_init(&s, &ir, ast, context, &stats);
+	for (int b = 0; b < ast->block_num; b++) {
+		const ast_block_t *block = ast->blocks + b;
+
+		ir_run(&s, b, level);
+		/* Operands are printed as the values they stand for */
+		for (int v = 0; v < ir.value_num; v++) {
+			for (int i = 0; i < 2; i++) {
+				if (ir.values[v].arg[i] >= 0 &&
+				    ir.values[v].op != ir_num)
+					ir.values[v].arg[i] = ir_find(
+						&ir, ir.values[v].arg[i]);
+			}
+		}
+
+		fprintf(stream, "%s:\n",
+			block->sym < 0 ?
+				"main" :
+				intern_name(ast->syms[block->sym].name_id));
+		for (int k = 0; k < ir.block_num; k++) {
+			const ir_block_t *bb = ir.blocks + k;
+
+			fprintf(stream, "b%d:", k);
+			for (int i = 0; i < bb->npred; i++)
+				fprintf(stream, " <- b%d", bb->pred[i]);
+			fprintf(stream, "\n");
+			for (int v = 0; v < ir.value_num; v++) {
+				if (ir.values[v].block == k &&
+				    ir_find(&ir, v) == v)
+					ir_dump_value(&ir, v, stream);
+			}
+			if (bb->nsucc == 2)
+				fprintf(stream, "\tbranch v%d, b%d, b%d\n",
+					ir_find(&ir, bb->cond), bb->succ[0],
+					bb->succ[1]);
+			else if (bb->nsucc == 1)
+				fprintf(stream, "\tjump b%d\n", bb->succ[0]);
+		}
+		fprintf(stream, "\n");
+	}
+	ir_state_free(&s);
+}
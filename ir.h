@@ -0,0 +1,117 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IR_H
+#define IR_H
+
+#include "ast.h"
+#include "opt.h"
+
+/* Kinds of SSA values */
+typedef enum {
+	ir_num, // 123
+	ir_entry, // variable on entry of the block
+	ir_unknown, // variable after read or call
+	ir_copy, // a := b
+	ir_phi, // value of one of two predecessors
+	ir_neg, // - a
+	ir_binop, // a + b
+	ir_odd, // odd a
+	ir_cond // a < b
+} IR_OP;
+
+/* SSA value, defined once by the basic block holding it */
+typedef struct {
+	IR_OP op;
+	/* Operator of binop and cond */
+	SYMBOL sym_op;
+	/* Operands, of phi by predecessor */
+	int arg[2];
+	/* Value of num */
+	long num;
+	/* Variable of entry, copy and phi */
+	int sym;
+	int block;
+	/* Value it was found equal to, itself if none */
+	int repl;
+} ir_value_t;
+
+/**
+ * Basic block. Joins of if and while have exactly two predecessors,
+ * a branch goes to succ[0] if its condition holds, else to succ[1].
+*/
+typedef struct {
+	int pred[2];
+	int npred;
+	int succ[2];
+	int nsucc;
+	/* Value branched on, -1 for none */
+	int cond;
+	/* Immediate dominator and its depth in the dominator tree */
+	int idom;
+	int dom_depth;
+} ir_block_t;
+
+/* (sym, value) a statement leaves in a variable */
+typedef struct {
+	int sym;
+	int value;
+} ir_def_t;
+
+/* SSA form of one block of the program, a procedure or main */
+typedef struct {
+	const ast_t *ast;
+	int ast_block;
+
+	ir_value_t *values;
+	int value_num;
+	int value_cap;
+
+	ir_block_t *blocks;
+	int block_num;
+	int block_cap;
+
+	/* Value of each expression node, -1 for none */
+	int *node_value;
+	/**
+	 * Variables each statement node defines, at node_defs[n] in defs,
+	 * ended by a sym of -1. Loops define their phis on entry.
+	*/
+	int *node_defs;
+	ir_def_t *defs;
+	int def_num;
+	int def_cap;
+
+	/* Lattice of each value, and its constant if it has one */
+	int *lattice;
+	long *consts;
+} ir_t;
+
+/**
+ * Build SSA form of each block of a parsed program, run the passes of
+ * optimization level, and write what they found back into the tree:
+ * expressions of a constant become numbers, and those of a value some
+ * variable already holds read that variable.
+*/
+void ir_optimize(ast_t *ast, context_t *context, int level,
+		 opt_stats_t *stats);
+
+/* Print SSA form of each block after the passes of level */
+void ir_dump(ast_t *ast, context_t *context, int level, FILE *stream);
+
+#endif /* IR_H */
@@ -0,0 +1,771 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jit.h"
+#include "arith.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#if JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#define JIT_PREALLOC_SIZE 0x1000
+/**
+ * Bytes of C stack native calls may nest on at most, calls going
+ * deeper end the program before the stack overflows
+*/
+#define JIT_STACK_SIZE 0x400000
+
+/**
+ * Each block becomes a function taking the frame of its enclosing
+ * block as static link in rdi. Frame layout below rbp:
+ * 	[rbp - 8]		static link
+ * 	[rbp - 16 - 8 * slot]	variables
+ * Expressions are evaluated into rax, with rcx as second operand
+ * and rsi for following static links.
+*/
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+/* Condition codes of jcc and setcc */
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd,
+       CC_LE = 0xe, CC_G = 0xf };
+
+/* State of the native code generator */
+typedef struct {
+	jit_t *jit;
+	const ast_t *ast;
+	context_t *context;
+	/* Block being compiled */
+	int block;
+	/* Entry of each block called through, null to call blocks directly */
+	jit_entry_t *entries;
+
+	unsigned char *buf;
+	size_t len;
+	size_t cap;
+
+	/* Calls waiting for entry of their block */
+	struct {
+		size_t at;
+		int block;
+	} * fix;
+	int fix_num;
+	int fix_cap;
+} jit_compiler_t;
+
+/* Operand usable without evaluation */
+typedef struct {
+	enum { opnd_none, opnd_imm, opnd_mem } kind;
+	long imm;
+	/* Levels to follow static links, and offset in frame */
+	int level;
+	int disp;
+} operand_t;
+
+/* Runtime of native code */
+static context_t *jit_context;
+static const ast_t *jit_ast;
+/* Lowest rsp a call may be made from, none while null */
+static const char *jit_stack_limit;
+
+static void
+jit_no_mem(const context_t *context)
+{
+	sprintf(context_top_restrict(context)->message, "Out of memory");
+	exit(1);
+}
+
+void
+jit_init(jit_t *jit)
+{
+	memset(jit, 0, sizeof(jit_t));
+}
+
+void
+jit_free(jit_t *jit)
+{
+#if JIT_SUPPORTED
+	if (jit->code)
+		munmap(jit->code, jit->size);
+	for (int i = 0; i < jit->unit_num; i++)
+		munmap(jit->units[i].code, jit->units[i].size);
+#endif
+	free(jit->addr);
+	free(jit->units);
+	jit_init(jit);
+}
+
+static void
+jit_write(long value)
+{
+	fprintf(jit_context->outstream, "%ld\n", value);
+}
+
+static void
+jit_read(long *var)
+{
+	long tmp;
+	if (scanf("%ld", &tmp) == 1)
+		*var = tmp;
+}
+
+static void
+jit_div_error(int n, long divisor)
+{
+	const node_t *node = jit_ast->nodes + n;
+
+	snprintf(context_top_restrict(jit_context)->message,
+		 MAX_CONTEXT_MSG_SIZE, "runtime:%d:%d: %s", node->pos.row,
+		 node->pos.col, arith_div_error(divisor));
+	exit(1);
+}
+
+static void
+jit_call_error(int n)
+{
+	const node_t *node = jit_ast->nodes + n;
+
+	snprintf(context_top_restrict(jit_context)->message,
+		 MAX_CONTEXT_MSG_SIZE, "runtime:%d:%d: too many nested calls",
+		 node->pos.row, node->pos.col);
+	exit(1);
+}
+
+const char *
+jit_stack(const void *base)
+{
+	size_t size = JIT_STACK_SIZE;
+	struct rlimit limit;
+
+	/* Calls nest on at most half of a smaller stack */
+	if (!getrlimit(RLIMIT_STACK, &limit) &&
+	    limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur / 2 < size)
+		size = limit.rlim_cur / 2;
+	jit_stack_limit = (const char *)base - size;
+	return jit_stack_limit;
+}
+
+static void
+byte(jit_compiler_t *c, unsigned char b)
+{
+	if (c->len == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : JIT_PREALLOC_SIZE;
+		if (!(c->buf = realloc(c->buf, c->cap)))
+			jit_no_mem(c->context);
+	}
+	c->buf[c->len++] = b;
+}
+
+static void
+dword(jit_compiler_t *c, int32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		byte(c, (uint32_t)v >> (8 * i));
+}
+
+static void
+qword(jit_compiler_t *c, int64_t v)
+{
+	for (int i = 0; i < 8; i++)
+		byte(c, (uint64_t)v >> (8 * i));
+}
+
+static void
+opcode(jit_compiler_t *c, int op)
+{
+	byte(c, 0x48); // REX.W
+	if (op > 0xff)
+		byte(c, op >> 8);
+	byte(c, op);
+}
+
+/* op reg, [base + disp32] */
+static void
+op_mem(jit_compiler_t *c, int op, int reg, int base, int disp)
+{
+	opcode(c, op);
+	byte(c, 0x80 | reg << 3 | base);
+	dword(c, disp);
+}
+
+/* op rm, reg or op reg, rm, depending on direction of op */
+static void
+op_reg(jit_compiler_t *c, int op, int reg, int rm)
+{
+	opcode(c, op);
+	byte(c, 0xc0 | reg << 3 | rm);
+}
+
+/* mov reg, imm */
+static void
+mov_imm(jit_compiler_t *c, int reg, long imm)
+{
+	if (imm == (int32_t)imm) {
+		op_reg(c, 0xc7, 0, reg);
+		dword(c, imm);
+	} else {
+		byte(c, 0x48);
+		byte(c, 0xb8 + reg);
+		qword(c, imm);
+	}
+}
+
+/* Call a C function of runtime, stack is aligned by caller */
+static void
+call_abs(jit_compiler_t *c, void *func)
+{
+	byte(c, 0x48); // mov rax, imm64
+	byte(c, 0xb8);
+	qword(c, (long)func);
+	byte(c, 0xff); // call rax
+	byte(c, 0xd0);
+}
+
+/* Emit a jump with 32-bit displacement, return place to patch */
+static size_t
+jump(jit_compiler_t *c, int cc)
+{
+	if (cc < 0) {
+		byte(c, 0xe9); // jmp
+	} else {
+		byte(c, 0x0f); // jcc
+		byte(c, 0x80 | cc);
+	}
+	dword(c, 0);
+	return c->len - 4;
+}
+
+/* Point displacement at "at" to target */
+static void
+patch(jit_compiler_t *c, size_t at, size_t target)
+{
+	int32_t rel = target - (at + 4);
+	memcpy(c->buf + at, &rel, 4);
+}
+
+/**
+ * Follow static links to frame "level" blocks out into reg,
+ * return register holding the frame.
+*/
+static int
+jit_frame(jit_compiler_t *c, int level, int reg)
+{
+	if (!level)
+		return RBP;
+
+	op_mem(c, 0x8b, reg, RBP, -8);
+	while (--level)
+		op_mem(c, 0x8b, reg, reg, -8);
+	return reg;
+}
+
+static int
+jit_disp(int slot)
+{
+	return -16 - 8 * slot;
+}
+
+/* Level difference between current block and a block of depth */
+static int
+jit_level(const jit_compiler_t *c, int depth)
+{
+	return c->ast->blocks[c->block].depth - depth;
+}
+
+/* Classify node as immediate or memory operand */
+static operand_t
+jit_operand(const jit_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+	operand_t o = { .kind = opnd_none };
+
+	if (node->type == ast_num) {
+		o.kind = opnd_imm;
+		o.imm = node->num;
+	} else if (node->type == ast_var) {
+		o.kind = opnd_mem;
+		o.level = jit_level(c, node->depth);
+		o.disp = jit_disp(node->slot);
+	}
+
+	return o;
+}
+
+/* mov reg, operand */
+static void
+jit_load(jit_compiler_t *c, const operand_t *o, int reg)
+{
+	if (o->kind == opnd_imm)
+		mov_imm(c, reg, o->imm);
+	else
+		op_mem(c, 0x8b, reg, jit_frame(c, o->level, RSI), o->disp);
+}
+
+/**
+ * rax := rax / rcx or rax % rcx, leave to runtime if rcx is zero,
+ * or -1 while rax is LONG_MIN
+*/
+static void
+jit_div(jit_compiler_t *c, int n, bool checked)
+{
+	size_t zero, ok, min;
+
+	if (checked) {
+		op_reg(c, 0x85, RCX, RCX); // test rcx, rcx
+		zero = jump(c, CC_E);
+		op_reg(c, 0x83, 7, RCX); // cmp rcx, -1
+		byte(c, 0xff);
+		ok = jump(c, CC_NE);
+		mov_imm(c, RDX, LONG_MIN);
+		op_reg(c, 0x39, RDX, RAX); // cmp rax, rdx
+		min = jump(c, CC_NE);
+		patch(c, zero, c->len);
+		op_reg(c, 0x89, RCX, RSI); // mov rsi, rcx
+		byte(c, 0xbf); // mov edi, n
+		dword(c, n);
+		op_reg(c, 0x83, 4, RSP); // and rsp, -16
+		byte(c, 0xf0);
+		call_abs(c, jit_div_error);
+		patch(c, ok, c->len);
+		patch(c, min, c->len);
+	}
+	byte(c, 0x48); // cqo
+	byte(c, 0x99);
+	op_reg(c, 0xf7, 7, RCX); // idiv rcx
+	if (c->ast->nodes[n].op == percent)
+		op_reg(c, 0x89, RDX, RAX); // mov rax, rdx
+}
+
+static void jit_expression(jit_compiler_t *c, int n);
+
+/**
+ * Evaluate binop or cond node, leave result of arithmetic in rax
+ * or result of comparison in flags.
+*/
+static void
+jit_binary(jit_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+	operand_t o = jit_operand(c, node->kid[1]);
+	bool div = node->op == slash || node->op == percent;
+	/* Opcodes of op rax, imm32 / op rax, [mem] / op rax, rcx */
+	int imm, mem, reg;
+
+	switch (node->op) {
+	case plus:
+		imm = 0x05, mem = 0x03, reg = 0x01;
+		break;
+	case minus:
+		imm = 0x2d, mem = 0x2b, reg = 0x29;
+		break;
+	case times:
+		imm = 0x69, mem = 0x0faf, reg = 0x0faf;
+		break;
+	case slash:
+	case percent:
+		imm = mem = reg = 0;
+		break;
+	default: // comparison
+		imm = 0x3d, mem = 0x3b, reg = 0x39;
+		break;
+	}
+
+	jit_expression(c, node->kid[0]);
+
+	if (o.kind == opnd_none) {
+		byte(c, 0x50); // push rax
+		jit_expression(c, node->kid[1]);
+		op_reg(c, 0x89, RAX, RCX); // mov rcx, rax
+		byte(c, 0x58); // pop rax
+	} else if (div || (o.kind == opnd_imm &&
+					 o.imm != (int32_t)o.imm)) {
+		jit_load(c, &o, RCX);
+	} else if (o.kind == opnd_imm) {
+		if (node->op == times) {
+			op_reg(c, imm, RAX, RAX); // imul rax, rax, imm32
+		} else {
+			opcode(c, imm);
+		}
+		dword(c, o.imm);
+		return;
+	} else {
+		op_mem(c, mem, RAX, jit_frame(c, o.level, RSI), o.disp);
+		return;
+	}
+
+	/* Second operand in rcx */
+	if (div)
+		jit_div(c, n, o.kind != opnd_imm || !o.imm || o.imm == -1);
+	else if (node->op == times)
+		op_reg(c, reg, RAX, RCX);
+	else
+		op_reg(c, reg, RCX, RAX);
+}
+
+/* Condition code of a comparison */
+static int
+jit_cc(SYMBOL op)
+{
+	switch (op) {
+	case eql:
+		return CC_E;
+	case neq:
+		return CC_NE;
+	case lss:
+		return CC_L;
+	case leq:
+		return CC_LE;
+	case gtr:
+		return CC_G;
+	case geq:
+	default:
+		return CC_GE;
+	}
+}
+
+/* Evaluate node into rax */
+static void
+jit_expression(jit_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+	operand_t o;
+
+	switch (node->type) {
+	case ast_num:
+	case ast_var:
+		o = jit_operand(c, n);
+		jit_load(c, &o, RAX);
+		break;
+	case ast_neg:
+		jit_expression(c, node->kid[0]);
+		op_reg(c, 0xf7, 3, RAX); // neg rax
+		break;
+	case ast_odd:
+		jit_expression(c, node->kid[0]);
+		op_reg(c, 0x83, 4, RAX); // and rax, 1
+		byte(c, 1);
+		break;
+	case ast_binop:
+		jit_binary(c, n);
+		break;
+	case ast_cond:
+		jit_binary(c, n);
+		byte(c, 0x0f); // setcc al
+		byte(c, 0x90 | jit_cc(node->op));
+		byte(c, 0xc0);
+		byte(c, 0x48); // movzx rax, al
+		byte(c, 0x0f);
+		byte(c, 0xb6);
+		byte(c, 0xc0);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Jump if condition is false, return place to patch */
+static size_t
+jit_branch(jit_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+
+	if (node->type == ast_cond) {
+		jit_binary(c, n);
+		/* Inverse of a condition code flips the lowest bit */
+		return jump(c, jit_cc(node->op) ^ 1);
+	}
+
+	if (node->type == ast_odd) {
+		jit_expression(c, node->kid[0]);
+		byte(c, 0xa8); // test al, 1
+		byte(c, 1);
+	} else {
+		jit_expression(c, n);
+		op_reg(c, 0x85, RAX, RAX); // test rax, rax
+	}
+	return jump(c, CC_E);
+}
+
+static void
+jit_statement(jit_compiler_t *c, int n)
+{
+	const ast_t *ast = c->ast;
+	const node_t *node = ast->nodes + n;
+	size_t at, loop;
+	int level, block;
+
+	switch (node->type) {
+	case ast_assign:
+		jit_expression(c, node->kid[0]);
+		level = jit_level(c, node->depth);
+		op_mem(c, 0x89, RAX, jit_frame(c, level, RSI),
+		       jit_disp(node->slot));
+		break;
+	case ast_call:
+		/* Calls nest on the C stack down to jit_stack_limit */
+		mov_imm(c, RAX, (long)&jit_stack_limit);
+		op_mem(c, 0x3b, RSP, RAX, 0); // cmp rsp, [rax]
+		at = jump(c, CC_AE);
+		byte(c, 0xbf); // mov edi, n
+		dword(c, n);
+		op_reg(c, 0x83, 4, RSP); // and rsp, -16
+		byte(c, 0xf0);
+		call_abs(c, jit_call_error);
+		patch(c, at, c->len);
+
+		/* Block of a procedure symbol is its body */
+		block = ast->syms[node->sym].block;
+		level = jit_level(c, ast->blocks[block].depth) + 1;
+		if (jit_frame(c, level, RDI) == RBP)
+			op_reg(c, 0x89, RBP, RDI); // mov rdi, rbp
+
+		if (c->entries) {
+			mov_imm(c, RAX, (long)(c->entries + block));
+			byte(c, 0xff); // call [rax]
+			byte(c, 0x10);
+			break;
+		}
+		byte(c, 0xe8); // call
+		dword(c, 0);
+		if (c->fix_num == c->fix_cap) {
+			c->fix_cap = c->fix_cap ? c->fix_cap * 2 : 0x40;
+			c->fix = realloc(c->fix, c->fix_cap * sizeof(*c->fix));
+			if (!c->fix)
+				jit_no_mem(c->context);
+		}
+		c->fix[c->fix_num].at = c->len - 4;
+		c->fix[c->fix_num].block = block;
+		c->fix_num++;
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			jit_statement(c, n);
+		break;
+	case ast_if:
+		at = jit_branch(c, node->kid[0]);
+		jit_statement(c, node->kid[1]);
+		patch(c, at, c->len);
+		break;
+	case ast_while:
+		loop = c->len;
+		at = jit_branch(c, node->kid[0]);
+		jit_statement(c, node->kid[1]);
+		patch(c, jump(c, -1), loop);
+		patch(c, at, c->len);
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			const node_t *var = ast->nodes + n;
+			level = jit_level(c, var->depth);
+			op_mem(c, 0x8d, RDI, jit_frame(c, level, RSI),
+			       jit_disp(var->slot)); // lea
+			call_abs(c, jit_read);
+		}
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			jit_expression(c, n);
+			op_reg(c, 0x89, RAX, RDI); // mov rdi, rax
+			call_abs(c, jit_write);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+jit_compile_block(jit_compiler_t *c, int block)
+{
+	const ast_block_t *b = c->ast->blocks + block;
+	/* Static link and variables, keep rsp aligned to 16 bytes */
+	int size = (8 + 8 * b->nvars + 15) & ~15;
+
+	c->block = block;
+
+	byte(c, 0x55); // push rbp
+	op_reg(c, 0x89, RSP, RBP); // mov rbp, rsp
+	op_reg(c, 0x81, 5, RSP); // sub rsp, size
+	dword(c, size);
+	op_mem(c, 0x89, RDI, RBP, -8); // mov [rbp - 8], rdi
+
+	/* Every activation starts with zeroed variables */
+	for (int i = 0; i < b->nvars; i++) {
+		op_mem(c, 0xc7, 0, RBP, jit_disp(i));
+		dword(c, 0);
+	}
+
+	jit_statement(c, b->body);
+
+	byte(c, 0xc9); // leave
+	byte(c, 0xc3); // ret
+}
+
+void
+jit_compile(jit_t *jit, const ast_t *ast, context_t *context)
+{
+#if JIT_SUPPORTED
+	jit_compiler_t c = { .jit = jit, .ast = ast, .context = context };
+
+	if (!(jit->addr = calloc(ast->block_num, sizeof(size_t))))
+		jit_no_mem(context);
+
+	for (int b = 0; b < ast->block_num; b++) {
+		jit->addr[b] = c.len;
+		jit_compile_block(&c, b);
+	}
+	for (int i = 0; i < c.fix_num; i++)
+		patch(&c, c.fix[i].at, jit->addr[c.fix[i].block]);
+
+	jit->size = c.len;
+	jit->code = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED) {
+		jit->code = NULL;
+		jit_no_mem(context);
+	}
+	memcpy(jit->code, c.buf, c.len);
+	if (mprotect(jit->code, jit->size, PROT_READ | PROT_EXEC)) {
+		sprintf(context_top_restrict(context)->message,
+			"jit: cannot make code executable");
+		exit(1);
+	}
+	jit->entry = (void (*)(long *))(jit->code + jit->addr[0]);
+
+	free(c.buf);
+	free(c.fix);
+#else
+	sprintf(context_top_restrict(context)->message,
+		"jit: not supported on this platform");
+	exit(1);
+#endif
+}
+
+void
+jit_run(const jit_t *jit, const ast_t *ast, context_t *context)
+{
+	jit_context = context;
+	jit_ast = ast;
+	jit_stack(__builtin_frame_address(0));
+
+	jit->entry(NULL);
+	fflush(context->outstream);
+}
+
+/**
+ * Map code of c as a unit of its own, return its entry. Runtime of
+ * native code is bound to the context code was compiled for.
+*/
+static jit_entry_t
+jit_unit(jit_compiler_t *c)
+{
+#if JIT_SUPPORTED
+	jit_t *jit = c->jit;
+	unsigned char *code;
+
+	if (jit->unit_num == jit->unit_cap) {
+		jit->unit_cap = jit->unit_cap ? jit->unit_cap * 2 : 0x10;
+		jit->units = realloc(jit->units,
+				     jit->unit_cap * sizeof(*jit->units));
+		if (!jit->units)
+			jit_no_mem(c->context);
+	}
+
+	code = mmap(NULL, c->len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		jit_no_mem(c->context);
+	memcpy(code, c->buf, c->len);
+	if (mprotect(code, c->len, PROT_READ | PROT_EXEC)) {
+		sprintf(context_top_restrict(c->context)->message,
+			"jit: cannot make code executable");
+		exit(1);
+	}
+	jit->units[jit->unit_num].code = code;
+	jit->units[jit->unit_num].size = c->len;
+	jit->unit_num++;
+
+	jit_context = c->context;
+	jit_ast = c->ast;
+	free(c->buf);
+	return (jit_entry_t)code;
+#else
+	sprintf(context_top_restrict(c->context)->message,
+		"jit: not supported on this platform");
+	exit(1);
+	return NULL;
+#endif
+}
+
+void
+jit_stubs(jit_t *jit, const ast_t *ast, context_t *context,
+	  void (*enter)(long *link, int block), jit_entry_t *entries)
+{
+	jit_compiler_t c = { .jit = jit, .ast = ast, .context = context };
+	unsigned char *code;
+
+	for (int b = 0; b < ast->block_num; b++) {
+		byte(&c, 0xbe); // mov esi, b
+		dword(&c, b);
+		mov_imm(&c, RAX, (long)enter);
+		byte(&c, 0xff); // jmp rax
+		byte(&c, 0xe0);
+	}
+
+	/* Stubs are alike, every one is as long as the first */
+	code = (unsigned char *)jit_unit(&c);
+	for (int b = 0; b < ast->block_num; b++)
+		entries[b] = (jit_entry_t)(code + b * (c.len / ast->block_num));
+}
+
+jit_entry_t
+jit_compile_proc(jit_t *jit, const ast_t *ast, context_t *context, int block,
+		 jit_entry_t *entries)
+{
+	jit_compiler_t c = { .jit = jit,
+			     .ast = ast,
+			     .context = context,
+			     .entries = entries };
+
+	jit_compile_block(&c, block);
+	return jit_unit(&c);
+}
+
+jit_entry_t
+jit_compile_loop(jit_t *jit, const ast_t *ast, context_t *context, int block,
+		 int n, jit_entry_t *entries)
+{
+	jit_compiler_t c = { .jit = jit,
+			     .ast = ast,
+			     .context = context,
+			     .block = block,
+			     .entries = entries };
+
+	/* Frame of the activation is taken as is, rsp stays aligned */
+	byte(&c, 0x55); // push rbp
+	op_reg(&c, 0x89, RDI, RBP); // mov rbp, rdi
+	jit_statement(&c, n);
+	byte(&c, 0x5d); // pop rbp
+	byte(&c, 0xc3); // ret
+
+	return jit_unit(&c);
+}
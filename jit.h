@@ -0,0 +1,87 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "ast.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/**
+ * Native code of a block, called with the frame of its enclosing block
+ * as static link. A frame points past its static link at frame[-1],
+ * and variable of slot is at frame[-2 - slot].
+*/
+typedef void (*jit_entry_t)(long *link);
+
+/* Native code of a whole program */
+typedef struct {
+	/* Executable mapping */
+	unsigned char *code;
+	size_t size;
+	/* Entry of each block */
+	size_t *addr;
+	/* Main program, called with a null static link */
+	jit_entry_t entry;
+
+	/* Mappings of blocks and loops compiled one at a time */
+	struct {
+		unsigned char *code;
+		size_t size;
+	} * units;
+	int unit_num;
+	int unit_cap;
+} jit_t;
+
+void jit_init(jit_t *jit);
+void jit_free(jit_t *jit);
+
+/* Translate every block of a parsed program into x86-64 code */
+void jit_compile(jit_t *jit, const ast_t *ast, context_t *context);
+/* Run native code */
+void jit_run(const jit_t *jit, const ast_t *ast, context_t *context);
+/**
+ * Let native calls nest on the C stack from base down, as far as it is
+ * safe to, return the lowest stack address a call may be made from.
+ * Code run other than by jit_run is unchecked until then.
+*/
+const char *jit_stack(const void *base);
+
+/**
+ * Blocks and loops compiled one at a time call other blocks through
+ * entries, which start out as stubs calling enter(link, block).
+*/
+void jit_stubs(jit_t *jit, const ast_t *ast, context_t *context,
+	       void (*enter)(long *link, int block), jit_entry_t *entries);
+/* Translate a block on its own */
+jit_entry_t jit_compile_proc(jit_t *jit, const ast_t *ast, context_t *context,
+			     int block, jit_entry_t *entries);
+/**
+ * Translate while statement n of block on its own, into a function
+ * taking the frame of an activation of block and running the loop
+ * from its condition to its end.
+*/
+jit_entry_t jit_compile_loop(jit_t *jit, const ast_t *ast, context_t *context,
+			     int block, int n, jit_entry_t *entries);
+
+#endif /* JIT_H */
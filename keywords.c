@@ -20,30 +20,39 @@
 
 #include "keywords.h"
 
-const keyword_t keywords[14] = {
-	{ .value = "begin", .symbol = beginsym },
-	{ .value = "call", .symbol = callsym },
-	{ .value = "const", .symbol = constsym },
-	{ .value = "do", .symbol = dosym },
-	{ .value = "end", .symbol = endsym },
-	{ .value = "if", .symbol = ifsym },
-	{ .value = "odd", .symbol = oddsym },
-	{ .value = "procedure", .symbol = proceduresym },
-	{ .value = "read", .symbol = readsym },
-	{ .value = "then", .symbol = thensym },
-	{ .value = "var", .symbol = varsym },
-	{ .value = "while", .symbol = whilesym },
-	{ .value = "write", .symbol = writesym },
-	{ .value = "", .symbol = ident } // fallback to ident
+/**
+ * Slot of a keyword is KEYWORD_HASH of it, a perfect hash found for
+ * these 13 keywords: each keyword has a slot of its own, so any other
+ * word needs at most one compare to be told apart.
+*/
+#define KEYWORD_HASH(id, len) (((id)[0] + 2 * (id)[1] + 7 * (len)) & 31)
+
+static const keyword_t keywords[32] = {
+	[0] = { .value = "then", .symbol = thensym },
+	[1] = { .value = "call", .symbol = callsym },
+	[3] = { .value = "if", .symbol = ifsym },
+	[4] = { .value = "const", .symbol = constsym },
+	[10] = { .value = "while", .symbol = whilesym },
+	[12] = { .value = "odd", .symbol = oddsym },
+	[13] = { .value = "var", .symbol = varsym },
+	[15] = { .value = "begin", .symbol = beginsym },
+	[16] = { .value = "do", .symbol = dosym },
+	[19] = { .value = "procedure", .symbol = proceduresym },
+	[22] = { .value = "end", .symbol = endsym },
+	[24] = { .value = "read", .symbol = readsym },
+	[30] = { .value = "write", .symbol = writesym }
 };
 
 SYMBOL
-key2sym(const char *id)
+key2sym(const char *id, int len)
 {
 	const keyword_t *ptr;
-	for (ptr = keywords; ptr - keywords < 13; ptr++) {
-		if (!strcmp(ptr->value, id))
-			break;
-	}
-	return ptr->symbol;
+
+	if (len < 2)
+		return ident;
+
+	ptr = keywords + KEYWORD_HASH((const unsigned char *)id, len);
+	if (ptr->value && !strcmp(ptr->value, id))
+		return ptr->symbol;
+	return ident;
 }
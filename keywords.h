@@ -26,7 +26,7 @@ typedef struct {
 	SYMBOL symbol;
 } keyword_t;
 
-/* Convert keyword to SYMBOL */
-SYMBOL key2sym(const char *id);
+/* Convert keyword of length len to SYMBOL, ident if not a keyword */
+SYMBOL key2sym(const char *id, int len);
 
 #endif /* KEYWORDS_H */
@@ -0,0 +1,106 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * SIMD scanners of the lexer, included by symbols.c once for each
+ * instruction set. Define before including:
+ * 	SCAN(name)	name of each function
+ * 	SCAN_TARGET	function attribute enabling the instruction set
+ * 	SCAN_WIDTH	bytes per vector
+ * 	SCAN_VEC	vector type
+ * 	SCAN_LOAD, SCAN_SET1, SCAN_MIN, SCAN_SUB, SCAN_OR, SCAN_CMPEQ,
+ * 	SCAN_MOVEMASK	intrinsics of the instruction set
+*/
+
+/* Bytes of v no greater than n, as unsigned */
+#define SCAN_LE(v, n) SCAN_CMPEQ(SCAN_MIN(v, SCAN_SET1(n)), v)
+/* Bytes of v in [lo, lo + n) */
+#define SCAN_IN(v, lo, n) SCAN_LE(SCAN_SUB(v, SCAN_SET1(lo)), (n)-1)
+
+/* Bit mask of a full vector */
+#define SCAN_ALL ((uint32_t)(((uint64_t)1 << SCAN_WIDTH) - 1))
+
+/* Count newlines of mask at p, remember the last one */
+#define SCAN_LINES(mask, p)                                                    \
+	if (mask) {                                                            \
+		*lines += __builtin_popcount(mask);                            \
+		*line = (p) + 31 - __builtin_clz(mask);                        \
+	}
+
+SCAN_TARGET static const char *
+SCAN(space)(const char *p, const char *end, int *lines, const char **line)
+{
+	for (; end - p >= SCAN_WIDTH; p += SCAN_WIDTH) {
+		SCAN_VEC v = SCAN_LOAD((const void *)p);
+		uint32_t space = SCAN_MOVEMASK(SCAN_LE(v, ' '));
+		uint32_t nl = SCAN_MOVEMASK(SCAN_CMPEQ(v, SCAN_SET1('\n')));
+
+		if (space != SCAN_ALL) {
+			int n = __builtin_ctz(~space);
+			nl &= ((uint32_t)1 << n) - 1;
+			SCAN_LINES(nl, p);
+			return p + n;
+		}
+		SCAN_LINES(nl, p);
+	}
+	return scan_space_scalar(p, end, lines, line);
+}
+
+SCAN_TARGET static const char *
+SCAN(alnum)(const char *p, const char *end)
+{
+	for (; end - p >= SCAN_WIDTH; p += SCAN_WIDTH) {
+		SCAN_VEC v = SCAN_LOAD((const void *)p);
+		SCAN_VEC alpha = SCAN_OR(v, SCAN_SET1(0x20));
+		uint32_t alnum = SCAN_MOVEMASK(
+			SCAN_OR(SCAN_IN(v, '0', 10), SCAN_IN(alpha, 'a', 26)));
+
+		if (alnum != SCAN_ALL)
+			return p + __builtin_ctz(~alnum);
+	}
+	return scan_alnum_scalar(p, end);
+}
+
+SCAN_TARGET static const char *
+SCAN(digit)(const char *p, const char *end)
+{
+	for (; end - p >= SCAN_WIDTH; p += SCAN_WIDTH) {
+		SCAN_VEC v = SCAN_LOAD((const void *)p);
+		uint32_t digit = SCAN_MOVEMASK(SCAN_IN(v, '0', 10));
+
+		if (digit != SCAN_ALL)
+			return p + __builtin_ctz(~digit);
+	}
+	return scan_digit_scalar(p, end);
+}
+
+#undef SCAN_LE
+#undef SCAN_IN
+#undef SCAN_ALL
+#undef SCAN_LINES
+#undef SCAN
+#undef SCAN_TARGET
+#undef SCAN_WIDTH
+#undef SCAN_VEC
+#undef SCAN_LOAD
+#undef SCAN_SET1
+#undef SCAN_MIN
+#undef SCAN_SUB
+#undef SCAN_OR
+#undef SCAN_CMPEQ
+#undef SCAN_MOVEMASK
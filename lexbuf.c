@@ -0,0 +1,365 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lexbuf.h"
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Part of input lexed by one task */
+typedef struct {
+	const char *begin;
+	const char *end;
+	/* Tokens with positions relative to the chunk */
+	lexbuf_t buf;
+	/* Newlines in chunk, and chars after the last one */
+	int lines;
+	int tail;
+	bool failed;
+} lexchunk_t;
+
+/* Chunks shared by the threads */
+typedef struct {
+	const input_t *input;
+	lexchunk_t *chunks;
+	int num;
+	/* Next chunk to take */
+	int next;
+	pthread_mutex_t lock;
+} lexpool_t;
+
+void
+lexbuf_init(lexbuf_t *buf)
+{
+	memset(buf, 0, sizeof(lexbuf_t));
+}
+
+void
+lexbuf_free(lexbuf_t *buf)
+{
+	free(buf->tokens);
+	free(buf->text);
+	free(buf->cache);
+	lexbuf_init(buf);
+}
+
+static bool
+lexbuf_grow(lexbuf_t *buf, int num)
+{
+	token_t *tokens;
+	int cap = buf->cap ? buf->cap : 0x100;
+
+	if (num <= buf->cap)
+		return true;
+	while (cap < num)
+		cap *= 2;
+	if (!(tokens = realloc(buf->tokens, cap * sizeof(token_t))))
+		return false;
+	buf->tokens = tokens;
+	buf->cap = cap;
+	return true;
+}
+
+/* Lex one chunk until its end or its first invalid symbol */
+static void
+lexchunk_lex(lexchunk_t *chunk, const input_t *input)
+{
+	input_t in = { .base = input->base,
+		       .pos = chunk->begin,
+		       .end = chunk->end };
+	lexer_t lexer;
+	token_t *t;
+	SYMBOL sym;
+
+	lexer_init(&lexer, &in, 0);
+	/* About one token in five bytes */
+	if (!lexbuf_grow(&chunk->buf, (chunk->end - chunk->begin) / 5 + 1))
+		goto no_mem;
+
+	do {
+		sym = lexer_next(&lexer);
+		if (!lexbuf_grow(&chunk->buf, chunk->buf.num + 1))
+			goto no_mem;
+
+		t = chunk->buf.tokens + chunk->buf.num++;
+		t->type = sym;
+		t->pos = lexer.pos;
+		t->num = lexer.num;
+		if (sym == eof) {
+			t->offset = in.end - in.base;
+			t->len = 0;
+		} else {
+			t->offset = lexer.start - in.base;
+			/* Invalid symbol keeps text of error message */
+			t->len = sym == nul ? lexer.id_len : in.pos - lexer.start;
+		}
+	} while (sym != eof && sym != nul);
+
+	chunk->lines = 0;
+	chunk->tail = chunk->end - chunk->begin;
+	for (const char *p = chunk->begin;
+	     (p = memchr(p, '\n', chunk->end - p)); p++) {
+		chunk->lines++;
+		chunk->tail = chunk->end - p - 1;
+	}
+	return;
+
+no_mem:
+	chunk->failed = true;
+}
+
+static void *
+lexpool_work(void *arg)
+{
+	lexpool_t *pool = arg;
+	int k;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		k = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (k >= pool->num)
+			return 0;
+		lexchunk_lex(pool->chunks + k, pool->input);
+	}
+}
+
+/* Join tokens of chunks in order, with positions of the whole input */
+static bool
+lexbuf_join(lexbuf_t *buf, lexchunk_t *chunks, int num)
+{
+	pos_t start = { .row = 1, .col = 0 };
+	int total = 0, k;
+
+	for (k = 0; k < num; k++) {
+		if (chunks[k].failed)
+			return false;
+		total += chunks[k].buf.num;
+	}
+	if (!lexbuf_grow(buf, total))
+		return false;
+
+	for (k = 0; k < num; k++) {
+		lexchunk_t *chunk = chunks + k;
+
+		for (int i = 0; i < chunk->buf.num; i++) {
+			token_t *t = chunk->buf.tokens + i;
+
+			/* Only the last chunk ends the input */
+			if (t->type == eof && k != num - 1)
+				break;
+			if (t->pos.row == 1)
+				t->pos.col += start.col;
+			t->pos.row += start.row - 1;
+			buf->tokens[buf->num++] = *t;
+
+			/* Rest of input is never read by parser */
+			if (t->type == nul)
+				return true;
+		}
+
+		if (chunk->lines) {
+			start.row += chunk->lines;
+			start.col = chunk->tail;
+		} else {
+			start.col += chunk->tail;
+		}
+	}
+	return true;
+}
+
+/* Intern idents in order, so ids do not depend on threads */
+static bool
+lexbuf_intern(lexbuf_t *buf)
+{
+	for (int i = 0; i < buf->num; i++) {
+		token_t *t = buf->tokens + i;
+
+		if (t->type != ident)
+			continue;
+		t->num = intern(buf->input->base + t->offset, t->len);
+		if (t->num < 0)
+			return false;
+	}
+	return true;
+}
+
+bool
+lexbuf_lex(lexbuf_t *buf, const input_t *input, int threads)
+{
+	size_t size = input->end - input->base;
+	lexpool_t pool = { .input = input };
+	pthread_t *tids;
+	const char *p;
+	bool ok;
+	int k;
+
+	lexbuf_init(buf);
+	buf->input = input;
+
+	if (threads < 1)
+		threads = 1;
+	pool.num = size / LEXBUF_CHUNK_MIN;
+	if (pool.num > threads * LEXBUF_CHUNKS_PER_THREAD)
+		pool.num = threads * LEXBUF_CHUNKS_PER_THREAD;
+	if (pool.num < 1)
+		pool.num = 1;
+	if (threads > pool.num)
+		threads = pool.num;
+
+	if (!(pool.chunks = calloc(pool.num, sizeof(lexchunk_t))))
+		return false;
+	if (!(tids = calloc(threads, sizeof(pthread_t)))) {
+		free(pool.chunks);
+		return false;
+	}
+
+	/* Cut at the first space after each even share of input */
+	p = input->base;
+	for (k = 0; k < pool.num; k++) {
+		const char *end = input->base + size * (k + 1) / pool.num;
+
+		if (end < p)
+			end = p;
+		while (end < input->end && (unsigned char)*end > ' ')
+			end++;
+		pool.chunks[k].begin = p;
+		pool.chunks[k].end = end;
+		p = end;
+	}
+
+	/* This thread takes chunks too */
+	pthread_mutex_init(&pool.lock, 0);
+	for (k = 1; k < threads; k++) {
+		if (pthread_create(tids + k, 0, lexpool_work, &pool))
+			break;
+	}
+	lexpool_work(&pool);
+	while (--k > 0)
+		pthread_join(tids[k], 0);
+	pthread_mutex_destroy(&pool.lock);
+
+	/* One chunk is already in place */
+	if (pool.num == 1 && !pool.chunks->failed) {
+		buf->tokens = pool.chunks->buf.tokens;
+		buf->num = pool.chunks->buf.num;
+		buf->cap = pool.chunks->buf.cap;
+		ok = true;
+	} else {
+		ok = lexbuf_join(buf, pool.chunks, pool.num);
+		for (k = 0; k < pool.num; k++)
+			lexbuf_free(&pool.chunks[k].buf);
+	}
+
+	free(tids);
+	free(pool.chunks);
+	return ok && lexbuf_intern(buf);
+}
+
+bool
+lexbuf_push(lexbuf_t *buf, SYMBOL type, pos_t pos, long num,
+	    const char *text, int len)
+{
+	int cap = buf->cap;
+	token_t *t;
+
+	if (!lexbuf_grow(buf, buf->num + 1))
+		return false;
+	if (!buf->cache || cap != buf->cap) {
+		lexcache_t *cache =
+			realloc(buf->cache, buf->cap * sizeof(lexcache_t));
+
+		if (!cache)
+			return false;
+		buf->cache = cache;
+	}
+
+	if (buf->text_len + len + 1 > buf->text_cap) {
+		size_t cap = buf->text_cap ? buf->text_cap * 2 : 0x1000;
+		char *tmp;
+
+		while (cap < buf->text_len + len + 1)
+			cap *= 2;
+		if (!(tmp = realloc(buf->text, cap)))
+			return false;
+		buf->text = tmp;
+		buf->text_cap = cap;
+	}
+
+	t = buf->tokens + buf->num++;
+	t->type = type;
+	t->len = len;
+	t->offset = buf->text_len;
+	t->pos = pos;
+	t->num = num;
+	buf->cache[buf->num - 1].scope = 0;
+
+	memcpy(buf->text + buf->text_len, text, len);
+	buf->text_len += len;
+	buf->text[buf->text_len++] = 0;
+	return true;
+}
+
+void
+lexbuf_name(const lexbuf_t *buf, const token_t *t, char *name, int size)
+{
+	int len = t->len;
+
+	if (t->type == number) {
+		snprintf(name, size, "%ld", t->num);
+	} else if (t->type == eof) {
+		snprintf(name, size, "EOF");
+	} else {
+		if (len > size - 1)
+			len = size - 1;
+		memcpy(name,
+		       (buf->input ? buf->input->base : buf->text) + t->offset,
+		       len);
+		name[len] = 0;
+	}
+}
+
+void
+lexbuf_bench(const input_t *input, int threads)
+{
+	struct timespec start, end;
+	long tokens = 0, passes = 0;
+	lexbuf_t buf;
+	double ns = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if (!lexbuf_lex(&buf, input, threads))
+			break;
+		tokens += buf.num - 1;
+		passes++;
+		lexbuf_free(&buf);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 +
+		     (end.tv_nsec - start.tv_nsec);
+	} while (ns < 1e9);
+
+	fprintf(stderr, "%d thread%s %ld tokens in %ld passes, "
+			"%.2f Mtokens/s, %.1f MB/s\n",
+		threads, threads > 1 ? "s" : " ", tokens, passes,
+		tokens / ns * 1e3,
+		(input->end - input->base) * passes / ns * 1e3);
+}
@@ -0,0 +1,83 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LEXBUF_H
+#define LEXBUF_H
+
+#include <stdbool.h>
+
+#include "symbols.h"
+
+/* Inputs smaller than this are lexed on one thread */
+#define LEXBUF_CHUNK_MIN 0x40000
+/* Chunks handed to each thread, to balance uneven chunks */
+#define LEXBUF_CHUNKS_PER_THREAD 4
+
+/**
+ * Inline cache of a token read from a stream, for interpreters that
+ * evaluate while parsing: what an ident resolved to, valid only
+ * while looked up again from scope.
+*/
+typedef struct {
+	const void *scope;
+	void *target;
+} lexcache_t;
+
+/**
+ * Growable array of tokens, which parsers walk by index. Text of a
+ * token lies in mapped input, or in text for tokens read from a
+ * stream. Lexing a whole input ends it with eof, or with nul at the
+ * first invalid symbol.
+*/
+typedef struct {
+	token_t *tokens;
+	int num;
+	int cap;
+
+	const input_t *input;
+	char *text;
+	size_t text_len;
+	size_t text_cap;
+
+	/* Cache of each token read from a stream, cap entries */
+	lexcache_t *cache;
+} lexbuf_t;
+
+void lexbuf_init(lexbuf_t *buf);
+void lexbuf_free(lexbuf_t *buf);
+
+/**
+ * Lex mapped input on up to threads threads. Input is cut at spaces,
+ * which never lie inside a token, and the chunks are joined back in
+ * order with positions of the whole input. Return false if out of
+ * memory.
+*/
+bool lexbuf_lex(lexbuf_t *buf, const input_t *input, int threads);
+
+/**
+ * Append a token read from a stream, with a copy of its text and
+ * an empty cache.
+*/
+bool lexbuf_push(lexbuf_t *buf, SYMBOL type, pos_t pos, long num,
+		 const char *text, int len);
+/* Copy text of a token into name of size bytes, truncated to fit */
+void lexbuf_name(const lexbuf_t *buf, const token_t *t, char *name, int size);
+/* Lex mapped input repeatedly with threads, report tokens per second */
+void lexbuf_bench(const input_t *input, int threads);
+
+#endif /* LEXBUF_H */
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <readline/readline.h>
@@ -29,6 +30,15 @@
 
 #include "sharedmem.h"
 #include "context.h"
+#include "ast.h"
+#include "opt.h"
+#include "ir.h"
+#include "vm.h"
+#include "jit.h"
+#include "closure.h"
+#include "tier.h"
+#include "aot.h"
+#include "cgen.h"
 
 #define NDEBUG
 
@@ -47,9 +57,62 @@ print_version()
 static inline void
 print_help(char **argv)
 {
-	printf("Usage: %s [options] [infile]\n", argv[0]);
+	printf("Usage: %s [options] [infile]\n"
+	       "Options:\n"
+	       "  -e engine\trun infile with engine: ast (default), vm, jit,"
+	       " closure, tier\n"
+	       "  -P calls\twith -e tier, compile procedures called calls times,"
+	       " default %d\n"
+	       "  -L loops\twith -e tier, compile loops iterated loops times,"
+	       " default %d\n"
+	       "  -d\t\tprint p-code of infile instead of running it\n"
+	       "  -b\t\tbenchmark dispatch loops of vm on infile\n"
+	       "  -p\t\tprint pairs of vm instructions executed on infile\n"
+	       "  -l\t\tbenchmark lexer on infile\n"
+	       "  -j threads\tlex infile on threads threads, default all cores\n"
+	       "  -c file\tcompile infile into native executable file\n"
+	       "  -S\t\twith -c, write x86-64 assembly instead\n"
+	       "  -t file\ttranslate infile into C source file\n"
+	       "  -O level\toptimize infile at level 0 to 2, default 2\n"
+	       "  -s\t\tprint what optimizations and tiers did on infile\n"
+	       "  -i\t\tprint SSA form of infile instead of running it\n"
+	       "  -v\t\tprint version\n"
+	       "  -h\t\tprint this help\n",
+	       argv[0], TIER_CALLS, TIER_LOOPS);
 }
 
+/* Execution engines of file mode */
+typedef enum {
+	engine_ast, // walk the syntax tree
+	engine_vm, // compile to p-code
+	engine_jit, // compile to native code
+	engine_closure, // compile to closures
+	engine_tier // walk the syntax tree, compile hot code to native code
+} ENGINE;
+
+/* Options of file mode */
+static struct {
+	ENGINE engine;
+	bool dump;
+	bool bench;
+	/* Instruction pairs of vm */
+	bool pairs;
+	bool lex_bench;
+	/* Threads lexing a mapped file */
+	int threads;
+	/* Ahead-of-time output, assembly only if asm_only */
+	const char *output;
+	bool asm_only;
+	/* C translation output */
+	const char *c_output;
+	/* Optimization level */
+	int level;
+	bool stats;
+	/* Thresholds of tiered execution */
+	tier_config_t tier;
+	bool ir_dump;
+} options;
+
 #define prompt_reset()                                                         \
 	{                                                                      \
 		prompt_setup(context->prompt, "PL0> ");                        \
@@ -57,6 +120,24 @@ print_help(char **argv)
 		shm_attach(&shm[1]);                                           \
 	}
 
+/**
+ * Idents declared by interpreters of earlier lines, each interpreter
+ * loads them at start and saves them back when it exits.
+*/
+static FILE *session;
+static context_t *session_context;
+
+static void
+session_end()
+{
+	if (!session_context)
+		return;
+	ident_save(session_context, session);
+	/* Procedures of this line are gone with it */
+	context_free(session_context);
+	session_context = 0;
+}
+
 void
 cli_run()
 {
@@ -87,6 +168,10 @@ cli_run()
 	}
 	/* Initialize prompt */
 	prompt_setup(context->prompt, "PL0> ");
+	if (!(session = tmpfile())) {
+		perror("tmpfile");
+		exit(1);
+	}
 
 	/* CLI mode, readline */
 	while ((line = readline(context->prompt->buffer)) != NULL) {
@@ -121,6 +206,10 @@ cli_run()
 				/* Reset message */
 				context->message = shm[0].ptr;
 				context->message[0] = 0;
+				/* Idents of earlier lines */
+				ident_load(context, session);
+				session_context = context;
+				atexit(session_end);
 
 				/* Run interpreter */
 				context_next(context);
@@ -130,6 +219,7 @@ cli_run()
 				printf("\nIdent table:\n");
 				ident_dump(context);
 				fflush(stdout);
+				session_end();
 				/* Dettach shared memories */
 				shm_dettach(&shm[0]);
 				shm_dettach(&shm[1]);
@@ -196,7 +286,9 @@ cli_run()
 
 			/* Let child thread bort */
 			kill(pid, SIGABRT);
-			fprintf(stderr, "interpreter timeout\n");
+			/* Idents are saved when an interpreter exits */
+			fprintf(stderr, "interpreter timeout, declarations of "
+					"this line are lost\n");
 			prompt_reset();
 		}
 
@@ -220,6 +312,110 @@ cli_run()
 	shm_dettach(&shm[1]);
 }
 
+/* Error message of file mode */
+static char file_message[MAX_CONTEXT_MSG_SIZE];
+
+static void
+print_message()
+{
+	if (file_message[0])
+		fprintf(stderr, "%s\n", file_message);
+}
+
+/* Parse the whole file into a syntax tree, then run it */
+void
+file_run(FILE *instream)
+{
+	static context_t context[1];
+	static input_t input[1];
+	static lexbuf_t lexbuf[1];
+	ast_t ast[1];
+	opt_stats_t stats = { 0 };
+
+	token_init();
+	context_init(context, instream, stdout);
+	context->message = file_message;
+	atexit(print_message);
+
+	/**
+	 * Lex straight from memory when input is a regular file,
+	 * on all the threads before parsing.
+	*/
+	if (context_map(context, input)) {
+		if (options.lex_bench) {
+			token_bench(context);
+			lexbuf_bench(input, options.threads);
+			context_unmap(context);
+			fclose(instream);
+			return;
+		}
+		if (!lexbuf_lex(lexbuf, input, options.threads)) {
+			sprintf(file_message, "Out of memory");
+			exit(1);
+		}
+		context->lexbuf = lexbuf;
+	} else if (options.lex_bench) {
+		token_bench(context);
+	}
+
+	ast_init(ast);
+	ast_parse(ast, context);
+	opt_run(ast, context, options.level, &stats);
+	if (options.stats)
+		opt_report(&stats, stderr);
+	context->lexbuf = token_stream();
+	lexbuf_free(lexbuf);
+	context_unmap(context);
+	fclose(instream);
+
+	if (options.ir_dump) {
+		ir_dump(ast, context, options.level, stdout);
+	} else if (options.c_output) {
+		cgen_write(ast, context, options.c_output);
+	} else if (options.output) {
+		aot_build(ast, context, options.output, options.asm_only);
+	} else if (options.engine == engine_vm || options.dump ||
+		   options.bench || options.pairs) {
+		vm_t vm[1];
+
+		vm_init(vm);
+		vm_compile(vm, ast, context);
+		if (options.dump)
+			vm_dump(vm, stdout);
+		else if (options.bench)
+			vm_bench(vm, context);
+		else if (options.pairs)
+			vm_pairs(vm, context, stdout);
+		else
+			vm_run(vm, context);
+		vm_free(vm);
+	} else if (options.engine == engine_jit) {
+		jit_t jit[1];
+
+		jit_init(jit);
+		jit_compile(jit, ast, context);
+		jit_run(jit, ast, context);
+		jit_free(jit);
+	} else if (options.engine == engine_closure) {
+		closure_t cl[1];
+
+		closure_init(cl);
+		closure_compile(cl, ast, context);
+		closure_run(cl, context);
+		closure_free(cl);
+	} else if (options.engine == engine_tier) {
+		tier_stats_t tier_stats = { 0 };
+
+		tier_run(ast, context, &options.tier, &tier_stats);
+		if (options.stats)
+			tier_report(&tier_stats, stderr);
+	} else {
+		ast_exec(ast, context);
+	}
+
+	ast_free(ast);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -227,8 +423,69 @@ main(int argc, char *argv[])
 	int is_cli_mode = 1;
 	FILE *instream;
 
-	for (int option; (option = getopt(argc, argv, "hv")) != -1;) {
+	options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	options.level = 2;
+	options.tier.calls = TIER_CALLS;
+	options.tier.loops = TIER_LOOPS;
+
+	for (int option;
+	     (option = getopt(argc, argv, "e:dbplj:c:St:O:P:L:sihv")) != -1;) {
 		switch (option) {
+		case 'e':
+			if (!strcmp(optarg, "ast")) {
+				options.engine = engine_ast;
+			} else if (!strcmp(optarg, "vm")) {
+				options.engine = engine_vm;
+			} else if (!strcmp(optarg, "jit")) {
+				options.engine = engine_jit;
+			} else if (!strcmp(optarg, "closure")) {
+				options.engine = engine_closure;
+			} else if (!strcmp(optarg, "tier")) {
+				options.engine = engine_tier;
+			} else {
+				fprintf(stderr, "unknown engine: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			options.dump = true;
+			break;
+		case 'b':
+			options.bench = true;
+			break;
+		case 'p':
+			options.pairs = true;
+			break;
+		case 'l':
+			options.lex_bench = true;
+			break;
+		case 'j':
+			options.threads = atoi(optarg);
+			break;
+		case 'c':
+			options.output = optarg;
+			break;
+		case 'S':
+			options.asm_only = true;
+			break;
+		case 't':
+			options.c_output = optarg;
+			break;
+		case 'O':
+			options.level = atoi(optarg);
+			break;
+		case 'P':
+			options.tier.calls = atol(optarg);
+			break;
+		case 'L':
+			options.tier.loops = atol(optarg);
+			break;
+		case 's':
+			options.stats = true;
+			break;
+		case 'i':
+			options.ir_dump = true;
+			break;
 		case 'v':
 			print_version();
 			break;
@@ -243,12 +500,16 @@ main(int argc, char *argv[])
 	infile = argv[optind];
 	if (infile) {
 		is_cli_mode = 0;
-		if (!(instream = fopen(infile, "r")))
+		if (!(instream = fopen(infile, "r"))) {
 			perror(infile);
+			return 1;
+		}
 	}
 
 	if (is_cli_mode)
 		cli_run();
+	else
+		file_run(instream);
 
 	return 0;
 }
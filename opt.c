@@ -0,0 +1,1663 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "opt.h"
+#include "ir.h"
+#include "arith.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* State of the passes */
+typedef struct {
+	ast_t *ast;
+	context_t *context;
+	opt_stats_t *stats;
+} opt_t;
+
+static void *
+opt_alloc(const opt_t *o, size_t num, size_t size)
+{
+	void *p = calloc(num, size);
+
+	if (!p) {
+		sprintf(context_top_restrict(o->context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	return p;
+}
+
+/* Make room for one more element of an arena array of the tree */
+static void *
+opt_grow(const opt_t *o, void *array, int num, int *cap, size_t size)
+{
+	if (num < *cap)
+		return array;
+
+	*cap = *cap ? *cap * 2 : 0x100;
+	if (!(array = realloc(array, *cap * size))) {
+		sprintf(context_top_restrict(o->context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	return array;
+}
+
+/* Append a copy of node k, outside of any list */
+static int
+opt_node(opt_t *o, int k)
+{
+	ast_t *ast = o->ast;
+
+	ast->nodes = opt_grow(o, ast->nodes, ast->node_num, &ast->node_cap,
+			      sizeof(node_t));
+	ast->nodes[ast->node_num] = ast->nodes[k];
+	ast->nodes[ast->node_num].next = 0;
+	return ast->node_num++;
+}
+
+/* Turn node n into a read of variable sym */
+static void
+opt_use(ast_t *ast, int n, int sym)
+{
+	node_t *node = ast->nodes + n;
+	const ast_sym_t *s = ast->syms + sym;
+
+	node->type = ast_var;
+	node->sym = sym;
+	node->depth = ast->blocks[s->block].depth;
+	node->slot = s->slot;
+	node->kid[0] = node->kid[1] = 0;
+}
+
+/* New variable of block b, its name cannot be spelled in PL/0 */
+static int
+opt_temp(opt_t *o, int b)
+{
+	ast_t *ast = o->ast;
+	ast_block_t *block = ast->blocks + b;
+	char name[32];
+	int len = snprintf(name, sizeof(name), "_t%d", ast->sym_num);
+	ast_sym_t *sym;
+
+	ast->syms = opt_grow(o, ast->syms, ast->sym_num, &ast->sym_cap,
+			     sizeof(ast_sym_t));
+	sym = ast->syms + ast->sym_num;
+	if ((sym->name_id = intern(name, len)) < 0) {
+		sprintf(context_top_restrict(o->context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	sym->type = variable;
+	sym->value = 0;
+	sym->block = b;
+	sym->slot = block->nvars++;
+	sym->scope_next = block->syms;
+	sym->shadow = -1;
+	block->syms = ast->sym_num;
+	o->stats->temps++;
+	return ast->sym_num++;
+}
+
+/* Nodes x and y compute the same value */
+static bool
+opt_same(const ast_t *ast, int x, int y)
+{
+	const node_t *a = ast->nodes + x, *b = ast->nodes + y;
+
+	if (a->type != b->type)
+		return false;
+
+	switch (a->type) {
+	case ast_num:
+		return a->num == b->num;
+	case ast_var:
+		return a->depth == b->depth && a->slot == b->slot;
+	case ast_neg:
+	case ast_odd:
+		return opt_same(ast, a->kid[0], b->kid[0]);
+	case ast_binop:
+	case ast_cond:
+		return a->op == b->op && opt_same(ast, a->kid[0], b->kid[0]) &&
+		       opt_same(ast, a->kid[1], b->kid[1]);
+	default:
+		return false;
+	}
+}
+
+/* Node n is a number or a variable */
+static bool
+opt_leaf(const ast_t *ast, int n)
+{
+	return ast->nodes[n].type == ast_num || ast->nodes[n].type == ast_var;
+}
+
+long
+opt_operation(SYMBOL op, long m, long n)
+{
+	switch (op) {
+	case plus:
+		return arith_add(m, n);
+	case minus:
+		return arith_sub(m, n);
+	case times:
+		return arith_mul(m, n);
+	case slash:
+		return m / n;
+	case percent:
+		return m % n;
+	case eql:
+		return m == n;
+	case neq:
+		return m != n;
+	case lss:
+		return m < n;
+	case leq:
+		return m <= n;
+	case gtr:
+		return m > n;
+	case geq:
+	default:
+		return m >= n;
+	}
+}
+
+bool
+opt_divisible(long m, long n)
+{
+	return arith_divisible(m, n);
+}
+
+/* Turn node n into number v */
+static void
+fold_num(opt_t *o, int n, long v)
+{
+	node_t *node = o->ast->nodes + n;
+
+	o->stats->folded++;
+	node->type = ast_num;
+	node->num = v;
+	node->kid[0] = node->kid[1] = 0;
+}
+
+/* Replace node n with its kid k, keeping its place in a list */
+static void
+fold_replace(ast_t *ast, int n, int k)
+{
+	int next = ast->nodes[n].next;
+
+	ast->nodes[n] = ast->nodes[k];
+	ast->nodes[n].next = next;
+}
+
+/* Node n is a number of value v */
+static bool
+fold_is(const ast_t *ast, int n, long v)
+{
+	return ast->nodes[n].type == ast_num && ast->nodes[n].num == v;
+}
+
+/* Evaluating node n cannot end the program, so it may be dropped */
+static bool
+fold_pure(const ast_t *ast, int n)
+{
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_num:
+	case ast_var:
+		return true;
+	case ast_neg:
+	case ast_odd:
+		return fold_pure(ast, node->kid[0]);
+	case ast_binop:
+	case ast_cond:
+		if ((node->op == slash || node->op == percent) &&
+		    (ast->nodes[node->kid[1]].type != ast_num ||
+		     !opt_divisible(LONG_MIN, ast->nodes[node->kid[1]].num)))
+			return false;
+		return fold_pure(ast, node->kid[0]) &&
+		       fold_pure(ast, node->kid[1]);
+	default:
+		return false;
+	}
+}
+
+/**
+ * a / b * b or b * (a / b) => a - a % b, of a number or variable a and
+ * b, so that a remainder takes a single division. C division truncates
+ * and (a / b) * b + a % b = a, a division by zero still fails there.
+*/
+static bool
+fold_remainder(opt_t *o, int n)
+{
+	ast_t *ast = o->ast;
+
+	for (int i = 0; i < 2; i++) {
+		const node_t *node = ast->nodes + n;
+		const node_t *div = ast->nodes + node->kid[i];
+		int b = node->kid[!i], k = node->kid[i], a;
+
+		if (div->type != ast_binop || div->op != slash ||
+		    !opt_leaf(ast, div->kid[0]) || !opt_leaf(ast, b) ||
+		    !opt_same(ast, div->kid[1], b))
+			continue;
+		a = opt_node(o, div->kid[0]);
+		ast->nodes[k].op = percent;
+		ast->nodes[n].op = minus;
+		ast->nodes[n].kid[0] = a;
+		ast->nodes[n].kid[1] = k;
+		o->stats->reduced++;
+		return true;
+	}
+	return false;
+}
+
+static void fold_expression(opt_t *o, int n);
+
+/**
+ * Simplify binop n with folded operands. A constant goes right, where
+ * constants of chained + - and * meet and get folded together.
+*/
+static void
+fold_binop(opt_t *o, int n)
+{
+	ast_t *ast = o->ast;
+	node_t *node = ast->nodes + n;
+	node_t *lhs = ast->nodes + node->kid[0];
+	node_t *rhs = ast->nodes + node->kid[1];
+	SYMBOL op = node->op;
+
+	if (lhs->type == ast_num && rhs->type != ast_num &&
+	    (op == plus || op == times)) {
+		int k = node->kid[0];
+
+		node->kid[0] = node->kid[1];
+		node->kid[1] = k;
+		lhs = ast->nodes + node->kid[0];
+		rhs = ast->nodes + node->kid[1];
+	}
+
+	if (op == times && fold_remainder(o, n))
+		return;
+
+	if (rhs->type != ast_num)
+		return;
+
+	/* (a + c1) - c2 => a + (c1 - c2), (a * c1) * c2 => a * (c1 * c2) */
+	if (lhs->type == ast_binop && ast->nodes[lhs->kid[1]].type == ast_num) {
+		long c = ast->nodes[lhs->kid[1]].num;
+
+		if ((op == plus || op == minus) &&
+		    (lhs->op == plus || lhs->op == minus)) {
+			if (lhs->op == minus)
+				c = opt_operation(minus, 0, c);
+			rhs->num = opt_operation(op, c, rhs->num);
+			node->op = op = plus;
+			node->kid[0] = lhs->kid[0];
+		} else if (op == times && lhs->op == times) {
+			rhs->num = opt_operation(times, c, rhs->num);
+			node->kid[0] = lhs->kid[0];
+		}
+		lhs = ast->nodes + node->kid[0];
+	}
+
+	/* x + 0, x - 0, x * 1, x / 1 => x */
+	if ((fold_is(ast, node->kid[1], 0) && (op == plus || op == minus)) ||
+	    (fold_is(ast, node->kid[1], 1) && (op == times || op == slash))) {
+		fold_replace(ast, n, node->kid[0]);
+		return;
+	}
+	/* x * 0 => 0, unless x may end the program */
+	if (fold_is(ast, node->kid[1], 0) && op == times &&
+	    fold_pure(ast, node->kid[0]))
+		fold_num(o, n, 0);
+}
+
+/* a - b = a => b = 0, likewise for #, so a / b * b = a tests a % b */
+static void
+fold_cond(opt_t *o, int n)
+{
+	ast_t *ast = o->ast;
+	node_t *node = ast->nodes + n;
+
+	if (node->op != eql && node->op != neq)
+		return;
+
+	for (int i = 0; i < 2; i++) {
+		const node_t *diff = ast->nodes + node->kid[i];
+		int a = node->kid[!i];
+
+		if (diff->type != ast_binop || diff->op != minus ||
+		    !opt_leaf(ast, a) || !opt_same(ast, diff->kid[0], a))
+			continue;
+		node->kid[0] = diff->kid[1];
+		node->kid[1] = a;
+		ast->nodes[a].type = ast_num;
+		ast->nodes[a].num = 0;
+		o->stats->reduced++;
+		return;
+	}
+}
+
+/**
+ * Fold expression n. Folding may append nodes and move the arena, so
+ * nodes are looked up again after each call.
+*/
+static void
+fold_expression(opt_t *o, int n)
+{
+	ast_t *ast = o->ast;
+	const node_t *node = ast->nodes + n;
+	const node_t *lhs, *rhs;
+
+	switch (node->type) {
+	case ast_neg:
+		fold_expression(o, node->kid[0]);
+		node = ast->nodes + n;
+		lhs = ast->nodes + node->kid[0];
+		if (lhs->type == ast_num)
+			fold_num(o, n, opt_operation(minus, 0, lhs->num));
+		else if (lhs->type == ast_neg)
+			fold_replace(ast, n, lhs->kid[0]);
+		break;
+	case ast_odd:
+		fold_expression(o, node->kid[0]);
+		node = ast->nodes + n;
+		lhs = ast->nodes + node->kid[0];
+		if (lhs->type == ast_num)
+			fold_num(o, n, lhs->num % 2 != 0);
+		break;
+	case ast_binop:
+	case ast_cond:
+		fold_expression(o, node->kid[0]);
+		fold_expression(o, ast->nodes[n].kid[1]);
+		node = ast->nodes + n;
+		lhs = ast->nodes + node->kid[0];
+		rhs = ast->nodes + node->kid[1];
+		if (lhs->type == ast_num && rhs->type == ast_num &&
+		    ((node->op != slash && node->op != percent) ||
+		     opt_divisible(lhs->num, rhs->num)))
+			fold_num(o, n,
+				 opt_operation(node->op, lhs->num, rhs->num));
+		else if (node->type == ast_binop)
+			fold_binop(o, n);
+		else
+			fold_cond(o, n);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Fold statement n, return what replaces it, 0 for nothing */
+static int
+fold_statement(opt_t *o, int n)
+{
+	ast_t *ast = o->ast;
+	int k, tail;
+
+	switch (ast->nodes[n].type) {
+	case ast_assign:
+		fold_expression(o, ast->nodes[n].kid[0]);
+		break;
+	case ast_write:
+		for (k = ast->nodes[n].kid[0]; k; k = ast->nodes[k].next)
+			fold_expression(o, k);
+		break;
+	case ast_begin:
+		/* Relink statements left */
+		tail = 0;
+		for (int s = ast->nodes[n].kid[0], next; s; s = next) {
+			next = ast->nodes[s].next;
+			if (!(k = fold_statement(o, s)))
+				continue;
+			if (tail)
+				ast->nodes[tail].next = k;
+			else
+				ast->nodes[n].kid[0] = k;
+			tail = k;
+		}
+		if (!tail)
+			return 0;
+		ast->nodes[tail].next = 0;
+		break;
+	case ast_if:
+	case ast_while:
+		fold_expression(o, ast->nodes[n].kid[0]);
+		k = fold_statement(o, ast->nodes[n].kid[1]);
+		ast->nodes[n].kid[1] = k;
+
+		const node_t *node = ast->nodes + n;
+		const node_t *cond = ast->nodes + node->kid[0];
+		if (cond->type != ast_num ||
+		    (cond->num && node->type == ast_while))
+			break;
+		/* Statement under a constant condition of if */
+		o->stats->branches++;
+		return cond->num ? node->kid[1] : 0;
+	default:
+		break;
+	}
+
+	return n;
+}
+
+void
+opt_fold(ast_t *ast, context_t *context, opt_stats_t *stats)
+{
+	opt_t o = { .ast = ast, .context = context, .stats = stats };
+
+	for (int b = 0; b < ast->block_num; b++)
+		ast->blocks[b].body = fold_statement(&o, ast->blocks[b].body);
+}
+
+/* Mark blocks called from statement n as live, and what they call */
+static void
+dead_calls(const opt_t *o, bool *live, int n)
+{
+	const ast_t *ast = o->ast;
+	const node_t *node = ast->nodes + n;
+	int block;
+
+	switch (node->type) {
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		if (!live[block]) {
+			live[block] = true;
+			dead_calls(o, live, ast->blocks[block].body);
+		}
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			dead_calls(o, live, n);
+		break;
+	case ast_if:
+	case ast_while:
+		dead_calls(o, live, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Drop blocks of procedures never called from the main program, and
+ * number the blocks left in order.
+*/
+static void
+dead_blocks(opt_t *o)
+{
+	ast_t *ast = o->ast;
+	bool *live = opt_alloc(o, ast->block_num, sizeof(bool));
+	int *map = opt_alloc(o, ast->block_num, sizeof(int));
+	int num = 0;
+
+	live[0] = true;
+	dead_calls(o, live, ast->blocks[0].body);
+
+	for (int b = 0; b < ast->block_num; b++) {
+		if (!live[b]) {
+			map[b] = -1;
+			continue;
+		}
+		map[b] = num;
+		ast->blocks[num++] = ast->blocks[b];
+	}
+	/* Later runs count what earlier runs left */
+	o->stats->procs_dropped += ast->block_num - num;
+	o->stats->procs = num - 1 + o->stats->procs_dropped;
+	ast->block_num = num;
+
+	/* Enclosing block of a live procedure is live too */
+	for (int b = 1; b < ast->block_num; b++)
+		ast->blocks[b].parent = map[ast->blocks[b].parent];
+	for (int s = 0; s < ast->sym_num; s++) {
+		if (ast->syms[s].block != -1)
+			ast->syms[s].block = map[ast->syms[s].block];
+	}
+
+	/* Procedures dropped are no longer declared */
+	for (int b = 0; b < ast->block_num; b++) {
+		int *s = &ast->blocks[b].syms;
+
+		while (*s != -1) {
+			ast_sym_t *sym = ast->syms + *s;
+
+			if (sym->type == procvar && sym->block == -1)
+				*s = sym->scope_next;
+			else
+				s = &sym->scope_next;
+		}
+	}
+
+	free(live);
+	free(map);
+}
+
+/* Count reads of each variable by expression n */
+static void
+dead_reads(const opt_t *o, int *reads, int n)
+{
+	const node_t *node = o->ast->nodes + n;
+
+	switch (node->type) {
+	case ast_var:
+		reads[node->sym]++;
+		break;
+	case ast_neg:
+	case ast_odd:
+		dead_reads(o, reads, node->kid[0]);
+		break;
+	case ast_binop:
+	case ast_cond:
+		dead_reads(o, reads, node->kid[0]);
+		dead_reads(o, reads, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Count reads of each variable by statement n */
+static void
+dead_uses(const opt_t *o, int *reads, int n)
+{
+	const ast_t *ast = o->ast;
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_assign:
+		dead_reads(o, reads, node->kid[0]);
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			dead_reads(o, reads, n);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			dead_uses(o, reads, n);
+		break;
+	case ast_if:
+	case ast_while:
+		dead_reads(o, reads, node->kid[0]);
+		dead_uses(o, reads, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Drop assignments of pure values to variables never read, and
+ * statements after a loop that never ends. Return what replaces
+ * statement n, 0 for nothing.
+*/
+static int
+dead_statement(opt_t *o, const int *reads, int n)
+{
+	ast_t *ast = o->ast;
+	node_t *node = ast->nodes + n;
+	int k, tail;
+
+	switch (node->type) {
+	case ast_assign:
+		if (reads[node->sym] || !fold_pure(ast, node->kid[0]))
+			break;
+		o->stats->stores++;
+		return 0;
+	case ast_begin:
+		tail = 0;
+		for (int s = node->kid[0], next; s; s = next) {
+			next = ast->nodes[s].next;
+			if (!(k = dead_statement(o, reads, s)))
+				continue;
+			if (tail)
+				ast->nodes[tail].next = k;
+			else
+				node->kid[0] = k;
+			tail = k;
+
+			/**
+			 * Only a runtime error leaves while of a true
+			 * constant, drop statements after it.
+			*/
+			if (ast->nodes[k].type == ast_while &&
+			    ast->nodes[ast->nodes[k].kid[0]].type == ast_num) {
+				for (; next; next = ast->nodes[next].next)
+					o->stats->unreachable++;
+			}
+		}
+		if (!tail)
+			return 0;
+		ast->nodes[tail].next = 0;
+		break;
+	case ast_if:
+		node->kid[1] = dead_statement(o, reads, node->kid[1]);
+		if (!node->kid[1] && fold_pure(ast, node->kid[0]))
+			return 0;
+		break;
+	case ast_while:
+		node->kid[1] = dead_statement(o, reads, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+
+	return n;
+}
+
+void
+opt_dead(ast_t *ast, context_t *context, opt_stats_t *stats)
+{
+	opt_t o = { .ast = ast, .context = context, .stats = stats };
+	int *reads = opt_alloc(&o, ast->sym_num, sizeof(int));
+	int stores;
+
+	dead_blocks(&o);
+
+	/* Dropping a store may leave variables of its value unread */
+	do {
+		stores = stats->stores;
+		memset(reads, 0, ast->sym_num * sizeof(int));
+		for (int b = 0; b < ast->block_num; b++)
+			dead_uses(&o, reads, ast->blocks[b].body);
+		for (int b = 0; b < ast->block_num; b++) {
+			ast_block_t *block = ast->blocks + b;
+			block->body = dead_statement(&o, reads, block->body);
+		}
+	} while (stores != stats->stores);
+
+	free(reads);
+}
+
+void
+opt_report(const opt_stats_t *stats, FILE *stream)
+{
+	fprintf(stream,
+		"opt: %d expressions folded into numbers\n"
+		"opt: %d if and while statements of constant conditions\n"
+		"opt: %d of %d procedures never called\n"
+		"opt: %d assignments to variables never read\n"
+		"opt: %d statements after loops never ending\n"
+		"opt: %d loop invariant expressions hoisted\n"
+		"opt: %d multiplications and divisions reduced\n"
+		"opt: %d variables added\n"
+		"opt: %d calls inlined\n"
+		"opt: %d SSA copies propagated\n"
+		"opt: %d SSA values numbered as earlier ones\n"
+		"opt: %d expressions found constant\n"
+		"opt: %d expressions read from variables holding them\n",
+		stats->folded, stats->branches, stats->procs_dropped,
+		stats->procs, stats->stores, stats->unreachable,
+		stats->hoisted, stats->reduced, stats->temps, stats->inlined,
+		stats->copies, stats->numbered, stats->constants,
+		stats->reused);
+}
+
+/* How a loop writes a variable */
+enum { loop_none, loop_step, loop_write };
+
+/* State of the loop pass, for the loop being optimized */
+typedef struct {
+	opt_t *o;
+	/* Block of the loop, where temporaries go */
+	int block;
+	/**
+	 * Kind of write of each symbol by the loop, valid only if its
+	 * stamp is the one of the loop. Same for blocks called by it.
+	*/
+	int stamp;
+	int *sym_stamp;
+	char *kind;
+	int kind_cap;
+	int *seen;
+	/* Assignments of induction variables by a constant step */
+	int *steps;
+	int step_num;
+	int step_cap;
+	/* Multiplications of an induction variable */
+	int *muls;
+	int mul_num;
+	int mul_cap;
+	/* Statements to run ahead of the loop */
+	int *pre;
+	int pre_num;
+	int pre_cap;
+	/* Invariants hoisted, each assigned by a statement of pre */
+	int *inv;
+	int inv_num;
+	int inv_cap;
+} loop_t;
+
+/* Append a zeroed node */
+static int
+loop_node(loop_t *l, NODE type, pos_t pos)
+{
+	ast_t *ast = l->o->ast;
+	node_t *node;
+
+	ast->nodes = opt_grow(l->o, ast->nodes, ast->node_num,
+			      &ast->node_cap, sizeof(node_t));
+	node = ast->nodes + ast->node_num;
+	memset(node, 0, sizeof(node_t));
+	node->type = type;
+	node->pos = pos;
+	return ast->node_num++;
+}
+
+/* Copy of expression n, sharing no node with it */
+static int
+loop_copy(loop_t *l, int n)
+{
+	int k = opt_node(l->o, n);
+	int kid;
+
+	for (int i = 0; i < 2; i++) {
+		if ((kid = l->o->ast->nodes[k].kid[i])) {
+			kid = loop_copy(l, kid);
+			l->o->ast->nodes[k].kid[i] = kid;
+		}
+	}
+	return k;
+}
+
+/* Turn node n into a use of variable sym */
+static void
+loop_use(loop_t *l, int n, int sym)
+{
+	opt_use(l->o->ast, n, sym);
+}
+
+/* Kind of write of sym by the loop */
+static int
+loop_kind(const loop_t *l, int sym)
+{
+	return l->sym_stamp[sym] == l->stamp ? l->kind[sym] : loop_none;
+}
+
+static void
+loop_mark(loop_t *l, int sym, int kind)
+{
+	if (loop_kind(l, sym) >= kind)
+		return;
+	l->sym_stamp[sym] = l->stamp;
+	l->kind[sym] = kind;
+}
+
+/* Make room for kinds of every symbol */
+static void
+loop_kinds(loop_t *l)
+{
+	int num = l->o->ast->sym_cap;
+
+	if (num <= l->kind_cap)
+		return;
+	l->sym_stamp = realloc(l->sym_stamp, num * sizeof(int));
+	l->kind = realloc(l->kind, num);
+	if (!l->sym_stamp || !l->kind) {
+		sprintf(context_top_restrict(l->o->context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	memset(l->sym_stamp + l->kind_cap, 0,
+	       (num - l->kind_cap) * sizeof(int));
+	l->kind_cap = num;
+}
+
+/**
+ * New variable of the block of the loop, holding a value across
+ * iterations.
+*/
+static int
+loop_temp(loop_t *l)
+{
+	int temp = opt_temp(l->o, l->block);
+
+	/* Written by the loop, so nothing using it is invariant */
+	loop_kinds(l);
+	loop_mark(l, temp, loop_write);
+	return temp;
+}
+
+/* Queue temp := n ahead of the loop, n becomes its value */
+static void
+loop_pre(loop_t *l, int temp, int n, pos_t pos)
+{
+	int k = loop_node(l, ast_assign, pos);
+
+	loop_use(l, k, temp);
+	l->o->ast->nodes[k].type = ast_assign;
+	l->o->ast->nodes[k].kid[0] = n;
+	l->pre = opt_grow(l->o, l->pre, l->pre_num, &l->pre_cap, sizeof(int));
+	l->pre[l->pre_num++] = k;
+}
+
+/* Assignment n is var := var + number or var := var - number */
+static bool
+loop_is_step(const ast_t *ast, int n)
+{
+	const node_t *node = ast->nodes + n;
+	const node_t *rhs = ast->nodes + node->kid[0];
+
+	return rhs->type == ast_binop && (rhs->op == plus || rhs->op == minus) &&
+	       ast->nodes[rhs->kid[0]].type == ast_var &&
+	       ast->nodes[rhs->kid[0]].sym == node->sym &&
+	       ast->nodes[rhs->kid[1]].type == ast_num;
+}
+
+/**
+ * Mark variables written by statement n. Only writes of the loop
+ * itself, not of procedures it calls, may be steps.
+*/
+static void
+loop_writes(loop_t *l, int n, bool direct)
+{
+	const ast_t *ast = l->o->ast;
+	const node_t *node = ast->nodes + n;
+	int block;
+
+	switch (node->type) {
+	case ast_assign:
+		if (direct && loop_is_step(ast, n)) {
+			loop_mark(l, node->sym, loop_step);
+			l->steps = opt_grow(l->o, l->steps, l->step_num,
+					    &l->step_cap, sizeof(int));
+			l->steps[l->step_num++] = n;
+		} else {
+			loop_mark(l, node->sym, loop_write);
+		}
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			loop_mark(l, ast->nodes[n].sym, loop_write);
+		break;
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		if (l->seen[block] != l->stamp) {
+			l->seen[block] = l->stamp;
+			loop_writes(l, ast->blocks[block].body, false);
+		}
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			loop_writes(l, n, direct);
+		break;
+	case ast_if:
+	case ast_while:
+		loop_writes(l, node->kid[1], direct);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Value of expression n is the same in every iteration */
+static bool
+loop_invariant(const loop_t *l, int n)
+{
+	const node_t *node = l->o->ast->nodes + n;
+
+	switch (node->type) {
+	case ast_num:
+		return true;
+	case ast_var:
+		return loop_kind(l, node->sym) == loop_none;
+	case ast_neg:
+	case ast_odd:
+		return loop_invariant(l, node->kid[0]);
+	case ast_binop:
+	case ast_cond:
+		return loop_invariant(l, node->kid[0]) &&
+		       loop_invariant(l, node->kid[1]);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Induction variable of multiplication n, whose other operand is a
+ * number or an invariant variable, -1 if none.
+*/
+static int
+loop_mul_var(const loop_t *l, int n, int *by)
+{
+	const ast_t *ast = l->o->ast;
+	const node_t *node = ast->nodes + n;
+
+	if (node->type != ast_binop || node->op != times)
+		return -1;
+
+	for (int i = 0; i < 2; i++) {
+		const node_t *var = ast->nodes + node->kid[i];
+
+		*by = node->kid[!i];
+		if (var->type == ast_var &&
+		    loop_kind(l, var->sym) == loop_step &&
+		    opt_leaf(ast, *by) && loop_invariant(l, *by))
+			return var->sym;
+	}
+	return -1;
+}
+
+/* Collect multiplications of induction variables in expression n */
+static void
+loop_find_muls(loop_t *l, int n)
+{
+	const node_t *node = l->o->ast->nodes + n;
+	int by;
+
+	if (loop_mul_var(l, n, &by) != -1) {
+		l->muls = opt_grow(l->o, l->muls, l->mul_num, &l->mul_cap,
+				   sizeof(int));
+		l->muls[l->mul_num++] = n;
+		return;
+	}
+	if (node->kid[0] && node->type != ast_none)
+		loop_find_muls(l, node->kid[0]);
+	if (node->kid[1] && node->type != ast_none)
+		loop_find_muls(l, node->kid[1]);
+}
+
+/* Apply f to every expression of statement n */
+static void
+loop_expressions(loop_t *l, int n, void (*f)(loop_t *, int))
+{
+	const ast_t *ast = l->o->ast;
+	int kid;
+
+	switch (ast->nodes[n].type) {
+	case ast_assign:
+		f(l, ast->nodes[n].kid[0]);
+		break;
+	case ast_write:
+		for (kid = ast->nodes[n].kid[0]; kid; kid = ast->nodes[kid].next)
+			f(l, kid);
+		break;
+	case ast_begin:
+		for (kid = ast->nodes[n].kid[0]; kid; kid = ast->nodes[kid].next)
+			loop_expressions(l, kid, f);
+		break;
+	case ast_if:
+	case ast_while:
+		f(l, ast->nodes[n].kid[0]);
+		loop_expressions(l, ast->nodes[n].kid[1], f);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Replace i * c of induction variable i by a temporary t, with
+ * t := i * c ahead of the loop and t := t + k * c after each i := i + k.
+ * Worth it only if the product is used at least as often as i steps.
+*/
+static void
+loop_reduce(loop_t *l, int n)
+{
+	ast_t *ast = l->o->ast;
+	int loop = n;
+
+	l->mul_num = 0;
+	loop_find_muls(l, ast->nodes[loop].kid[0]);
+	loop_expressions(l, ast->nodes[loop].kid[1], loop_find_muls);
+
+	for (int m = 0; m < l->mul_num; m++) {
+		int by, var = loop_mul_var(l, l->muls[m], &by);
+		int uses = 0, steps = 0, by2;
+		bool unit = true;
+
+		if (var == -1)
+			continue;
+		for (int u = m; u < l->mul_num; u++) {
+			if (loop_mul_var(l, l->muls[u], &by2) == var &&
+			    opt_same(ast, by, by2))
+				uses++;
+		}
+		for (int s = 0; s < l->step_num; s++) {
+			const node_t *step = ast->nodes + l->steps[s];
+			long k = ast->nodes[ast->nodes[step->kid[0]].kid[1]].num;
+
+			if (step->sym != var)
+				continue;
+			steps++;
+			unit &= k == 1 || k == -1;
+		}
+		if (uses < steps ||
+		    (ast->nodes[by].type != ast_num && !unit))
+			continue;
+
+		/* t := i * c ahead of the loop */
+		int t = loop_temp(l);
+		loop_pre(l, t, loop_copy(l, l->muls[m]),
+			 ast->nodes[loop].pos);
+
+		/* t := t + k * c after each i := i + k */
+		for (int s = 0; s < l->step_num; s++) {
+			int step = l->steps[s];
+			int rhs = ast->nodes[step].kid[0];
+			long k = ast->nodes[ast->nodes[rhs].kid[1]].num;
+			SYMBOL op = ast->nodes[rhs].op;
+			pos_t pos = ast->nodes[step].pos;
+			int add, lhs, c, copy, update;
+
+			if (ast->nodes[step].sym != var)
+				continue;
+			if (ast->nodes[by].type == ast_num) {
+				c = loop_node(l, ast_num, pos);
+				k = opt_operation(times, k, ast->nodes[by].num);
+				ast->nodes[c].num = k;
+			} else {
+				c = loop_copy(l, by);
+				op = (op == plus) == (k == 1) ? plus : minus;
+			}
+			lhs = loop_node(l, ast_var, pos);
+			loop_use(l, lhs, t);
+			add = loop_node(l, ast_binop, pos);
+			ast->nodes[add].op = op;
+			ast->nodes[add].kid[0] = lhs;
+			ast->nodes[add].kid[1] = c;
+
+			/* Step becomes begin step; update end, in place */
+			copy = opt_node(l->o, step);
+			update = loop_node(l, ast_assign, pos);
+			loop_use(l, update, t);
+			ast->nodes[update].type = ast_assign;
+			ast->nodes[update].kid[0] = add;
+			ast->nodes[copy].next = update;
+			ast->nodes[step].type = ast_begin;
+			ast->nodes[step].kid[0] = copy;
+			ast->nodes[step].kid[1] = 0;
+			l->steps[s] = copy;
+		}
+
+		/* Uses of i * c read t */
+		for (int u = l->mul_num - 1; u >= m; u--) {
+			int use = l->muls[u];
+
+			if (ast->nodes[use].type != ast_binop ||
+			    loop_mul_var(l, use, &by2) != var ||
+			    !opt_same(ast, by, by2))
+				continue;
+			loop_use(l, use, t);
+		}
+		l->o->stats->reduced++;
+	}
+}
+
+/* Hoist invariant subexpressions of expression n ahead of the loop */
+static void
+loop_hoist(loop_t *l, int n)
+{
+	ast_t *ast = l->o->ast;
+	int k, t;
+
+	/* Conditions stay where they are, their operands may go */
+	switch (ast->nodes[n].type) {
+	case ast_neg:
+	case ast_binop:
+		break;
+	case ast_odd:
+		loop_hoist(l, ast->nodes[n].kid[0]);
+		return;
+	case ast_cond:
+		loop_hoist(l, ast->nodes[n].kid[0]);
+		loop_hoist(l, ast->nodes[n].kid[1]);
+		return;
+	default:
+		return;
+	}
+
+	if (!loop_invariant(l, n) || !fold_pure(ast, n)) {
+		loop_hoist(l, ast->nodes[n].kid[0]);
+		if (ast->nodes[n].kid[1])
+			loop_hoist(l, ast->nodes[n].kid[1]);
+		return;
+	}
+
+	/* Same value hoisted before */
+	for (int i = 0; i < l->inv_num; i++) {
+		const node_t *pre = ast->nodes + l->inv[i];
+
+		if (opt_same(ast, pre->kid[0], n)) {
+			loop_use(l, n, pre->sym);
+			l->o->stats->hoisted++;
+			return;
+		}
+	}
+
+	t = loop_temp(l);
+	k = opt_node(l->o, n);
+	loop_pre(l, t, k, ast->nodes[n].pos);
+	loop_use(l, n, t);
+
+	l->inv = opt_grow(l->o, l->inv, l->inv_num, &l->inv_cap, sizeof(int));
+	l->inv[l->inv_num++] = l->pre[l->pre_num - 1];
+	l->o->stats->hoisted++;
+}
+
+/* Optimize while statement n, whose inner loops are done */
+static void
+loop_optimize(loop_t *l, int n)
+{
+	ast_t *ast = l->o->ast;
+	int loop, k;
+
+	l->stamp++;
+	l->step_num = l->pre_num = l->inv_num = 0;
+	loop_kinds(l);
+	loop_writes(l, ast->nodes[n].kid[1], true);
+
+	loop_reduce(l, n);
+	loop_hoist(l, ast->nodes[n].kid[0]);
+	loop_expressions(l, ast->nodes[n].kid[1], loop_hoist);
+
+	if (!l->pre_num)
+		return;
+
+	/* Loop becomes begin pre; loop end, in place */
+	loop = opt_node(l->o, n);
+	for (int i = 0; i < l->pre_num; i++)
+		ast->nodes[l->pre[i]].next = i + 1 < l->pre_num ?
+							  l->pre[i + 1] : loop;
+	k = l->pre[0];
+	ast->nodes[n].type = ast_begin;
+	ast->nodes[n].kid[0] = k;
+	ast->nodes[n].kid[1] = 0;
+}
+
+/* Optimize loops of statement n, inner ones first */
+static void
+loop_statement(loop_t *l, int n)
+{
+	const ast_t *ast = l->o->ast;
+	int kid;
+
+	switch (ast->nodes[n].type) {
+	case ast_begin:
+		for (kid = ast->nodes[n].kid[0]; kid; kid = ast->nodes[kid].next)
+			loop_statement(l, kid);
+		break;
+	case ast_if:
+		loop_statement(l, ast->nodes[n].kid[1]);
+		break;
+	case ast_while:
+		loop_statement(l, ast->nodes[n].kid[1]);
+		loop_optimize(l, n);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+opt_loop(ast_t *ast, context_t *context, opt_stats_t *stats)
+{
+	opt_t o = { .ast = ast, .context = context, .stats = stats };
+	loop_t l = { .o = &o };
+
+	l.seen = opt_alloc(&o, ast->block_num, sizeof(int));
+	for (int b = 0; b < ast->block_num; b++) {
+		l.block = b;
+		loop_statement(&l, ast->blocks[b].body);
+	}
+
+	free(l.sym_stamp);
+	free(l.kind);
+	free(l.seen);
+	free(l.steps);
+	free(l.muls);
+	free(l.pre);
+	free(l.inv);
+}
+
+/* Procedures of at most this many nodes are inlined at every call */
+#define INLINE_SIZE 64
+
+/* State of the inliner */
+typedef struct {
+	opt_t *o;
+	/* Call sites of each block */
+	int *calls;
+	/* Blocks visited, and those calling themselves */
+	bool *done;
+	bool *recursive;
+	/* Scratch stamps of blocks */
+	int *seen;
+	int stamp;
+	/**
+	 * Variable standing for each local of the callee in the block
+	 * inlined into, valid if temp_stamp is that block + 1. Locals
+	 * assigned first by the callee, if assigned is of stamp.
+	*/
+	int *temp;
+	int *temp_stamp;
+	int *assigned;
+	int sym_cap;
+	/* Block inlined into and procedure inlined */
+	int block;
+	int callee;
+	/* Locals of the callee that must start at 0 */
+	int *zero;
+	int zero_num;
+	int zero_cap;
+	/* Locals marked assigned, to unmark past an if or while body */
+	int *marked;
+	int marked_num;
+	int marked_cap;
+} inline_t;
+
+/* Count call sites of statement n */
+static void
+inline_count(inline_t *in, int n)
+{
+	const ast_t *ast = in->o->ast;
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_call:
+		in->calls[ast->syms[node->sym].block]++;
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			inline_count(in, n);
+		break;
+	case ast_if:
+	case ast_while:
+		inline_count(in, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Statement n calls block b, directly or through other procedures */
+static bool
+inline_reaches(inline_t *in, int n, int b)
+{
+	const ast_t *ast = in->o->ast;
+	const node_t *node = ast->nodes + n;
+	int block;
+
+	switch (node->type) {
+	case ast_call:
+		block = ast->syms[node->sym].block;
+		if (block == b)
+			return true;
+		if (in->seen[block] == in->stamp)
+			return false;
+		in->seen[block] = in->stamp;
+		return inline_reaches(in, ast->blocks[block].body, b);
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			if (inline_reaches(in, n, b))
+				return true;
+		}
+		return false;
+	case ast_if:
+	case ast_while:
+		return inline_reaches(in, node->kid[1], b);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Statement n calls a procedure declared in block b, whose frame
+ * would be gone once b is inlined.
+*/
+static bool
+inline_nested(const ast_t *ast, int n, int b)
+{
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_call:
+		return ast->blocks[ast->syms[node->sym].block].parent == b;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			if (inline_nested(ast, n, b))
+				return true;
+		}
+		return false;
+	case ast_if:
+	case ast_while:
+		return inline_nested(ast, node->kid[1], b);
+	default:
+		return false;
+	}
+}
+
+/* Nodes of statement or expression n, up to INLINE_SIZE + 1 */
+static int
+inline_size(const ast_t *ast, int n)
+{
+	int size = 0;
+
+	for (; n && size <= INLINE_SIZE; n = ast->nodes[n].next) {
+		size++;
+		for (int i = 0; i < 2; i++) {
+			if (ast->nodes[n].kid[i] &&
+			    ast->nodes[n].type != ast_num &&
+			    ast->nodes[n].type != ast_var)
+				size += inline_size(ast, ast->nodes[n].kid[i]);
+		}
+	}
+	return size;
+}
+
+/* Make room for every symbol, inlining adds variables */
+static void
+inline_syms(inline_t *in)
+{
+	int num = in->o->ast->sym_cap, old = in->sym_cap;
+
+	if (num <= old)
+		return;
+	in->temp = realloc(in->temp, num * sizeof(int));
+	in->temp_stamp = realloc(in->temp_stamp, num * sizeof(int));
+	in->assigned = realloc(in->assigned, num * sizeof(int));
+	if (!in->temp || !in->temp_stamp || !in->assigned) {
+		sprintf(context_top_restrict(in->o->context)->message,
+			"Out of memory");
+		exit(1);
+	}
+	memset(in->temp_stamp + old, 0, (num - old) * sizeof(int));
+	memset(in->assigned + old, 0, (num - old) * sizeof(int));
+	in->sym_cap = num;
+}
+
+/* Variable sym of the callee reads or writes its local */
+static bool
+inline_local(const inline_t *in, int sym)
+{
+	return in->o->ast->syms[sym].block == in->callee;
+}
+
+/* Queue locals expression n reads, unless surely assigned before */
+static void
+inline_reads(inline_t *in, int n)
+{
+	const ast_t *ast = in->o->ast;
+	const node_t *node = ast->nodes + n;
+
+	switch (node->type) {
+	case ast_var:
+		if (!inline_local(in, node->sym) ||
+		    in->assigned[node->sym] == in->stamp)
+			return;
+		for (int i = 0; i < in->zero_num; i++) {
+			if (in->zero[i] == node->sym)
+				return;
+		}
+		in->zero = opt_grow(in->o, in->zero, in->zero_num,
+				    &in->zero_cap, sizeof(int));
+		in->zero[in->zero_num++] = node->sym;
+		break;
+	case ast_neg:
+	case ast_odd:
+		inline_reads(in, node->kid[0]);
+		break;
+	case ast_binop:
+	case ast_cond:
+		inline_reads(in, node->kid[0]);
+		inline_reads(in, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Queue reads of locals by statement n that may come first */
+static void
+inline_first_reads(inline_t *in, int n)
+{
+	const ast_t *ast = in->o->ast;
+	const node_t *node = ast->nodes + n;
+	int marked;
+
+	switch (node->type) {
+	case ast_assign:
+		inline_reads(in, node->kid[0]);
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			inline_reads(in, n);
+		break;
+	case ast_begin:
+		/* Assignments of the sequence itself surely happen */
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			inline_first_reads(in, n);
+			if (ast->nodes[n].type != ast_assign ||
+			    in->assigned[ast->nodes[n].sym] == in->stamp)
+				continue;
+			in->assigned[ast->nodes[n].sym] = in->stamp;
+			in->marked = opt_grow(in->o, in->marked, in->marked_num,
+					      &in->marked_cap, sizeof(int));
+			in->marked[in->marked_num++] = ast->nodes[n].sym;
+		}
+		break;
+	case ast_if:
+	case ast_while:
+		/**
+		 * Body may not run, so what it assigns is sure only
+		 * within it
+		*/
+		inline_reads(in, node->kid[0]);
+		marked = in->marked_num;
+		inline_first_reads(in, node->kid[1]);
+		while (in->marked_num > marked)
+			in->assigned[in->marked[--in->marked_num]] = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Variable of the block inlined into standing for local sym */
+static int
+inline_temp(inline_t *in, int sym)
+{
+	if (in->temp_stamp[sym] != in->block + 1) {
+		in->temp_stamp[sym] = in->block + 1;
+		in->temp[sym] = opt_temp(in->o, in->block);
+	}
+	return in->temp[sym];
+}
+
+/* Copy of the list starting at node n, locals of the callee remapped */
+static int
+inline_copy(inline_t *in, int n)
+{
+	ast_t *ast = in->o->ast;
+	int head = 0, tail = 0;
+
+	for (; n; n = ast->nodes[n].next) {
+		int k = opt_node(in->o, n), kid;
+
+		for (int i = 0; i < 2; i++) {
+			if (!ast->nodes[k].kid[i] ||
+			    ast->nodes[k].type == ast_num ||
+			    ast->nodes[k].type == ast_var)
+				continue;
+			kid = inline_copy(in, ast->nodes[k].kid[i]);
+			ast->nodes[k].kid[i] = kid;
+		}
+
+		node_t *node = ast->nodes + k;
+		if ((node->type == ast_var || node->type == ast_assign) &&
+		    inline_local(in, node->sym)) {
+			int temp = inline_temp(in, node->sym);
+
+			node->sym = temp;
+			node->depth = ast->blocks[in->block].depth;
+			node->slot = ast->syms[temp].slot;
+		} else if (node->type == ast_call) {
+			in->calls[ast->syms[node->sym].block]++;
+		}
+
+		if (tail)
+			ast->nodes[tail].next = k;
+		else
+			head = k;
+		tail = k;
+	}
+	return head;
+}
+
+/* Statement temp := 0 made from call n, ahead of statement next */
+static int
+inline_zero(inline_t *in, int n, int temp, int next)
+{
+	ast_t *ast = in->o->ast;
+	int k = opt_node(in->o, n), zero = opt_node(in->o, n);
+
+	ast->nodes[zero].type = ast_num;
+	ast->nodes[zero].num = 0;
+	opt_use(ast, k, temp);
+	ast->nodes[k].type = ast_assign;
+	ast->nodes[k].kid[0] = zero;
+	ast->nodes[k].next = next;
+	return k;
+}
+
+/**
+ * Replace call statement n by begin, locals read before they are
+ * assigned set to 0 like a new frame has them, then the body of the
+ * procedure.
+*/
+static void
+inline_call(inline_t *in, int n)
+{
+	ast_t *ast = in->o->ast;
+	int body = ast->blocks[in->callee].body;
+	int head;
+
+	inline_syms(in);
+	in->stamp++;
+	in->zero_num = 0;
+	in->marked_num = 0;
+	inline_first_reads(in, body);
+
+	head = inline_copy(in, body);
+	for (int i = in->zero_num - 1; i >= 0; i--)
+		head = inline_zero(in, n, inline_temp(in, in->zero[i]), head);
+
+	ast->nodes[n].type = ast_begin;
+	ast->nodes[n].kid[0] = head;
+	ast->nodes[n].kid[1] = 0;
+	in->calls[in->callee]--;
+	in->o->stats->inlined++;
+}
+
+static void inline_block(inline_t *in, int b);
+
+/* Inline calls of statement n of block b */
+static void
+inline_statement(inline_t *in, int b, int n)
+{
+	ast_t *ast = in->o->ast;
+	const node_t *node = ast->nodes + n;
+	int callee;
+
+	switch (node->type) {
+	case ast_call:
+		callee = ast->syms[node->sym].block;
+		inline_block(in, callee);
+		if (in->recursive[callee] ||
+		    inline_nested(ast, ast->blocks[callee].body, callee) ||
+		    (in->calls[callee] > 1 &&
+		     inline_size(ast, ast->blocks[callee].body) > INLINE_SIZE))
+			break;
+		in->block = b;
+		in->callee = callee;
+		inline_call(in, n);
+		/* Calls of the body are those of the callee, done already */
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			inline_statement(in, b, n);
+		break;
+	case ast_if:
+	case ast_while:
+		inline_statement(in, b, node->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Inline calls of block b, after those of the procedures it calls */
+static void
+inline_block(inline_t *in, int b)
+{
+	if (in->done[b])
+		return;
+	in->done[b] = true;
+	inline_statement(in, b, in->o->ast->blocks[b].body);
+}
+
+void
+opt_inline(ast_t *ast, context_t *context, opt_stats_t *stats)
+{
+	opt_t o = { .ast = ast, .context = context, .stats = stats };
+	inline_t in = { .o = &o };
+
+	in.calls = opt_alloc(&o, ast->block_num, sizeof(int));
+	in.done = opt_alloc(&o, ast->block_num, sizeof(bool));
+	in.recursive = opt_alloc(&o, ast->block_num, sizeof(bool));
+	in.seen = opt_alloc(&o, ast->block_num, sizeof(int));
+	for (int b = 0; b < ast->block_num; b++) {
+		inline_count(&in, ast->blocks[b].body);
+		in.stamp++;
+		in.recursive[b] = inline_reaches(&in, ast->blocks[b].body, b);
+	}
+
+	inline_block(&in, 0);
+
+	free(in.calls);
+	free(in.done);
+	free(in.recursive);
+	free(in.seen);
+	free(in.temp);
+	free(in.temp_stamp);
+	free(in.assigned);
+	free(in.zero);
+	free(in.marked);
+}
+
+void
+opt_run(ast_t *ast, context_t *context, int level, opt_stats_t *stats)
+{
+	if (level < 1)
+		return;
+
+	opt_fold(ast, context, stats);
+	opt_dead(ast, context, stats);
+	if (level >= 2)
+		opt_inline(ast, context, stats);
+	/* Constants and copies found leave more to fold and drop */
+	ir_optimize(ast, context, level, stats);
+	opt_fold(ast, context, stats);
+	opt_dead(ast, context, stats);
+	if (level >= 2)
+		opt_loop(ast, context, stats);
+}
@@ -0,0 +1,101 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPT_H
+#define OPT_H
+
+#include "ast.h"
+
+/* What the passes did, printed with -s */
+typedef struct {
+	/* Expressions folded into numbers */
+	int folded;
+	/* If and while statements of constant conditions */
+	int branches;
+	/* Procedures, and those never called */
+	int procs;
+	int procs_dropped;
+	/* Assignments to variables never read */
+	int stores;
+	/* Statements after loops never ending */
+	int unreachable;
+	/* Invariant expressions moved ahead of loops */
+	int hoisted;
+	/* Multiplications and divisions made cheaper */
+	int reduced;
+	/* Variables added to hold them, or locals of procedures inlined */
+	int temps;
+	/* Calls replaced by the body of the procedure */
+	int inlined;
+	/* SSA values found copies of others, or equal to dominating ones */
+	int copies;
+	int numbered;
+	/* Expressions found constant, or held by a variable already */
+	int constants;
+	int reused;
+} opt_stats_t;
+
+/**
+ * Arithmetic of folding wraps around like the engines do, instead of
+ * overflowing longs of the compiler.
+*/
+long opt_operation(SYMBOL op, long m, long n);
+
+/* Division of m by n that neither fails nor traps */
+bool opt_divisible(long m, long n);
+
+/**
+ * Fold constant subexpressions of a parsed program, apply algebraic
+ * identities, and drop if and while statements whose condition is
+ * constantly false. Runtime errors of the program are kept.
+*/
+void opt_fold(ast_t *ast, context_t *context, opt_stats_t *stats);
+
+/**
+ * Drop procedures never called from the main program, assignments to
+ * variables never read, and statements never reached. Blocks left are
+ * numbered again.
+*/
+void opt_dead(ast_t *ast, context_t *context, opt_stats_t *stats);
+
+/**
+ * Move expressions of while loops whose operands the loop never writes
+ * ahead of it, and replace products of an induction variable stepped by
+ * a constant with a variable stepped along with it. Values computed
+ * once go to new variables of the block of the loop.
+*/
+void opt_loop(ast_t *ast, context_t *context, opt_stats_t *stats);
+
+/**
+ * Replace calls of procedures called once, or small enough, by their
+ * bodies. Locals of the procedure become new variables of the block
+ * calling it. Recursive procedures, and those calling procedures they
+ * declare, are kept.
+*/
+void opt_inline(ast_t *ast, context_t *context, opt_stats_t *stats);
+
+/**
+ * Run the passes of optimization level: none for 0, folding, dead code
+ * and those of SSA form for 1, and inlining, loops and value numbering
+ * too for 2.
+*/
+void opt_run(ast_t *ast, context_t *context, int level, opt_stats_t *stats);
+
+void opt_report(const opt_stats_t *stats, FILE *stream);
+
+#endif /* OPT_H */
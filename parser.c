@@ -23,16 +23,17 @@
 #include "interpreter.h"
 #include "prompt.h"
 #include "context.h"
+#include "intern.h"
 
 static inline void
 invalid_token_tail(const context_t *context, SYMBOL assumed)
 {
-	extern pos_t err;
+	const token_t *token = token_cur(context);
 
 	sprintf(context_top_restrict(context)->message,
 		"syntax:%d:%d: syntax error, expected \"%s\" but got \"%s\"",
-		err.row, err.col, sym2human(assumed),
-		sym2human(context->token_tail->type));
+		token->pos.row, token->pos.col, sym2human(assumed),
+		sym2human(token->type));
 	exit(1);
 }
 
@@ -46,7 +47,7 @@ assert_multi(const context_t *context, int num, ...)
 
 	for (int i = 0; i < num; i++) {
 		sym = va_arg(ap, SYMBOL);
-		if (context->token_tail->type == sym)
+		if (token_cur(context)->type == sym)
 			return;
 	}
 	invalid_token_tail(context, sym);
@@ -59,47 +60,47 @@ parse(context_t *context)
 {
 	ident_t *id;
 
-	if (context->token_tail->type == constsym) { // const
+	if (token_cur(context)->type == constsym) { // const
 		do {
 			assert(context_next(context), ident); // id
-			id = ident_add(context, context->token_tail, constvar);
+			id = ident_add(context, token_cur(context), constvar);
 
 			assert(context_next(context), eql); // =
 
 			assert(context_next(context), number); // 123
-			size_t tmp = atoi(context->token_tail->value);
+			size_t tmp = token_cur(context)->num;
 			ident_assign(context, id, &tmp);
-		} while (context_next(context)->token_tail->type == comma); // ,
+		} while (token_cur(context_next(context))->type == comma); // ,
 
 		assert(context, semicolon); // ;
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			context_prev(context);
 			if (context_top(context)->depth)
 				context_next(context);
 		}
 	}
 
-	if (context->token_tail->type == varsym) { // var
+	if (token_cur(context)->type == varsym) { // var
 		do {
 			assert(context_next(context), ident); // id
-			id = ident_add(context, context->token_tail, variable);
-		} while (context_next(context)->token_tail->type == comma); // ,
+			id = ident_add(context, token_cur(context), variable);
+		} while (token_cur(context_next(context))->type == comma); // ,
 
 		assert(context, semicolon); // ;
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			context_prev(context);
 			if (context_top(context)->depth)
 				context_next(context);
 		}
 	}
 
-	for (; context->token_tail->type == proceduresym;) { // procedure
+	for (; token_cur(context)->type == proceduresym;) { // procedure
 		bool is_multi_lined = false;
 		assert(context_next(context), ident); // id
-		ident_t *id = ident_add(context, context->token_tail, procvar);
+		ident_t *id = ident_add(context, token_cur(context), procvar);
 
 		assert(context_next(context), semicolon); // ;
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			prompt_step_in(context_top(context)->prompt, "proc> ");
 			context_top(context)->depth++;
 			is_multi_lined = true;
@@ -113,13 +114,8 @@ parse(context_t *context)
 		new_context->excute = false;
 		ident_assign(context, id, new_context);
 
-		strcpy(new_context->tokens[0].value,
-		       context->token_tail->value);
-		new_context->tokens[0].type = context->token_tail->type;
-		new_context->token_num++;
-		context_prev(context);
-
 		parse(new_context); // block
+		context->token_pos = new_context->token_pos;
 
 		if (is_multi_lined) {
 			context_top(context)->depth--;
@@ -129,23 +125,23 @@ parse(context_t *context)
 		assert(context, semicolon); // ;
 		context_next(context);
 		new_context->excute = true;
-		new_context->scan = false;
 	}
 
 	parse_statement(context); // a := 1
 
 	/* End of program */
-	if (context->token_tail->type == period) // .
+	if (token_cur(context)->type == period) // .
 		return;
 }
 
 void
 parse_statement(context_t *context)
 {
-	if (context->token_tail->type == ident) { // id
-		ident_t *id = ident_find(context, context->token_tail->value);
+	if (token_cur(context)->type == ident) { // id
+		int name_id = token_cur(context)->num;
+		ident_t *id = ident_lookup(context);
 		if (!id)
-			ident_undefined(context->token_tail->value);
+			ident_undefined(intern_name(name_id));
 
 		assert(context_next(context), becomes); // :=
 		// a + 1
@@ -154,22 +150,41 @@ parse_statement(context_t *context)
 		ident_assign(context, id, &ret);
 	}
 
-	else if (context->token_tail->type == callsym) { // call
+	else if (token_cur(context)->type == callsym) { // call
 		assert(context_next(context), ident); // id
-		ident_t *id = ident_find(context, context->token_tail->value);
-		if (id) {
-			context_t *tmp = (context_t *)id->value;
-			/* TODO not so elegant */
-			token_t t = { .next = tmp->tokens };
-			tmp->token_tail = &t;
-			parse(tmp);
+		int name_id = token_cur(context)->num;
+		ident_t *id = ident_lookup(context);
+		if (!id)
+			ident_undefined(intern_name(name_id));
+		if (id->type != procvar)
+			ident_error(context, "\"%s\" is not a procedure",
+				    intern_name(name_id));
+
+		if (context->excute) {
+			context_t *proc = (context_t *)id->value;
+			/* Tokens of a procedure go with the line declaring it */
+			if (!proc)
+				ident_error(context,
+					    "procedure \"%s\" of an earlier "
+					    "line cannot be called",
+					    intern_name(name_id));
+			/**
+			 * Run the block again from its first token, with its
+			 * idents declared anew. A recursive call comes back
+			 * to where the outer one was.
+			*/
+			int pos = proc->token_pos;
+			proc->token_pos = proc->token_start;
+			ident_reset(proc);
+			parse(proc);
+			proc->token_pos = pos;
 		}
 		context_next(context);
 	}
 
-	else if (context->token_tail->type == beginsym) { // begin
+	else if (token_cur(context)->type == beginsym) { // begin
 		bool is_multi_lined = 0;
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			is_multi_lined = 1;
 			context_top(context)->depth++;
 			prompt_step_in(context_top(context)->prompt, ">> ");
@@ -177,7 +192,7 @@ parse_statement(context_t *context)
 			context_next(context);
 		}
 		parse_statement(context); // a := 1
-		if (is_multi_lined && context->token_tail->type == period) {
+		if (is_multi_lined && token_cur(context)->type == period) {
 			prompt_step_out(context_top(context)->prompt);
 			context_prev(context);
 			context_next(context);
@@ -185,7 +200,7 @@ parse_statement(context_t *context)
 
 		/* Return when got an 'end' symbol,
 			or assumed to be a semicolon with afterward other statements */
-		if (context->token_tail->type == endsym) { // end
+		if (token_cur(context)->type == endsym) { // end
 			if (is_multi_lined) {
 				context_top(context)->depth--;
 			}
@@ -194,12 +209,12 @@ parse_statement(context_t *context)
 		}
 
 		do {
-			if (!(context->token_tail->type == semicolon)) // ;
+			if (!(token_cur(context)->type == semicolon)) // ;
 				invalid_token_tail(context, endsym);
 
 			context_next(context);
 			if (is_multi_lined &&
-			    context->token_tail->type == period) {
+			    token_cur(context)->type == period) {
 				context_prev(context);
 				context_next(context);
 			}
@@ -207,21 +222,22 @@ parse_statement(context_t *context)
 			parse_statement(context); // a := 1
 
 			if (is_multi_lined &&
-			    context->token_tail->type == period) {
+			    token_cur(context)->type == period) {
 				context_top(context)->depth--;
 				prompt_step_out(context_top(context)->prompt);
 				context_prev(context);
 				context_next(context);
 			}
-		} while (context->token_tail->type != endsym); // end
+		} while (token_cur(context)->type != endsym); // end
+		context_next(context);
 	}
 
-	else if (context->token_tail->type == ifsym) { // if
+	else if (token_cur(context)->type == ifsym) { // if
 		bool excute = context->excute;
 		context->excute &= parse_condition(context_next(context));
 		assert(context, thensym); // then
 		/* FIXME this should only be valid in CLI mode */
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			context_prev(context);
 			prompt_step_in(context_top(context)->prompt, "then> ");
 			context_top(context)->depth++;
@@ -234,14 +250,14 @@ parse_statement(context_t *context)
 		context->excute = excute;
 	}
 
-	else if (context->token_tail->type == whilesym) { // while
-		token_t *token_hook = context->token_tail;
+	else if (token_cur(context)->type == whilesym) { // while
+		int hook = context->token_pos, end;
 		bool excute = context->excute;
 		bool is_multi_lined = false;
 		context->excute &= parse_condition(context_next(context));
 
 		assert(context, dosym); // do
-		if (context_next(context)->token_tail->type == period) {
+		if (token_cur(context_next(context))->type == period) {
 			is_multi_lined = true;
 			context_prev(context);
 			prompt_step_in(context_top(context)->prompt, "while> ");
@@ -250,7 +266,7 @@ parse_statement(context_t *context)
 		}
 
 		parse_statement(context);
-		context->scan = false;
+		end = context->token_pos;
 
 		if (is_multi_lined) {
 			context_top(context)->depth--;
@@ -262,46 +278,43 @@ parse_statement(context_t *context)
 			return;
 		}
 
-		context->token_tail = token_hook;
+		context->token_pos = hook;
 		while (context->excute &&
 		       parse_condition(context_next(context))) {
 			assert(context, dosym); // do
 			parse_statement(context_next(context));
-			context->token_tail = token_hook;
+			context->token_pos = hook;
 		};
-		context->scan = true;
-		for (; context->token_tail->next;
-		     context->token_tail = context->token_tail->next)
-			;
+		context->token_pos = end;
 	}
 
-	else if (context->token_tail->type == readsym) { // read
+	else if (token_cur(context)->type == readsym) { // read
 		assert(context_next(context), lparen); // (
 
 		do {
 			assert(context_next(context), ident); // id
 			size_t tmp;
-			ident_t *id =
-				ident_find(context, context->token_tail->value);
+			int name_id = token_cur(context)->num;
+			ident_t *id = ident_lookup(context);
 			if (!id) {
-				ident_undefined(context->token_tail->value);
+				ident_undefined(intern_name(name_id));
 			} else {
 				if (scanf("%ld", &tmp))
 					ident_assign(context, id, &tmp);
 			}
-		} while (context_next(context)->token_tail->type == comma); // ,
+		} while (token_cur(context_next(context))->type == comma); // ,
 
 		assert(context, rparen); // )
 		context_next(context);
 	}
 
-	else if (context->token_tail->type == writesym) { // write
+	else if (token_cur(context)->type == writesym) { // write
 		assert(context_next(context), lparen); // (
 
 		context_next(context);
 		do {
 			parse_expression(context); // a + 1
-		} while (context->token_tail->type == comma); // ,
+		} while (token_cur(context)->type == comma); // ,
 
 		assert(context, rparen); // )
 		context_next(context);
@@ -313,27 +326,28 @@ parse_factor(context_t *context)
 {
 	int ret;
 
-	if (context->token_tail->type == lparen) { // (
+	if (token_cur(context)->type == lparen) { // (
 		ret = parse_expression(context_next(context));
 		assert(context, rparen); // )
 	}
 
-	else if (context->token_tail->type == ident) { // a
-		ident_t *id = ident_find(context, context->token_tail->value);
+	else if (token_cur(context)->type == ident) { // a
+		int name_id = token_cur(context)->num;
+		ident_t *id = ident_lookup(context);
 		if (!id) {
-			ident_undefined(context->token_tail->value);
+			ident_undefined(intern_name(name_id));
 			return 0;
 		}
 		ret = (int)id->value;
 	}
 
-	else if (context->token_tail->type == number) // 1
-		ret = atoi(context->token_tail->value);
+	else if (token_cur(context)->type == number) // 1
+		ret = token_cur(context)->num;
 
 	else {
-		extern pos_t err;
+		pos_t pos = token_cur(context)->pos;
 		sprintf(context_top_restrict(context)->message,
-			"syntax:%d:%d: invalid factor", err.col, err.row);
+			"syntax:%d:%d: invalid factor", pos.row, pos.col);
 		exit(1);
 	}
 
@@ -347,9 +361,9 @@ parse_term(context_t *context)
 
 	for (;;) {
 		context_next(context);
-		if (context->token_tail->type == times ||
-		    context->token_tail->type == slash) { // * or /
-			SYMBOL opt = context->token_tail->type;
+		if (token_cur(context)->type == times ||
+		    token_cur(context)->type == slash) { // * or /
+			SYMBOL opt = token_cur(context)->type;
 			ret = operation(context, ret, opt,
 					parse_factor(context_next(context)));
 			continue;
@@ -358,9 +372,9 @@ parse_term(context_t *context)
 	}
 
 	for (;;) {
-		if (context->token_tail->type == plus ||
-		    context->token_tail->type == minus) { // + and -
-			SYMBOL opt = context->token_tail->type;
+		if (token_cur(context)->type == plus ||
+		    token_cur(context)->type == minus) { // + and -
+			SYMBOL opt = token_cur(context)->type;
 			ret = operation(context, ret, opt,
 					parse_term(context_next(context)));
 			continue;
@@ -374,8 +388,8 @@ parse_term(context_t *context)
 int
 parse_expression(context_t *context)
 {
-	if (context->token_tail->type == plus ||
-	    context->token_tail->type == minus) // + and -
+	if (token_cur(context)->type == plus ||
+	    token_cur(context)->type == minus) // + and -
 		return parse_term(context_next(context)); // a + 1
 	else
 		return parse_term(context); // a + 1
@@ -385,7 +399,7 @@ bool
 parse_condition(context_t *context)
 {
 	int ret;
-	if (context->token_tail->type == oddsym) // odd
+	if (token_cur(context)->type == oddsym) // odd
 		return 0 == parse_expression(context_next(context)); // a + 1
 
 	ret = parse_expression(context); // a + 1
@@ -393,7 +407,7 @@ parse_condition(context_t *context)
 	// = # < <= > >=
 	assert_multi(context, 6, eql, neq, lss, leq, gtr, geq);
 
-	SYMBOL opt = context->token_tail->type;
+	SYMBOL opt = token_cur(context)->type;
 	return condition(context, ret, opt,
 			 parse_expression(context_next(context)));
 }
@@ -28,23 +28,34 @@ prompt_setup(prompt_t *prompt, const char *str)
     memcpy(prompt->buffer, str, len + 1);
     prompt->length[0] = len;
     prompt->depth = 0;
+    prompt->hidden = 0;
 }
 
 void
 prompt_step_in(prompt_t *prompt, const char *str)
 {
 	int depth = prompt->depth;
-	strcat(prompt->buffer, str);
-	prompt->length[depth + 1] = prompt->length[depth] + strlen(str);
+	size_t len = strlen(str);
+
+	if (prompt->hidden || !len ||
+	    prompt->length[depth] + len >= MAX_PROMPT_SIZE) {
+		prompt->hidden++;
+		return;
+	}
 
-	int len = prompt->length[depth + 1];
-	prompt->buffer[len + 1] = 0;
+	strcat(prompt->buffer, str);
+	prompt->length[depth + 1] = prompt->length[depth] + len;
 	prompt->depth++;
 }
 
 void
 prompt_step_out(prompt_t *prompt)
 {
+	if (prompt->hidden) {
+		prompt->hidden--;
+		return;
+	}
+
 	int depth = prompt->depth;
 	int len = prompt->length[depth - 1];
 	prompt->buffer[len] = 0;
@@ -22,12 +22,14 @@
 #include <stddef.h>
 
 #define MAX_PROMPT_SIZE 64
-#define MAX_DEPTH 8
 
 typedef struct {
 	char buffer[MAX_PROMPT_SIZE];
-	size_t length[MAX_DEPTH];
+	/* Length of buffer at each depth, every step adds a char or more */
+	size_t length[MAX_PROMPT_SIZE];
 	int depth;
+	/* Steps past a full buffer, not shown */
+	int hidden;
 } prompt_t;
 
 void prompt_setup(prompt_t *prompt, const char *str);
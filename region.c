@@ -0,0 +1,68 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "region.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void
+region_init(region_t *region)
+{
+	region->chunk = NULL;
+}
+
+void
+region_free(region_t *region)
+{
+	region_chunk_t *chunk = region->chunk;
+
+	while (chunk) {
+		region_chunk_t *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+	region_init(region);
+}
+
+void *
+region_alloc(region_t *region, size_t size)
+{
+	region_chunk_t *chunk = region->chunk;
+	void *ptr;
+
+	/* Keep every object aligned like malloc() */
+	size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+	if (!chunk || chunk->used + size > chunk->size) {
+		size_t cap = chunk ? chunk->size * 2 : REGION_CHUNK_SIZE;
+
+		while (cap < size)
+			cap *= 2;
+		if (!(chunk = malloc(sizeof(region_chunk_t) + cap)))
+			return NULL;
+		chunk->prev = region->chunk;
+		chunk->size = cap;
+		chunk->used = 0;
+		region->chunk = chunk;
+	}
+
+	ptr = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	return memset(ptr, 0, size);
+}
@@ -0,0 +1,50 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+
+/* Size of the first chunk, later chunks double */
+#define REGION_CHUNK_SIZE 0x4000
+
+/* Chunk of a region, objects are carved from data in order */
+typedef struct region_chunk {
+	struct region_chunk *prev;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} region_chunk_t;
+
+/**
+ * Region owning objects of one program. Objects are never freed one
+ * by one, the whole region goes at once.
+*/
+typedef struct {
+	region_chunk_t *chunk;
+} region_t;
+
+void region_init(region_t *region);
+/* Free every object of region */
+void region_free(region_t *region);
+
+/* Zeroed object of size bytes, null if out of memory */
+void *region_alloc(region_t *region, size_t size);
+
+#endif /* REGION_H */
@@ -17,149 +17,465 @@
 */
 
 #include <string.h>
-#include <ctype.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "keywords.h"
+#include "intern.h"
 #include "context.h"
 
-/* Current position and error position */
-pos_t cur, err;
+/**
+ * Scan runs of spaces, identifiers and numbers with SSE2 and AVX2 on
+ * x86-64, define LEX_SCALAR to build the byte loops only.
+*/
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LEX_SCALAR)
+#define LEX_HAVE_SIMD 1
+#include <immintrin.h>
+#else
+#define LEX_HAVE_SIMD 0
+#endif
 
-/* Ident variable */
-char id[MAX_IDENT_SIZE] = "";
-/* Ident length */
-int id_len;
+/* Lexer of getsym(), and tokens it read */
+static lexer_t lexer;
+static lexbuf_t stream;
 
-int
-get_char(context_t *context)
+/* Next char of input, kept inline for the lexer loop */
+static inline int
+lex_getc(lexer_t *lexer)
 {
-	int ch = fgetc(context->instream);
-	cur.col++;
+	input_t *input = lexer->input;
+	int ch;
+
+	if (input)
+		ch = input->pos < input->end ? (unsigned char)*input->pos++ :
+					       EOF;
+	else
+		ch = fgetc(lexer->stream);
+
+	lexer->cur.col++;
 	if (ch == '\n') {
-		cur.row++;
-		cur.col = 0;
+		lexer->cur.row++;
+		lexer->cur.col = 0;
 	}
 	return ch;
 }
 
+static inline void
+lex_ungetc(lexer_t *lexer, int ch)
+{
+	if (!lexer->input)
+		ungetc(ch, lexer->stream);
+	else if (ch != EOF)
+		lexer->input->pos--;
+	lexer->cur.col--;
+	if (ch == '\n')
+		lexer->cur.row--;
+}
+
+/* Point lexer of getsym() to input of context */
+static inline lexer_t *
+lexer_of(context_t *context)
+{
+	lexer.input = context->input;
+	lexer.stream = context->instream;
+	return &lexer;
+}
+
+int
+get_char(context_t *context)
+{
+	return lex_getc(lexer_of(context));
+}
+
 int
 unget_char(context_t *context, int ch)
 {
-	ungetc(ch, context->instream);
-	cur.col--;
-	if (ch == '\n')
-		cur.row--;
+	lex_ungetc(lexer_of(context), ch);
 	return 0;
 }
 
-/* Save symbol to id and return */
-#define SAVE_SYM(str, sym)                                                     \
-	{                                                                      \
-		strcpy(id, str);                                               \
-		return sym;                                                    \
+/* Classes of input chars, for the lexer tables */
+typedef enum {
+	cc_eof,
+	cc_space, // blank and control chars
+	cc_digit, // 0-9
+	cc_alpha, // a-z A-Z
+	cc_colon, // :
+	cc_less, // <
+	cc_greater, // >
+	cc_equal, // =
+	cc_single, // + - * / ( ) , ; . #
+	cc_other, // invalid
+	CC_NUM
+} CHAR_CLASS;
+
+#define X cc_eof
+#define S cc_space
+#define D cc_digit
+#define A cc_alpha
+#define C cc_colon
+#define L cc_less
+#define G cc_greater
+#define E cc_equal
+#define P cc_single
+#define O cc_other
+
+/* Class of each char, indexed by char + 1 so that EOF comes first */
+static const unsigned char char_class[257] = {
+	X, // EOF
+	S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, // 0x00
+	S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, // 0x10
+	S, O, O, P, O, O, O, O, P, P, P, P, P, P, P, P, // 0x20
+	D, D, D, D, D, D, D, D, D, D, C, P, L, E, G, O, // 0x30
+	O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x40
+	A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O, // 0x50
+	O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x60
+	A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O, // 0x70
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x80
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x90
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0xa0
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0xb0
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0xc0
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0xd0
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0xe0
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O  // 0xf0
+};
+
+#undef X
+#undef S
+#undef D
+#undef A
+#undef C
+#undef L
+#undef G
+#undef E
+#undef P
+#undef O
+
+#define char_class(ch) char_class[(ch) + 1]
+
+/* Symbol of one-char tokens */
+static const SYMBOL single_sym[128] = {
+	['+'] = plus,	  ['-'] = minus,     ['*'] = times,
+	['/'] = slash,	  ['('] = lparen,    [')'] = rparen,
+	[','] = comma,	  [';'] = semicolon, ['.'] = period,
+	['#'] = neq,	  ['='] = eql,
+};
+
+/**
+ * States of the lexer DFA, states after LEX_STATES end the token:
+ * lex_take keeps current char in the token, lex_stop pushes it back.
+*/
+typedef enum {
+	lex_start,
+	lex_number,
+	lex_badnum, // number followed by letters
+	lex_ident,
+	lex_colon,
+	lex_less,
+	lex_greater,
+	LEX_STATES,
+	lex_take,
+	lex_stop,
+	lex_error
+} LEX_STATE;
+
+#define NU lex_number
+#define BN lex_badnum
+#define ID lex_ident
+#define CO lex_colon
+#define LE lex_less
+#define GR lex_greater
+#define TK lex_take
+#define ST lex_stop
+#define ER lex_error
+
+/* Next state of each state and char class */
+static const unsigned char lex_dfa[LEX_STATES][CC_NUM] = {
+	/*		eof space digit alpha :   <   >   =   single other */
+	[lex_start] = { ER, ER, NU, ID, CO, LE, GR, TK, TK, ER },
+	[lex_number] = { ST, ST, NU, BN, ST, ST, ST, ST, ST, ST },
+	[lex_badnum] = { ER, ER, BN, BN, ER, ER, ER, ER, ER, ER },
+	[lex_ident] = { ST, ST, ID, ID, ST, ST, ST, ST, ST, ST },
+	[lex_colon] = { ER, ER, ER, ER, ER, ER, ER, TK, ER, ER },
+	[lex_less] = { ST, ST, ST, ST, ST, ST, ST, TK, ST, ST },
+	[lex_greater] = { ST, ST, ST, ST, ST, ST, ST, TK, ST, ST },
+};
+
+#undef NU
+#undef BN
+#undef ID
+#undef CO
+#undef LE
+#undef GR
+#undef TK
+#undef ST
+#undef ER
+
+/* Symbol of a token ended by lex_stop in each state */
+static const SYMBOL lex_stop_sym[LEX_STATES] = {
+	[lex_number] = number,
+	[lex_ident] = ident,
+	[lex_less] = lss,
+	[lex_greater] = gtr,
+};
+
+/* Symbol of a token ended by lex_take in each state */
+static const SYMBOL lex_take_sym[LEX_STATES] = {
+	[lex_colon] = becomes,
+	[lex_less] = leq,
+	[lex_greater] = geq,
+};
+
+/**
+ * Scanners of runs in mapped input, each returns the end of the run
+ * starting at p. Spaces also count newlines into *lines and point
+ * *line to the last one.
+*/
+typedef struct {
+	const char *name;
+	const char *(*space)(const char *p, const char *end, int *lines,
+			     const char **line);
+	const char *(*alnum)(const char *p, const char *end);
+	const char *(*digit)(const char *p, const char *end);
+} scanner_t;
+
+static const char *
+scan_space_scalar(const char *p, const char *end, int *lines,
+		  const char **line)
+{
+	for (; p < end && (unsigned char)*p <= ' '; p++) {
+		if (*p == '\n') {
+			(*lines)++;
+			*line = p;
+		}
 	}
+	return p;
+}
+
+static const char *
+scan_alnum_scalar(const char *p, const char *end)
+{
+	while (p < end && char_class((unsigned char)*p) >= cc_digit &&
+	       char_class((unsigned char)*p) <= cc_alpha)
+		p++;
+	return p;
+}
+
+static const char *
+scan_digit_scalar(const char *p, const char *end)
+{
+	while (p < end && char_class((unsigned char)*p) == cc_digit)
+		p++;
+	return p;
+}
+
+#if LEX_HAVE_SIMD
+#define SCAN(name) scan_##name##_sse2
+#define SCAN_TARGET
+#define SCAN_WIDTH 16
+#define SCAN_VEC __m128i
+#define SCAN_LOAD _mm_loadu_si128
+#define SCAN_SET1 _mm_set1_epi8
+#define SCAN_MIN _mm_min_epu8
+#define SCAN_SUB _mm_sub_epi8
+#define SCAN_OR _mm_or_si128
+#define SCAN_CMPEQ _mm_cmpeq_epi8
+#define SCAN_MOVEMASK _mm_movemask_epi8
+#include "lex_scan.h"
+
+#define SCAN(name) scan_##name##_avx2
+#define SCAN_TARGET __attribute__((target("avx2")))
+#define SCAN_WIDTH 32
+#define SCAN_VEC __m256i
+#define SCAN_LOAD _mm256_loadu_si256
+#define SCAN_SET1 _mm256_set1_epi8
+#define SCAN_MIN _mm256_min_epu8
+#define SCAN_SUB _mm256_sub_epi8
+#define SCAN_OR _mm256_or_si256
+#define SCAN_CMPEQ _mm256_cmpeq_epi8
+#define SCAN_MOVEMASK _mm256_movemask_epi8
+#include "lex_scan.h"
+#endif
+
+/* From slowest to fastest */
+static const scanner_t scanners[] = {
+	{ "scalar", scan_space_scalar, scan_alnum_scalar, scan_digit_scalar },
+#if LEX_HAVE_SIMD
+	{ "sse2", scan_space_sse2, scan_alnum_sse2, scan_digit_sse2 },
+	{ "avx2", scan_space_avx2, scan_alnum_avx2, scan_digit_avx2 },
+#endif
+};
+
+/* Scanner picked for this CPU */
+static const scanner_t *scanner = scanners;
+
+/* Pick the fastest scanner supported by the running CPU */
+static void
+scanner_init()
+{
+	scanner = scanners;
+#if LEX_HAVE_SIMD
+	/* SSE2 is part of x86-64 */
+	scanner = scanners + 1;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scanner = scanners + 2;
+#endif
+}
+
+void
+lexer_init(lexer_t *lexer, input_t *input, FILE *stream)
+{
+	memset(lexer, 0, sizeof(lexer_t));
+	lexer->input = input;
+	lexer->stream = stream;
+	lexer->cur.row = 1;
+	lexer->id = lexer->text;
+	lexer->id_cap = LEX_TEXT_SIZE;
+}
+
+void
+lexer_free(lexer_t *lexer)
+{
+	if (lexer->id != lexer->text)
+		free(lexer->id);
+	lexer->id = lexer->text;
+	lexer->id_cap = LEX_TEXT_SIZE;
+}
+
+/* Double text of a stream token, false if it cannot grow */
+static bool
+lex_grow(lexer_t *lexer)
+{
+	int cap = lexer->id_cap * 2;
+	char *id;
+
+	if (lexer->input)
+		return false;
+	if (lexer->id == lexer->text) {
+		if ((id = malloc(cap)))
+			memcpy(id, lexer->text, LEX_TEXT_SIZE);
+	} else {
+		id = realloc(lexer->id, cap);
+	}
+	if (!id)
+		return false;
+
+	lexer->id = id;
+	lexer->id_cap = cap;
+	return true;
+}
+
+SYMBOL
+lexer_next(lexer_t *lexer)
+{
+	input_t *input = lexer->input;
+	char *id = lexer->id;
+	int ch, state, next, id_len;
+
+	/* Skip spaces of mapped input in bulk, keeping position right */
+	if (input) {
+		const char *line = 0, *pos = input->pos;
+		int lines = 0;
+
+		input->pos = scanner->space(pos, input->end, &lines, &line);
+		if (lines) {
+			lexer->cur.row += lines;
+			lexer->cur.col = input->pos - line - 1;
+		} else {
+			lexer->cur.col += input->pos - pos;
+		}
+	}
+
+	while (char_class(ch = lex_getc(lexer)) == cc_space)
+		;
+
+	lexer->pos = lexer->cur;
+	lexer->start = input ? input->pos - 1 : 0;
+
+	if (ch == EOF) {
+		strcpy(id, "EOF");
+		lexer->id_len = 3;
+		return eof;
+	}
+
+	/* Run the DFA, keeping as much of the token as id can hold */
+	id_len = 0;
+	for (state = lex_start;; state = next) {
+		next = lex_dfa[state][char_class(ch)];
+		if (next >= LEX_STATES)
+			break;
+		if (id_len < lexer->id_cap - 2 || lex_grow(lexer)) {
+			id = lexer->id;
+			id[id_len++] = ch;
+		}
+
+		/* Take the rest of a run of mapped input in bulk */
+		if (input && state == lex_start &&
+		    (next == lex_ident || next == lex_number)) {
+			const char *end =
+				(next == lex_ident ? scanner->alnum :
+						     scanner->digit)(
+					input->pos, input->end);
+			int len = end - input->pos;
+
+			if (len > lexer->id_cap - 2 - id_len)
+				len = lexer->id_cap - 2 - id_len;
+			memcpy(id + id_len, input->pos, len);
+			id_len += len;
+			lexer->cur.col += end - input->pos;
+			input->pos = end;
+		}
+		ch = lex_getc(lexer);
+	}
+
+	switch (next) {
+	case lex_take:
+		id[id_len++] = ch;
+		id[id_len] = 0;
+		lexer->id_len = id_len;
+		return state == lex_start ? single_sym[ch] :
+					    lex_take_sym[state];
+	case lex_stop:
+		id[id_len] = 0;
+		lex_ungetc(lexer, ch);
+		if (state == lex_number) {
+			lexer->num = strtol(id, 0, 10);
+			id_len = sprintf(id, "%ld", lexer->num);
+		}
+		lexer->id_len = id_len;
+		if (state == lex_ident)
+			return key2sym(id, id_len);
+		return lex_stop_sym[state];
+	default:
+		/* Show the rejected char itself */
+		if (state == lex_start)
+			id[id_len++] = ch;
+		id[id_len] = 0;
+		lexer->id_len = id_len;
+		return nul;
+	}
+}
 
 /* Print error info if symbol cannot be recongnized */
 #define invalid_symbol()                                                       \
 	{                                                                      \
 		sprintf(context_top_restrict(context)->message,                \
-			"lex:%d:%d: invalid symbol: %s", err.row, err.col,     \
-			id);                                                   \
+			"lex:%d:%d: invalid symbol: %s", lexer.pos.row,        \
+			lexer.pos.col, lexer.id);                              \
 		exit(1);                                                       \
 	}
 
 SYMBOL
 getsym(context_t *context)
 {
-	int ch;
-
-	while ((ch = get_char(context)) != EOF && ch <= ' ')
-		;
-
-	err.row = cur.row;
-	err.col = cur.col;
-
-	switch (ch) {
-	case EOF:
-		SAVE_SYM("EOF", eof)
-	case '+':
-		SAVE_SYM("+", plus)
-	case '-':
-		SAVE_SYM("-", minus)
-	case '*':
-		SAVE_SYM("*", times)
-	case '/':
-		SAVE_SYM("/", slash)
-	case '(':
-		SAVE_SYM("(", lparen)
-	case ')':
-		SAVE_SYM(")", rparen)
-	case ',':
-		SAVE_SYM(",", comma)
-	case ';':
-		SAVE_SYM(";", semicolon)
-	case '.':
-		SAVE_SYM(".", period)
-	case ':':
-		ch = get_char(context);
-		if (ch == '=') {
-			SAVE_SYM(":=", becomes)
-		} else
-			invalid_symbol();
-	case '=':
-		SAVE_SYM("=", eql)
-	case '#':
-		SAVE_SYM("#", neq)
-	case '<':
-		ch = get_char(context);
-		if (ch == '=') {
-			SAVE_SYM("<=", leq)
-		}
-		unget_char(context, ch);
-		SAVE_SYM("<", lss)
-	case '>':
-		ch = get_char(context);
-		if (ch == '=')
-			SAVE_SYM(">=", geq)
-
-		unget_char(context, ch);
-		SAVE_SYM(">", gtr)
-	default:
-		if (isdigit(ch)) {
-			int num = 0, count = 0;
-			do {
-				num = 10 * num + ch - '0';
-				count++;
-				ch = get_char(context);
-			} while (ch != EOF && isdigit(ch));
-			sprintf(id, "%d", num);
-
-			if (isalpha(ch)) {
-				id[count] = ch;
-				for (ch = get_char(context); isalnum(ch);
-				     ch = get_char(context))
-					id[++count] = ch;
-
-				invalid_symbol();
-			}
-			unget_char(context, ch);
-			return number;
-		} else if (isalpha(ch)) {
-			id_len = 0;
-			do {
-				if (id_len < MAX_IDENT_SIZE)
-					id[id_len++] = ch;
-				ch = get_char(context);
-			} while (ch != EOF && isalnum(ch));
-			id[id_len] = 0;
-
-			unget_char(context, ch);
-			return key2sym(id);
-		}
+	SYMBOL sym = lexer_next(lexer_of(context));
 
+	if (sym == nul)
 		invalid_symbol();
-	}
+	return sym;
 }
 
 const char *
@@ -176,6 +492,8 @@ sym2human(SYMBOL sym)
 		return "*";
 	case slash:
 		return "/";
+	case percent:
+		return "%";
 	case lparen:
 		return "(";
 	case rparen:
@@ -239,48 +557,93 @@ sym2human(SYMBOL sym)
 void
 token_init()
 {
-	cur.row = 1;
-	cur.col = 0;
+	lexer_free(&lexer);
+	lexer_init(&lexer, 0, 0);
+	lexbuf_free(&stream);
+	intern_reset();
+	scanner_init();
+}
+
+lexbuf_t *
+token_stream()
+{
+	return &stream;
 }
 
 void
 token_add(context_t *context, int flag)
 {
-	token_t *t;
-	if (context->token_num < PREALLOC_SYM_NUM) {
-		t = context->tokens + context->token_num;
-	} else {
-		t = malloc(sizeof(token_t));
-		if (!t) {
-			sprintf(context_top_restrict(context)->message,
-				"Out of memory");
-			exit(1);
-		}
-	}
-
-	t->type = flag;
-	int len = strlen(id);
-	memcpy(t->value, id, len + 1);
-
-	context->token_last_tail = context->token_tail;
-	context->token_tail->next = t;
-	context->token_tail = t;
+	long num = flag == ident ? intern(lexer.id, lexer.id_len) : lexer.num;
 
-	context->token_num++;
+	if ((flag == ident && num < 0) ||
+	    !lexbuf_push(context->lexbuf, flag, lexer.pos, num, lexer.id,
+			 lexer.id_len)) {
+		sprintf(context_top_restrict(context)->message,
+			"Out of memory");
+		exit(1);
+	}
 }
 
 void
 token_dump(context_t *context)
 {
-	const token_t *t = context->tokens;
+	const lexbuf_t *buf = context->lexbuf;
+	char name[LEX_TEXT_SIZE];
 
 	printf("+-----+--------------------+--------------------+\n"
 	       "|%4s |%19s |%19s |\n"
 	       "+-----+--------------------+--------------------+\n",
 	       "No", "Symbol", "Symbol Type");
-	for (int i = 1; i < context->token_num; i++) {
-		printf("|%4d |%19s |%19s |\n", i, t->value, sym2human(t->type));
-		t = t->next;
+	for (int i = 0; i < buf->num; i++) {
+		lexbuf_name(buf, buf->tokens + i, name, sizeof(name));
+		printf("|%4d |%19s |%19s |\n", i + 1, name,
+		       sym2human(buf->tokens[i].type));
 	}
 	printf("+-----+--------------------+--------------------+\n");
-}
\ No newline at end of file
+}
+
+/* Lex the whole mapped input again until a second has passed */
+static void
+token_bench_one(context_t *context)
+{
+	input_t *input = context->input;
+	struct timespec start, end;
+	long tokens = 0, passes = 0;
+	lexer_t lexer;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		input->pos = input->base;
+		lexer_init(&lexer, input, 0);
+		while (lexer_next(&lexer) > eof)
+			tokens++;
+		passes++;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 +
+		     (end.tv_nsec - start.tv_nsec);
+	} while (ns < 1e9);
+
+	fprintf(stderr, "%-8s %ld tokens in %ld passes, %.2f Mtokens/s, "
+			"%.1f MB/s\n",
+		scanner->name, tokens, passes, tokens / ns * 1e3,
+		(input->end - input->base) * passes / ns * 1e3);
+}
+
+void
+token_bench(context_t *context)
+{
+	const scanner_t *best;
+
+	if (!context->input) {
+		sprintf(context_top_restrict(context)->message,
+			"lex: benchmark needs a regular input file");
+		exit(1);
+	}
+
+	/* Each scanner up to the one this CPU supports */
+	best = scanner;
+	for (scanner = scanners; scanner <= best; scanner++)
+		token_bench_one(context);
+	scanner = best;
+}
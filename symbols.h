@@ -21,8 +21,11 @@
 
 #include <stdio.h>
 
-/* Max length of an ident */
-#define MAX_IDENT_SIZE 20
+/**
+ * Text kept by the lexer for a token of mapped input, which is a span
+ * of input anyway. Enough for keywords and any long.
+*/
+#define LEX_TEXT_SIZE 32
 
 /* Enumulate of all the symbols */
 typedef enum {
@@ -32,6 +35,7 @@ typedef enum {
 	minus, // -
 	times, // *
 	slash, // /
+	percent, // %, remainder made by optimizer only
 	lparen, // (
 	rparen, // )
 	comma, // ,
@@ -67,11 +71,57 @@ typedef struct {
 	int col;
 } pos_t;
 
-/* Chain node of symbols */
+/* Input file mapped into memory */
+typedef struct {
+	const char *base;
+	/* Next char to read */
+	const char *pos;
+	const char *end;
+} input_t;
+
+/**
+ * State of a lexer, one for each thread lexing. Reads mapped input,
+ * or stream if input is null.
+*/
+typedef struct {
+	input_t *input;
+	FILE *stream;
+	/* Current position, and position of last token */
+	pos_t cur;
+	pos_t pos;
+	/* Start of last token in mapped input */
+	const char *start;
+	/**
+	 * Text of last token in id, of id_cap bytes. Grows out of text
+	 * for a stream, truncated to fit for mapped input.
+	*/
+	char *id;
+	int id_len;
+	int id_cap;
+	char text[LEX_TEXT_SIZE];
+	/* Value of last number */
+	long num;
+} lexer_t;
+
+void lexer_init(lexer_t *lexer, input_t *input, FILE *stream);
+/* Free text grown for a long token of a stream */
+void lexer_free(lexer_t *lexer);
+/**
+ * Scan next token. Return nul for an invalid symbol, with its text
+ * in id, and leave the lexer there.
+*/
+SYMBOL lexer_next(lexer_t *lexer);
+
+/* Token, its text is a span of input */
 typedef struct {
-	char value[MAX_IDENT_SIZE];
 	SYMBOL type;
-	void *next;
+	/* Length of its text */
+	int len;
+	/* Offset of its text */
+	size_t offset;
+	pos_t pos;
+	/* Value of number, or intern id of ident */
+	long num;
 } token_t;
 
 #endif /* SYMBOLS_H */
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Run each tests/*.pl0 with every engine at every -O level, as a native
+# executable too, and report each whose output and runtime error differ
+# from the .out file next to it.
+#
+# Usage: tests/run.sh [analyzer]
+
+analyzer=${1:-./analyzer}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail=0
+
+# Output then errors of a command, which flush in either order
+run() {
+	timeout 20 "$@" </dev/null >"$dir/out" 2>"$dir/err"
+	cat "$dir/out" "$dir/err"
+}
+
+for test in "$(dirname "$0")"/*.pl0; do
+	expected=$(cat "${test%.pl0}.out")
+
+	for level in 0 1 2; do
+		for engine in ast closure vm jit tier "tier -P 1 -L 1"; do
+			out=$(run "$analyzer" -O $level -e $engine "$test")
+			[ "$out" = "$expected" ] && continue
+			echo "$test: -O $level -e $engine differs"
+			fail=1
+		done
+
+		out=$("$analyzer" -O $level -c "$dir/p" "$test" 2>&1 &&
+		      run "$dir/p")
+		if [ "$out" != "$expected" ]; then
+			echo "$test: -O $level -c differs"
+			fail=1
+		fi
+	done
+done
+
+exit $fail
@@ -0,0 +1,358 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tier.h"
+#include "jit.h"
+#include "arith.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Longs in the first chunk of records */
+#define TIER_CHUNK_SIZE 0x1000
+
+/**
+ * Records of interpreted activations are laid out like frames of native
+ * code, so either tier reaches variables of the other through static
+ * links. They are carved from chunks that never move, as native code
+ * holds pointers to them.
+*/
+typedef struct tier_chunk {
+	struct tier_chunk *next;
+	long *end;
+	long data[];
+} tier_chunk_t;
+
+/* State of tiered execution */
+typedef struct {
+	const ast_t *ast;
+	context_t *context;
+	const tier_config_t *config;
+	tier_stats_t *stats;
+
+	jit_t jit[1];
+	/* Entry native code calls each block through */
+	jit_entry_t *entries;
+	/* Native code of each block, null while interpreted */
+	jit_entry_t *procs;
+	/* Calls of each block so far */
+	long *calls;
+	/* Iterations and native code of each while node */
+	struct {
+		long count;
+		jit_entry_t code;
+	} * loops;
+
+	/* Chunk holding the top of records */
+	tier_chunk_t *chunk;
+	long *top;
+	/**
+	 * Interpreted calls nest on the C stack along with native ones,
+	 * down to the same limit
+	*/
+	const char *stack_limit;
+} tier_t;
+
+/* Tiered execution running, for stubs called by native code */
+static tier_t *tier;
+
+static void
+tier_no_mem(const context_t *context)
+{
+	sprintf(context_top_restrict(context)->message, "Out of memory");
+	exit(1);
+}
+
+static void
+tier_error(const tier_t *t, const node_t *node, const char *msg)
+{
+	snprintf(context_top_restrict(t->context)->message,
+		 MAX_CONTEXT_MSG_SIZE, "runtime:%d:%d: %s", node->pos.row,
+		 node->pos.col, msg);
+	exit(1);
+}
+
+static double
+tier_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Follow static links level blocks out */
+static long *
+tier_frame(long *frame, int level)
+{
+	while (level-- > 0)
+		frame = (long *)frame[-1];
+	return frame;
+}
+
+/* Variable of var or assign node, read from a block of depth */
+static long *
+tier_var(long *frame, int depth, const node_t *node)
+{
+	return tier_frame(frame, depth - node->depth) - 2 - node->slot;
+}
+
+/* Push zeroed record of nvars variables and static link, return frame */
+static long *
+tier_push(tier_t *t, int nvars, long *link)
+{
+	long *frame;
+
+	if (t->top + nvars + 1 > t->chunk->end) {
+		tier_chunk_t *next = t->chunk->next;
+
+		/* Chunks past the top are kept for later calls */
+		if (!next || next->data + nvars + 1 > next->end) {
+			long size = TIER_CHUNK_SIZE;
+
+			while (size < nvars + 1)
+				size *= 2;
+			if (!(next = malloc(sizeof(tier_chunk_t) +
+					    size * sizeof(long))))
+				tier_no_mem(t->context);
+			next->end = next->data + size;
+			next->next = t->chunk->next;
+			t->chunk->next = next;
+		}
+		t->chunk = next;
+		t->top = next->data;
+	}
+
+	memset(t->top, 0, nvars * sizeof(long));
+	t->top += nvars + 1;
+	frame = t->top;
+	frame[-1] = (long)link;
+	return frame;
+}
+
+static long
+tier_expression(const tier_t *t, long *frame, int depth, int n)
+{
+	const node_t *node = t->ast->nodes + n;
+	long m, k;
+
+	switch (node->type) {
+	case ast_num:
+		return node->num;
+	case ast_var:
+		return *tier_var(frame, depth, node);
+	case ast_neg:
+		return arith_neg(tier_expression(t, frame, depth, node->kid[0]));
+	case ast_binop:
+		m = tier_expression(t, frame, depth, node->kid[0]);
+		k = tier_expression(t, frame, depth, node->kid[1]);
+		if ((node->op == slash || node->op == percent) &&
+		    !arith_divisible(m, k))
+			tier_error(t, node, arith_div_error(k));
+		return operation(t->context, m, node->op, k);
+	case ast_odd:
+		return tier_expression(t, frame, depth, node->kid[0]) % 2 != 0;
+	case ast_cond:
+		m = tier_expression(t, frame, depth, node->kid[0]);
+		return condition(t->context, m, node->op,
+				 tier_expression(t, frame, depth,
+						 node->kid[1]));
+	default:
+		tier_error(t, node, "invalid expression");
+		return 0;
+	}
+}
+
+static void tier_call(tier_t *t, long *link, int block);
+
+/* Compile while statement n of block once it looped often enough */
+static jit_entry_t
+tier_loop(tier_t *t, int block, int n)
+{
+	double start;
+
+	if (!JIT_SUPPORTED || ++t->loops[n].count < t->config->loops)
+		return NULL;
+
+	start = tier_clock();
+	t->loops[n].code = jit_compile_loop(t->jit, t->ast, t->context, block,
+					    n, t->entries);
+	t->stats->compile_ns += tier_clock() - start;
+	t->stats->loops++;
+	return t->loops[n].code;
+}
+
+static void
+tier_statement(tier_t *t, long *frame, int block, int n)
+{
+	const ast_t *ast = t->ast;
+	const node_t *node = ast->nodes + n;
+	const node_t *var;
+	int depth = ast->blocks[block].depth;
+	int callee;
+	long tmp;
+
+	switch (node->type) {
+	case ast_none:
+		break;
+	case ast_assign:
+		tmp = tier_expression(t, frame, depth, node->kid[0]);
+		*tier_var(frame, depth, node) = tmp;
+		break;
+	case ast_call:
+		if ((const char *)__builtin_frame_address(0) < t->stack_limit)
+			tier_error(t, node, "too many nested calls");
+		/* Block of a procedure symbol is its body */
+		callee = ast->syms[node->sym].block;
+		tier_call(t,
+			  tier_frame(frame,
+				     depth - ast->blocks[callee].depth + 1),
+			  callee);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			tier_statement(t, frame, block, n);
+		break;
+	case ast_if:
+		if (tier_expression(t, frame, depth, node->kid[0]))
+			tier_statement(t, frame, block, node->kid[1]);
+		break;
+	case ast_while:
+		/* Hot loops go on natively from where they are */
+		if (t->loops[n].code) {
+			t->loops[n].code(frame);
+			break;
+		}
+		while (tier_expression(t, frame, depth, node->kid[0])) {
+			tier_statement(t, frame, block, node->kid[1]);
+			t->stats->iterations++;
+			if (tier_loop(t, block, n)) {
+				t->loops[n].code(frame);
+				break;
+			}
+		}
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = var->next) {
+			var = ast->nodes + n;
+			if (scanf("%ld", &tmp) == 1)
+				*tier_var(frame, depth, var) = tmp;
+		}
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			fprintf(t->context->outstream, "%ld\n",
+				tier_expression(t, frame, depth, n));
+		break;
+	default:
+		tier_error(t, node, "invalid statement");
+	}
+}
+
+/* Call block with static link, compile it once called often enough */
+static void
+tier_call(tier_t *t, long *link, int block)
+{
+	tier_chunk_t *chunk = t->chunk;
+	long *top = t->top;
+
+	if (JIT_SUPPORTED && !t->procs[block] &&
+	    ++t->calls[block] >= t->config->calls) {
+		double start = tier_clock();
+
+		t->procs[block] = jit_compile_proc(t->jit, t->ast, t->context,
+						   block, t->entries);
+		t->entries[block] = t->procs[block];
+		t->stats->compile_ns += tier_clock() - start;
+		t->stats->procs++;
+	}
+
+	if (t->procs[block]) {
+		t->procs[block](link);
+		return;
+	}
+
+	t->stats->calls++;
+	tier_statement(t,
+		       tier_push(t, t->ast->blocks[block].nvars, link),
+		       block, t->ast->blocks[block].body);
+	t->chunk = chunk;
+	t->top = top;
+}
+
+/* Stub of a block native code calls while it is interpreted */
+static void
+tier_enter(long *link, int block)
+{
+	tier_call(tier, link, block);
+}
+
+void
+tier_run(const ast_t *ast, context_t *context, const tier_config_t *config,
+	 tier_stats_t *stats)
+{
+	tier_t t = {
+		.ast = ast, .context = context, .config = config, .stats = stats
+	};
+	tier_chunk_t *first;
+
+	t.entries = calloc(ast->block_num, sizeof(jit_entry_t));
+	t.procs = calloc(ast->block_num, sizeof(jit_entry_t));
+	t.calls = calloc(ast->block_num, sizeof(long));
+	/* Pages of nodes never a while loop are never touched */
+	t.loops = calloc(ast->node_num, sizeof(*t.loops));
+	first = malloc(sizeof(tier_chunk_t) + TIER_CHUNK_SIZE * sizeof(long));
+	if (!t.entries || !t.procs || !t.calls || !t.loops || !first)
+		tier_no_mem(context);
+	first->next = NULL;
+	first->end = first->data + TIER_CHUNK_SIZE;
+	t.chunk = first;
+	t.top = first->data;
+
+	tier = &t;
+	t.stack_limit = jit_stack(__builtin_frame_address(0));
+	jit_init(t.jit);
+	if (JIT_SUPPORTED)
+		jit_stubs(t.jit, ast, context, tier_enter, t.entries);
+
+	tier_call(&t, NULL, 0);
+	fflush(context->outstream);
+
+	tier = NULL;
+	jit_free(t.jit);
+	while (first) {
+		tier_chunk_t *next = first->next;
+		free(first);
+		first = next;
+	}
+	free(t.entries);
+	free(t.procs);
+	free(t.calls);
+	free(t.loops);
+}
+
+void
+tier_report(const tier_stats_t *stats, FILE *stream)
+{
+	fprintf(stream,
+		"tier: %lu calls and %lu loop iterations interpreted\n"
+		"tier: %d procedures and %d loops compiled in %.0f us\n",
+		stats->calls, stats->iterations, stats->procs, stats->loops,
+		stats->compile_ns / 1000);
+}
@@ -0,0 +1,58 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIER_H
+#define TIER_H
+
+#include "ast.h"
+
+/* Default calls of a procedure, and iterations of a loop, before JIT */
+#define TIER_CALLS 100
+#define TIER_LOOPS 1000
+
+/* When code moves from the interpreter to native code */
+typedef struct {
+	/* Calls of a procedure interpreted before it is compiled */
+	long calls;
+	/* Iterations of a while loop interpreted before it is compiled */
+	long loops;
+} tier_config_t;
+
+/* What tiered execution did, printed with -s */
+typedef struct {
+	/* Procedures and loops compiled, and time spent on it */
+	int procs;
+	int loops;
+	double compile_ns;
+	/* Calls and loop iterations run by the interpreter */
+	unsigned long calls;
+	unsigned long iterations;
+} tier_stats_t;
+
+/**
+ * Run a parsed program walking the tree, and compile a procedure or a
+ * while loop into native code once it ran as often as config says.
+ * Without a JIT everything stays interpreted.
+*/
+void tier_run(const ast_t *ast, context_t *context,
+	      const tier_config_t *config, tier_stats_t *stats);
+
+/* Print statistics of tier_run */
+void tier_report(const tier_stats_t *stats, FILE *stream);
+
+#endif /* TIER_H */
@@ -0,0 +1,688 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vm.h"
+#include "arith.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VM_PREALLOC_NUM 0x100
+
+/* State of the p-code generator */
+typedef struct {
+	vm_t *vm;
+	const ast_t *ast;
+	context_t *context;
+	/* Block being compiled */
+	int block;
+	/* Entry of each block */
+	int *addr;
+	/* Current depth of expression evaluation */
+	int temps;
+} vm_compiler_t;
+
+static void
+vm_no_mem(const context_t *context)
+{
+	sprintf(context_top_restrict(context)->message, "Out of memory");
+	exit(1);
+}
+
+void
+vm_init(vm_t *vm)
+{
+	memset(vm, 0, sizeof(vm_t));
+}
+
+void
+vm_free(vm_t *vm)
+{
+	free(vm->code);
+	free(vm->pos);
+	vm_init(vm);
+}
+
+/* Append an instruction, return its address */
+static int
+emit(vm_compiler_t *c, OPCODE f, int l, long a, pos_t pos)
+{
+	vm_t *vm = c->vm;
+
+	if (vm->code_num == vm->code_cap) {
+		vm->code_cap = vm->code_cap ? vm->code_cap * 2 :
+					      VM_PREALLOC_NUM;
+		vm->code = realloc(vm->code, vm->code_cap * sizeof(instr_t));
+		vm->pos = realloc(vm->pos, vm->code_cap * sizeof(pos_t));
+		if (!vm->code || !vm->pos)
+			vm_no_mem(c->context);
+	}
+
+	vm->code[vm->code_num].f = f;
+	vm->code[vm->code_num].l = l;
+	vm->code[vm->code_num].a = a;
+	vm->pos[vm->code_num] = pos;
+
+	return vm->code_num++;
+}
+
+/* Track stack usage of expressions */
+static void
+vm_push(vm_compiler_t *c, int num)
+{
+	c->temps += num;
+	if (c->temps > c->vm->max_temps)
+		c->vm->max_temps = c->temps;
+}
+
+/* Level difference between current block and a block of depth */
+static int
+vm_level(const vm_compiler_t *c, int depth)
+{
+	return c->ast->blocks[c->block].depth - depth;
+}
+
+static OPR
+sym2opr(SYMBOL sym)
+{
+	switch (sym) {
+	case plus:
+		return opr_add;
+	case minus:
+		return opr_sub;
+	case times:
+		return opr_mul;
+	case slash:
+		return opr_div;
+	case percent:
+		return opr_mod;
+	case eql:
+		return opr_eql;
+	case neq:
+		return opr_neq;
+	case lss:
+		return opr_lss;
+	case leq:
+		return opr_leq;
+	case gtr:
+		return opr_gtr;
+	case geq:
+		return opr_geq;
+	default:
+		return opr_ret;
+	}
+}
+
+static void
+vm_compile_expression(vm_compiler_t *c, int n)
+{
+	const node_t *node = c->ast->nodes + n;
+
+	switch (node->type) {
+	case ast_num:
+		emit(c, vm_lit, 0, node->num, node->pos);
+		vm_push(c, 1);
+		break;
+	case ast_var:
+		emit(c, vm_lod, vm_level(c, node->depth),
+		     VM_FRAME_HEADER + node->slot, node->pos);
+		vm_push(c, 1);
+		break;
+	case ast_neg:
+		vm_compile_expression(c, node->kid[0]);
+		emit(c, vm_opr, 0, opr_neg, node->pos);
+		break;
+	case ast_odd:
+		vm_compile_expression(c, node->kid[0]);
+		emit(c, vm_opr, 0, opr_odd, node->pos);
+		break;
+	case ast_binop:
+	case ast_cond:
+		vm_compile_expression(c, node->kid[0]);
+		vm_compile_expression(c, node->kid[1]);
+		emit(c, vm_opr, 0, sym2opr(node->op), node->pos);
+		vm_push(c, -1);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+vm_compile_statement(vm_compiler_t *c, int n)
+{
+	const ast_t *ast = c->ast;
+	const node_t *node = ast->nodes + n;
+	int jmp, loop, block;
+
+	switch (node->type) {
+	case ast_assign:
+		vm_compile_expression(c, node->kid[0]);
+		emit(c, vm_sto, vm_level(c, node->depth),
+		     VM_FRAME_HEADER + node->slot, node->pos);
+		vm_push(c, -1);
+		break;
+	case ast_call:
+		/**
+		 * Block of a procedure symbol is its body, one level
+		 * deeper than where it is declared. Address is patched
+		 * once every block is placed.
+		*/
+		block = ast->syms[node->sym].block;
+		emit(c, vm_cal, vm_level(c, ast->blocks[block].depth) + 1,
+		     block, node->pos);
+		break;
+	case ast_begin:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next)
+			vm_compile_statement(c, n);
+		break;
+	case ast_if:
+		vm_compile_expression(c, node->kid[0]);
+		jmp = emit(c, vm_jpc, 0, 0, node->pos);
+		vm_push(c, -1);
+		vm_compile_statement(c, node->kid[1]);
+		c->vm->code[jmp].a = c->vm->code_num;
+		break;
+	case ast_while:
+		loop = c->vm->code_num;
+		vm_compile_expression(c, node->kid[0]);
+		jmp = emit(c, vm_jpc, 0, 0, node->pos);
+		vm_push(c, -1);
+		vm_compile_statement(c, node->kid[1]);
+		emit(c, vm_jmp, 0, loop, node->pos);
+		c->vm->code[jmp].a = c->vm->code_num;
+		break;
+	case ast_read:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			const node_t *var = ast->nodes + n;
+			emit(c, vm_red, vm_level(c, var->depth),
+			     VM_FRAME_HEADER + var->slot, var->pos);
+		}
+		break;
+	case ast_write:
+		for (n = node->kid[0]; n; n = ast->nodes[n].next) {
+			vm_compile_expression(c, n);
+			emit(c, vm_wrt, 0, 0, node->pos);
+			vm_push(c, -1);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* Code of nested procedures goes ahead of the body of block */
+static void
+vm_compile_block(vm_compiler_t *c, int block)
+{
+	const ast_t *ast = c->ast;
+	const ast_block_t *b = ast->blocks + block;
+	int parent = c->block;
+	int jmp = -1;
+
+	for (int s = b->syms; s != -1; s = ast->syms[s].scope_next) {
+		if (ast->syms[s].type != procvar)
+			continue;
+		if (jmp == -1)
+			jmp = emit(c, vm_jmp, 0, 0, (pos_t){ 0 });
+		vm_compile_block(c, ast->syms[s].block);
+	}
+	if (jmp != -1)
+		c->vm->code[jmp].a = c->vm->code_num;
+
+	c->block = block;
+	c->addr[block] = c->vm->code_num;
+	emit(c, vm_int, 0, VM_FRAME_HEADER + b->nvars, (pos_t){ 0 });
+	vm_compile_statement(c, b->body);
+	if (b->parent == -1)
+		emit(c, vm_hlt, 0, 0, (pos_t){ 0 });
+	else
+		emit(c, vm_opr, 0, opr_ret, (pos_t){ 0 });
+	c->block = parent;
+}
+
+void
+vm_compile(vm_t *vm, const ast_t *ast, context_t *context)
+{
+	vm_compiler_t c = { .vm = vm, .ast = ast, .context = context };
+
+	if (!(c.addr = calloc(ast->block_num, sizeof(int))))
+		vm_no_mem(context);
+
+	vm_compile_block(&c, 0);
+
+	for (int i = 0; i < vm->code_num; i++) {
+		if (vm->code[i].f == vm_cal)
+			vm->code[i].a = c.addr[vm->code[i].a];
+	}
+
+	free(c.addr);
+}
+
+static void
+vm_error(const vm_t *vm, context_t *context, int p, const char *msg)
+{
+	snprintf(context_top_restrict(context)->message, MAX_CONTEXT_MSG_SIZE,
+		 "runtime:%d:%d: %s", vm->pos[p].row, vm->pos[p].col, msg);
+	exit(1);
+}
+
+/* Follow static links down l levels */
+static inline int
+base(const long *s, int b, int l)
+{
+	while (l-- > 0)
+		b = s[b];
+	return b;
+}
+
+/* Operations with opr decoded, one for each handler of dispatch loop */
+typedef enum {
+	vm_x_lit,
+	vm_x_lod,
+	vm_x_sto,
+	vm_x_cal,
+	vm_x_int,
+	vm_x_jmp,
+	vm_x_jpc,
+	vm_x_red,
+	vm_x_wrt,
+	vm_x_hlt,
+	vm_x_ret,
+	vm_x_neg,
+	vm_x_add,
+	vm_x_sub,
+	vm_x_mul,
+	vm_x_div,
+	vm_x_odd,
+	vm_x_eql,
+	vm_x_neq,
+	vm_x_lss,
+	vm_x_leq,
+	vm_x_gtr,
+	vm_x_geq,
+	vm_x_mod,
+	/* Superinstructions, see vm_fuse */
+	vm_x_ll_add, // lod, lod, add
+	vm_x_ll_sub,
+	vm_x_ll_mul,
+	vm_x_ll_div,
+	vm_x_ll_mod,
+	vm_x_eql_jpc, // eql, jpc
+	vm_x_neq_jpc,
+	vm_x_lss_jpc,
+	vm_x_leq_jpc,
+	vm_x_gtr_jpc,
+	vm_x_geq_jpc,
+	vm_x_ll_eql_jpc, // lod, lod, eql, jpc
+	vm_x_ll_neq_jpc,
+	vm_x_ll_lss_jpc,
+	vm_x_ll_leq_jpc,
+	vm_x_ll_gtr_jpc,
+	vm_x_ll_geq_jpc,
+	vm_x_odd_jpc, // odd, jpc
+	vm_x_inc, // lod a, lit n, add, sto a
+	vm_x_dec // lod a, lit n, sub, sto a
+} XOPCODE;
+
+#define VM_X_NUM (vm_x_dec + 1)
+
+static const char *const vm_x_names[] = {
+	"lit", "lod", "sto", "cal", "int", "jmp", "jpc", "red", "wrt", "hlt",
+	"ret", "neg", "add", "sub", "mul", "div", "odd", "eql", "neq", "lss",
+	"leq", "gtr", "geq", "mod",
+	"lod.lod.add", "lod.lod.sub", "lod.lod.mul", "lod.lod.div",
+	"lod.lod.mod",
+	"eql.jpc", "neq.jpc", "lss.jpc", "leq.jpc", "gtr.jpc", "geq.jpc",
+	"lod.lod.eql.jpc", "lod.lod.neq.jpc", "lod.lod.lss.jpc",
+	"lod.lod.leq.jpc", "lod.lod.gtr.jpc", "lod.lod.geq.jpc",
+	"odd.jpc", "inc", "dec"
+};
+
+/* Decoded instruction, with handler address for threaded code */
+typedef struct {
+	union {
+		const void *label;
+		XOPCODE op;
+	};
+	int l;
+	long a;
+} vm_thread_t;
+
+/* Test if instruction k is opr of an operation in [first, last] */
+static bool
+vm_is_opr(const vm_t *vm, int k, OPR first, OPR last)
+{
+	return k < vm->code_num && vm->code[k].f == vm_opr &&
+	       vm->code[k].a >= first && vm->code[k].a <= last;
+}
+
+static bool
+vm_is(const vm_t *vm, int k, OPCODE f)
+{
+	return k < vm->code_num && vm->code[k].f == f;
+}
+
+/**
+ * Peephole matching of superinstructions, return the one starting at
+ * instruction k or -1. It only takes the place of instruction k, the
+ * rest of the sequence stays where it was for jumps into the middle
+ * of it, and its handler reads operands from there then skips it.
+*/
+static int
+vm_fuse(const vm_t *vm, int k)
+{
+	const instr_t *i = vm->code + k;
+
+	if (vm_is(vm, k, vm_lod) && vm_is(vm, k + 1, vm_lit) &&
+	    vm_is_opr(vm, k + 2, opr_add, opr_sub) && vm_is(vm, k + 3, vm_sto) &&
+	    i[3].l == i[0].l && i[3].a == i[0].a)
+		return i[2].a == opr_add ? vm_x_inc : vm_x_dec;
+
+	if (vm_is(vm, k, vm_lod) && vm_is(vm, k + 1, vm_lod)) {
+		if (vm_is_opr(vm, k + 2, opr_eql, opr_geq) &&
+		    vm_is(vm, k + 3, vm_jpc))
+			return vm_x_ll_eql_jpc + (i[2].a - opr_eql);
+		if (vm_is_opr(vm, k + 2, opr_add, opr_div))
+			return vm_x_ll_add + (i[2].a - opr_add);
+		if (vm_is_opr(vm, k + 2, opr_mod, opr_mod))
+			return vm_x_ll_mod;
+	}
+
+	if (vm_is_opr(vm, k, opr_eql, opr_geq) && vm_is(vm, k + 1, vm_jpc))
+		return vm_x_eql_jpc + (i->a - opr_eql);
+	if (vm_is_opr(vm, k, opr_odd, opr_odd) && vm_is(vm, k + 1, vm_jpc))
+		return vm_x_odd_jpc;
+
+	return -1;
+}
+
+/**
+ * Translate p-code for a dispatch loop, replace each operation
+ * with its handler if labels is given, and sequences with
+ * superinstructions if fuse.
+*/
+static vm_thread_t *
+vm_decode(const vm_t *vm, context_t *context, const void *const *labels,
+	  bool fuse)
+{
+	vm_thread_t *code;
+
+	if (!(code = malloc(vm->code_num * sizeof(vm_thread_t))))
+		vm_no_mem(context);
+
+	for (int k = 0; k < vm->code_num; k++) {
+		const instr_t *i = vm->code + k;
+		XOPCODE op;
+		int fused;
+
+		switch (i->f) {
+		case vm_opr:
+			op = vm_x_ret + i->a;
+			break;
+		case vm_lit:
+			op = vm_x_lit;
+			break;
+		case vm_lod:
+			op = vm_x_lod;
+			break;
+		case vm_sto:
+			op = vm_x_sto;
+			break;
+		case vm_cal:
+			op = vm_x_cal;
+			break;
+		case vm_int:
+			op = vm_x_int;
+			break;
+		case vm_jmp:
+			op = vm_x_jmp;
+			break;
+		case vm_jpc:
+			op = vm_x_jpc;
+			break;
+		case vm_red:
+			op = vm_x_red;
+			break;
+		case vm_wrt:
+			op = vm_x_wrt;
+			break;
+		case vm_hlt:
+		default:
+			op = vm_x_hlt;
+			break;
+		}
+		if (fuse && (fused = vm_fuse(vm, k)) != -1)
+			op = fused;
+
+		if (labels)
+			code[k].label = labels[op];
+		else
+			code[k].op = op;
+		code[k].l = i->l;
+		code[k].a = i->a;
+	}
+
+	return code;
+}
+
+/* Dispatches counted by the profiling loop */
+typedef struct {
+	unsigned long steps;
+	/* Dispatches of each operation right after another */
+	unsigned long pairs[VM_X_NUM][VM_X_NUM];
+	XOPCODE prev;
+} vm_profile_t;
+
+static inline XOPCODE
+vm_count(vm_profile_t *profile, XOPCODE op)
+{
+	if (profile->steps++)
+		profile->pairs[profile->prev][op]++;
+	profile->prev = op;
+	return op;
+}
+
+#define VM_RUN vm_run_switch
+#define VM_THREADED 0
+#define VM_PROFILE 0
+#include "vm_dispatch.h"
+
+#define VM_RUN vm_run_profile
+#define VM_THREADED 0
+#define VM_PROFILE 1
+#include "vm_dispatch.h"
+
+#if VM_HAVE_THREADED
+#define VM_RUN vm_run_threaded
+#define VM_THREADED 1
+#define VM_PROFILE 0
+#include "vm_dispatch.h"
+#endif
+
+void
+vm_run(const vm_t *vm, context_t *context)
+{
+#if VM_HAVE_THREADED
+	vm_run_threaded(vm, context, true, NULL);
+#else
+	vm_run_switch(vm, context, true, NULL);
+#endif
+}
+
+/* Discard output of program while measuring, return where it went */
+static FILE *
+vm_mute(context_t *context)
+{
+	FILE *outstream = context->outstream;
+
+	if (!(context->outstream = fopen("/dev/null", "w"))) {
+		perror("/dev/null");
+		context->outstream = outstream;
+		return NULL;
+	}
+	return outstream;
+}
+
+static void
+vm_unmute(context_t *context, FILE *outstream)
+{
+	fclose(context->outstream);
+	context->outstream = outstream;
+}
+
+static vm_profile_t *
+vm_profile(const vm_t *vm, context_t *context, bool fuse)
+{
+	vm_profile_t *profile;
+
+	if (!(profile = calloc(1, sizeof(vm_profile_t))))
+		vm_no_mem(context);
+	vm_run_profile(vm, context, fuse, profile);
+	return profile;
+}
+
+static double
+vm_time(void (*run)(const vm_t *, context_t *, bool, vm_profile_t *),
+	const vm_t *vm, context_t *context, bool fuse)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run(vm, context, fuse, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1e9 +
+	       (end.tv_nsec - start.tv_nsec);
+}
+
+void
+vm_bench(const vm_t *vm, context_t *context)
+{
+	FILE *outstream;
+	vm_profile_t *profile;
+	unsigned long steps;
+	double ns;
+
+	if (!(outstream = vm_mute(context)))
+		return;
+
+	profile = vm_profile(vm, context, false);
+	steps = profile->steps;
+	free(profile);
+	profile = vm_profile(vm, context, true);
+	fprintf(stderr,
+		"%lu instructions executed, %lu dispatches with "
+		"superinstructions\n",
+		steps, profile->steps);
+	free(profile);
+
+	/* Time per instruction of p-code, however it was dispatched */
+	for (int fuse = 0; fuse < 2; fuse++) {
+		const char *name = fuse ? "super" : "";
+
+		ns = vm_time(vm_run_switch, vm, context, fuse);
+		fprintf(stderr, "switch %-6s  %10.0f ns, %6.2f ns/op\n", name,
+			ns, ns / steps);
+#if VM_HAVE_THREADED
+		ns = vm_time(vm_run_threaded, vm, context, fuse);
+		fprintf(stderr, "threaded %-6s%10.0f ns, %6.2f ns/op\n", name,
+			ns, ns / steps);
+#else
+		if (!fuse)
+			fprintf(stderr,
+				"threaded: not supported by this build\n");
+#endif
+	}
+
+	vm_unmute(context, outstream);
+}
+
+/* Pair of operations dispatched one after the other */
+typedef struct {
+	unsigned long count;
+	XOPCODE first;
+	XOPCODE second;
+} vm_pair_t;
+
+static int
+vm_pair_cmp(const void *a, const void *b)
+{
+	const vm_pair_t *x = a, *y = b;
+
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+void
+vm_pairs(const vm_t *vm, context_t *context, FILE *stream)
+{
+	FILE *outstream;
+	vm_profile_t *profile;
+	vm_pair_t *pairs;
+	int num = 0;
+
+	if (!(outstream = vm_mute(context)))
+		return;
+	profile = vm_profile(vm, context, true);
+	vm_unmute(context, outstream);
+
+	if (!(pairs = malloc(VM_X_NUM * VM_X_NUM * sizeof(vm_pair_t))))
+		vm_no_mem(context);
+	for (int x = 0; x < VM_X_NUM; x++) {
+		for (int y = 0; y < VM_X_NUM; y++) {
+			if (profile->pairs[x][y])
+				pairs[num++] = (vm_pair_t){
+					profile->pairs[x][y], x, y
+				};
+		}
+	}
+	qsort(pairs, num, sizeof(vm_pair_t), vm_pair_cmp);
+
+	fprintf(stream, "%lu dispatches\n", profile->steps);
+	for (int k = 0; k < num; k++)
+		fprintf(stream, "%12lu %6.2f%%  %s %s\n", pairs[k].count,
+			100.0 * pairs[k].count / profile->steps,
+			vm_x_names[pairs[k].first], vm_x_names[pairs[k].second]);
+
+	free(pairs);
+	free(profile);
+}
+
+static const char *
+vm_name(OPCODE f)
+{
+	static const char *names[] = { "lit", "opr", "lod", "sto",
+				       "cal", "int", "jmp", "jpc",
+				       "red", "wrt", "hlt" };
+	return names[f];
+}
+
+void
+vm_dump(const vm_t *vm, FILE *stream)
+{
+	for (int i = 0; i < vm->code_num; i++) {
+		int fused = vm_fuse(vm, i);
+
+		fprintf(stream, "%5d %s %d, %ld", i, vm_name(vm->code[i].f),
+			vm->code[i].l, vm->code[i].a);
+		if (fused != -1)
+			fprintf(stream, "\t%s", vm_x_names[fused]);
+		fputc('\n', stream);
+	}
+}
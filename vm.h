@@ -0,0 +1,110 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VM_H
+#define VM_H
+
+#include "ast.h"
+
+/* Instructions of p-code */
+typedef enum {
+	vm_lit, // lit 0, n: push n
+	vm_opr, // opr 0, m: operation m on top of stack
+	vm_lod, // lod l, a: push variable a of level l
+	vm_sto, // sto l, a: pop into variable a of level l
+	vm_cal, // cal l, a: call procedure at a with static link of level l
+	vm_int, // int 0, n: allocate n slots
+	vm_jmp, // jmp 0, a: jump to a
+	vm_jpc, // jpc 0, a: pop, jump to a if zero
+	vm_red, // red l, a: read into variable a of level l
+	vm_wrt, // wrt 0, 0: pop and write
+	vm_hlt // hlt 0, 0: end of program
+} OPCODE;
+
+/* Operations of opr */
+typedef enum {
+	opr_ret, // return from procedure
+	opr_neg, // -
+	opr_add, // +
+	opr_sub, // -
+	opr_mul, // *
+	opr_div, // /
+	opr_odd, // odd
+	opr_eql, // =
+	opr_neq, // #
+	opr_lss, // <
+	opr_leq, // <=
+	opr_gtr, // >
+	opr_geq, // >=
+	opr_mod // %
+} OPR;
+
+/**
+ * Dispatch with computed goto on GCC compatible compilers,
+ * define VM_SWITCH to force the portable switch loop.
+*/
+#if defined(__GNUC__) && !defined(VM_SWITCH)
+#define VM_HAVE_THREADED 1
+#else
+#define VM_HAVE_THREADED 0
+#endif
+
+/* Static link, dynamic link and return address ahead of variables */
+#define VM_FRAME_HEADER 3
+#define VM_STACK_SIZE 0x1000
+
+typedef struct {
+	OPCODE f;
+	/* Level difference */
+	int l;
+	/* Literal, address or operation */
+	long a;
+} instr_t;
+
+typedef struct {
+	instr_t *code;
+	/* Source position of each instruction, for runtime errors */
+	pos_t *pos;
+	int code_num;
+	int code_cap;
+
+	/* Deepest expression evaluation, besides frames */
+	int max_temps;
+} vm_t;
+
+void vm_init(vm_t *vm);
+void vm_free(vm_t *vm);
+
+/* Translate a parsed program into p-code */
+void vm_compile(vm_t *vm, const ast_t *ast, context_t *context);
+/* Run p-code */
+void vm_run(const vm_t *vm, context_t *context);
+/**
+ * Run p-code with each dispatch loop, with and without superinstructions,
+ * report ns per instruction.
+*/
+void vm_bench(const vm_t *vm, context_t *context);
+/**
+ * Run p-code counting operations dispatched right after one another,
+ * print the pairs by frequency as candidates for superinstructions.
+*/
+void vm_pairs(const vm_t *vm, context_t *context, FILE *stream);
+/* Print p-code listing, with the superinstruction starting at each */
+void vm_dump(const vm_t *vm, FILE *stream);
+
+#endif /* VM_H */
@@ -0,0 +1,293 @@
+/*
+    PL0-Analyzer -- A simple PL0 lexical & syntex analyzer
+    Copyright 2020  Shuaicheng Zhu
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Dispatch loop of p-code, included by vm.c once for each flavor.
+ * Define before including:
+ * 	VM_RUN		name of the function
+ * 	VM_THREADED	1 for computed goto, 0 for switch
+ * 	VM_PROFILE	1 to count dispatches into *profile
+*/
+
+static void
+VM_RUN(const vm_t *vm, context_t *context, bool fuse, vm_profile_t *profile)
+{
+	int size = VM_STACK_SIZE;
+	int b = 1, t = 0;
+	long *s, tmp;
+	vm_thread_t *code, *i, *ip;
+
+#if !VM_PROFILE
+	(void)profile;
+#endif
+
+#if VM_THREADED
+	static const void *const labels[] = {
+		[vm_x_lit] = &&L_vm_x_lit, [vm_x_lod] = &&L_vm_x_lod,
+		[vm_x_sto] = &&L_vm_x_sto, [vm_x_cal] = &&L_vm_x_cal,
+		[vm_x_int] = &&L_vm_x_int, [vm_x_jmp] = &&L_vm_x_jmp,
+		[vm_x_jpc] = &&L_vm_x_jpc, [vm_x_red] = &&L_vm_x_red,
+		[vm_x_wrt] = &&L_vm_x_wrt, [vm_x_hlt] = &&L_vm_x_hlt,
+		[vm_x_ret] = &&L_vm_x_ret, [vm_x_neg] = &&L_vm_x_neg,
+		[vm_x_add] = &&L_vm_x_add, [vm_x_sub] = &&L_vm_x_sub,
+		[vm_x_mul] = &&L_vm_x_mul, [vm_x_div] = &&L_vm_x_div,
+		[vm_x_odd] = &&L_vm_x_odd, [vm_x_eql] = &&L_vm_x_eql,
+		[vm_x_neq] = &&L_vm_x_neq, [vm_x_lss] = &&L_vm_x_lss,
+		[vm_x_leq] = &&L_vm_x_leq, [vm_x_gtr] = &&L_vm_x_gtr,
+		[vm_x_geq] = &&L_vm_x_geq, [vm_x_mod] = &&L_vm_x_mod,
+		[vm_x_ll_add] = &&L_vm_x_ll_add,
+		[vm_x_ll_sub] = &&L_vm_x_ll_sub,
+		[vm_x_ll_mul] = &&L_vm_x_ll_mul,
+		[vm_x_ll_div] = &&L_vm_x_ll_div,
+		[vm_x_ll_mod] = &&L_vm_x_ll_mod,
+		[vm_x_eql_jpc] = &&L_vm_x_eql_jpc,
+		[vm_x_neq_jpc] = &&L_vm_x_neq_jpc,
+		[vm_x_lss_jpc] = &&L_vm_x_lss_jpc,
+		[vm_x_leq_jpc] = &&L_vm_x_leq_jpc,
+		[vm_x_gtr_jpc] = &&L_vm_x_gtr_jpc,
+		[vm_x_geq_jpc] = &&L_vm_x_geq_jpc,
+		[vm_x_ll_eql_jpc] = &&L_vm_x_ll_eql_jpc,
+		[vm_x_ll_neq_jpc] = &&L_vm_x_ll_neq_jpc,
+		[vm_x_ll_lss_jpc] = &&L_vm_x_ll_lss_jpc,
+		[vm_x_ll_leq_jpc] = &&L_vm_x_ll_leq_jpc,
+		[vm_x_ll_gtr_jpc] = &&L_vm_x_ll_gtr_jpc,
+		[vm_x_ll_geq_jpc] = &&L_vm_x_ll_geq_jpc,
+		[vm_x_odd_jpc] = &&L_vm_x_odd_jpc,
+		[vm_x_inc] = &&L_vm_x_inc, [vm_x_dec] = &&L_vm_x_dec,
+	};
+#define CASE(op) L_##op
+#define NEXT() goto *(i = ip++)->label
+#define DISPATCH() NEXT();
+	code = vm_decode(vm, context, labels, fuse);
+#else
+	code = vm_decode(vm, context, NULL, fuse);
+#define CASE(op) case op
+#define NEXT() continue
+#if VM_PROFILE
+#define DISPATCH() for (;;) switch (vm_count(profile, (i = ip++)->op))
+#else
+#define DISPATCH() for (;;) switch ((i = ip++)->op)
+#endif
+#endif
+
+/* Variable loaded by lod instruction x */
+#define LOD(x) s[base(s, b, (x).l) + (x).a]
+/* Condition on the stack, or of two lod ahead of it, then its jpc */
+#define CMP_JPC(rel)                                                           \
+	t -= 2;                                                                \
+	ip = s[t + 1] rel s[t + 2] ? i + 2 : code + i[1].a;                    \
+	NEXT()
+#define LL_JPC(rel)                                                            \
+	ip = LOD(i[0]) rel LOD(i[1]) ? i + 4 : code + i[3].a;                  \
+	NEXT()
+
+	if (!(s = malloc(size * sizeof(long))))
+		vm_no_mem(context);
+	s[1] = s[2] = s[3] = 0;
+	ip = code;
+
+	DISPATCH()
+	{
+	CASE(vm_x_lit):
+		s[++t] = i->a;
+		NEXT();
+	CASE(vm_x_lod):
+		s[t + 1] = s[base(s, b, i->l) + i->a];
+		t++;
+		NEXT();
+	CASE(vm_x_sto):
+		s[base(s, b, i->l) + i->a] = s[t];
+		t--;
+		NEXT();
+	CASE(vm_x_cal):
+		s[t + 1] = base(s, b, i->l);
+		s[t + 2] = b;
+		s[t + 3] = ip - code;
+		b = t + 1;
+		ip = code + i->a;
+		NEXT();
+	CASE(vm_x_int):
+		t += i->a;
+		/* Room for the deepest expression and the next frame */
+		if (t + vm->max_temps + VM_FRAME_HEADER >= size) {
+			while (t + vm->max_temps + VM_FRAME_HEADER >= size)
+				size *= 2;
+			if (!(s = realloc(s, size * sizeof(long))))
+				vm_no_mem(context);
+		}
+		/* Every activation starts with zeroed variables */
+		memset(s + b + VM_FRAME_HEADER, 0,
+		       (i->a - VM_FRAME_HEADER) * sizeof(long));
+		NEXT();
+	CASE(vm_x_jmp):
+		ip = code + i->a;
+		NEXT();
+	CASE(vm_x_jpc):
+		if (!s[t--])
+			ip = code + i->a;
+		NEXT();
+	CASE(vm_x_red):
+		if (scanf("%ld", &tmp) == 1)
+			s[base(s, b, i->l) + i->a] = tmp;
+		NEXT();
+	CASE(vm_x_wrt):
+		fprintf(context->outstream, "%ld\n", s[t--]);
+		NEXT();
+	CASE(vm_x_ret):
+		t = b - 1;
+		ip = code + s[t + 3];
+		b = s[t + 2];
+		NEXT();
+	CASE(vm_x_neg):
+		s[t] = arith_neg(s[t]);
+		NEXT();
+	CASE(vm_x_add):
+		t--;
+		s[t] = arith_add(s[t], s[t + 1]);
+		NEXT();
+	CASE(vm_x_sub):
+		t--;
+		s[t] = arith_sub(s[t], s[t + 1]);
+		NEXT();
+	CASE(vm_x_mul):
+		t--;
+		s[t] = arith_mul(s[t], s[t + 1]);
+		NEXT();
+	CASE(vm_x_div):
+		t--;
+		if (!arith_divisible(s[t], s[t + 1]))
+			vm_error(vm, context, i - code,
+				 arith_div_error(s[t + 1]));
+		s[t] = s[t] / s[t + 1];
+		NEXT();
+	CASE(vm_x_mod):
+		t--;
+		if (!arith_divisible(s[t], s[t + 1]))
+			vm_error(vm, context, i - code,
+				 arith_div_error(s[t + 1]));
+		s[t] = s[t] % s[t + 1];
+		NEXT();
+	CASE(vm_x_odd):
+		s[t] = s[t] % 2 != 0;
+		NEXT();
+	CASE(vm_x_eql):
+		t--;
+		s[t] = s[t] == s[t + 1];
+		NEXT();
+	CASE(vm_x_neq):
+		t--;
+		s[t] = s[t] != s[t + 1];
+		NEXT();
+	CASE(vm_x_lss):
+		t--;
+		s[t] = s[t] < s[t + 1];
+		NEXT();
+	CASE(vm_x_leq):
+		t--;
+		s[t] = s[t] <= s[t + 1];
+		NEXT();
+	CASE(vm_x_gtr):
+		t--;
+		s[t] = s[t] > s[t + 1];
+		NEXT();
+	CASE(vm_x_geq):
+		t--;
+		s[t] = s[t] >= s[t + 1];
+		NEXT();
+	CASE(vm_x_ll_add):
+		s[++t] = arith_add(LOD(i[0]), LOD(i[1]));
+		ip = i + 3;
+		NEXT();
+	CASE(vm_x_ll_sub):
+		s[++t] = arith_sub(LOD(i[0]), LOD(i[1]));
+		ip = i + 3;
+		NEXT();
+	CASE(vm_x_ll_mul):
+		s[++t] = arith_mul(LOD(i[0]), LOD(i[1]));
+		ip = i + 3;
+		NEXT();
+	CASE(vm_x_ll_div):
+		tmp = LOD(i[1]);
+		if (!arith_divisible(LOD(i[0]), tmp))
+			vm_error(vm, context, i + 2 - code,
+				 arith_div_error(tmp));
+		s[++t] = LOD(i[0]) / tmp;
+		ip = i + 3;
+		NEXT();
+	CASE(vm_x_ll_mod):
+		tmp = LOD(i[1]);
+		if (!arith_divisible(LOD(i[0]), tmp))
+			vm_error(vm, context, i + 2 - code,
+				 arith_div_error(tmp));
+		s[++t] = LOD(i[0]) % tmp;
+		ip = i + 3;
+		NEXT();
+	CASE(vm_x_eql_jpc):
+		CMP_JPC(==);
+	CASE(vm_x_neq_jpc):
+		CMP_JPC(!=);
+	CASE(vm_x_lss_jpc):
+		CMP_JPC(<);
+	CASE(vm_x_leq_jpc):
+		CMP_JPC(<=);
+	CASE(vm_x_gtr_jpc):
+		CMP_JPC(>);
+	CASE(vm_x_geq_jpc):
+		CMP_JPC(>=);
+	CASE(vm_x_ll_eql_jpc):
+		LL_JPC(==);
+	CASE(vm_x_ll_neq_jpc):
+		LL_JPC(!=);
+	CASE(vm_x_ll_lss_jpc):
+		LL_JPC(<);
+	CASE(vm_x_ll_leq_jpc):
+		LL_JPC(<=);
+	CASE(vm_x_ll_gtr_jpc):
+		LL_JPC(>);
+	CASE(vm_x_ll_geq_jpc):
+		LL_JPC(>=);
+	CASE(vm_x_odd_jpc):
+		ip = s[t--] % 2 != 0 ? i + 2 : code + i[1].a;
+		NEXT();
+	CASE(vm_x_inc):
+		LOD(i[0]) = arith_add(LOD(i[0]), i[1].a);
+		ip = i + 4;
+		NEXT();
+	CASE(vm_x_dec):
+		LOD(i[0]) = arith_sub(LOD(i[0]), i[1].a);
+		ip = i + 4;
+		NEXT();
+	CASE(vm_x_hlt):
+		goto halt;
+	}
+
+halt:
+	fflush(context->outstream);
+	free(code);
+	free(s);
+}
+
+#undef CASE
+#undef NEXT
+#undef DISPATCH
+#undef LOD
+#undef CMP_JPC
+#undef LL_JPC
+#undef VM_RUN
+#undef VM_THREADED
+#undef VM_PROFILE